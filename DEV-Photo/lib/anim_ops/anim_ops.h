@@ -0,0 +1,91 @@
+// GIF动画的绘制指令: 第一遍解码时录制, 之后的循环直接回放. 不依赖Arduino,
+// 主机上的单元测试(test/test_anim_replay)直接包含本文件
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// 指令(小端):
+//   'R' x y n + n个像素   一段不透明像素(已是面板字节序)
+//   'F' x y w h           填黑, 对应处置方式2
+//   'E' 延时ms            帧结束
+#define ANIM_OP_RUN  'R'
+#define ANIM_OP_FILL 'F'
+#define ANIM_OP_END  'E'
+#define ANIM_OP_RUN_SIZE  7
+#define ANIM_OP_FILL_SIZE 9
+#define ANIM_OP_END_SIZE  3
+
+inline void animPut16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+inline uint16_t animGet16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+inline size_t animOpRun(uint8_t* op, int16_t x, int16_t y, uint16_t n) {
+    op[0] = ANIM_OP_RUN;
+    animPut16(op + 1, x);
+    animPut16(op + 3, y);
+    animPut16(op + 5, n);
+    return ANIM_OP_RUN_SIZE;
+}
+
+inline size_t animOpFill(uint8_t* op, int16_t x, int16_t y, int16_t w, int16_t h) {
+    op[0] = ANIM_OP_FILL;
+    animPut16(op + 1, x);
+    animPut16(op + 3, y);
+    animPut16(op + 5, w);
+    animPut16(op + 7, h);
+    return ANIM_OP_FILL_SIZE;
+}
+
+inline size_t animOpEnd(uint8_t* op, int delayMs) {
+    op[0] = ANIM_OP_END;
+    animPut16(op + 1, delayMs);
+    return ANIM_OP_END_SIZE;
+}
+
+// 把一行调色板索引拆成不透明像素段: 每段查表写入line[0..n), 再调用emit(段起点, n)
+template<typename Emit>
+void animSplitRuns(const uint8_t* px, int w, bool hasTransparency, uint8_t transparent,
+                   const uint16_t* palette, uint16_t* line, Emit emit) {
+    int i = 0;
+    while(i < w) {
+        if(hasTransparency && px[i] == transparent) {
+            i++;
+            continue;
+        }
+        int start = i;
+        while(i < w && !(hasTransparency && px[i] == transparent)) {
+            line[i - start] = palette[px[i]];
+            i++;
+        }
+        emit(start, (uint16_t)(i - start));
+    }
+}
+
+// 回放一帧: 从in读取指令直到帧结束, 返回帧延时.
+// Reader::read(buf, n)按顺序(循环)读取录制内容; Panel::run(x, y, n, px)推送一段像素(px可被修改),
+// Panel::fill(x, y, w, h)填黑. line至少容纳一行
+template<typename Reader, typename Panel>
+int animReplayFrame(Reader& in, Panel& panel, uint16_t* line) {
+    uint8_t op[ANIM_OP_FILL_SIZE];
+    for(;;) {
+        in.read(op, 1);
+        if(op[0] == ANIM_OP_END) {
+            in.read(op, ANIM_OP_END_SIZE - 1);
+            return animGet16(op);
+        }
+        if(op[0] == ANIM_OP_FILL) {
+            in.read(op, ANIM_OP_FILL_SIZE - 1);
+            panel.fill(animGet16(op), animGet16(op + 2), animGet16(op + 4), animGet16(op + 6));
+            continue;
+        }
+        in.read(op, ANIM_OP_RUN_SIZE - 1);
+        uint16_t n = animGet16(op + 4);
+        in.read(line, n * sizeof(uint16_t));
+        panel.run(animGet16(op), animGet16(op + 2), n, line);
+    }
+}
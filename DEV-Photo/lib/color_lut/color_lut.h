@@ -0,0 +1,45 @@
+// 色彩查找表: 亮度、暖色调和gamma都是逐通道的变换, 用R/G/B三张小表(32/64/32项, 共256字节)
+// 代替整张RGB565表(128KB). 表项预先移位并交换字节, 已交换字节的像素查三次表、两次或即可.
+// 不依赖Arduino, 主机上的单元测试(test/test_color_lut)直接包含本文件
+#pragma once
+#include <stdint.h>
+#include <math.h>
+
+struct ColorLut {
+    uint16_t r[32], g[64], b[32];
+};
+
+// 暖色调(0-100)对绿/蓝通道的衰减
+#define COLOR_WARM_GREEN 0.15f
+#define COLOR_WARM_BLUE 0.6f
+
+inline uint8_t colorLutChannel(int v, int maxValue, float gain, float gamma) {
+    float f = powf((float)v / maxValue, gamma) * gain;
+    int out = (int)(f * maxValue + 0.5f);
+    return out > maxValue ? maxValue : out;
+}
+
+inline uint16_t colorLutSwap(uint16_t v) {
+    return (v >> 8) | (v << 8);
+}
+
+// scale: 亮度系数(1为不变); warmth: 0-100; gamma: 1为不变
+inline void colorLutBuild(ColorLut& lut, float scale, uint8_t warmth, float gamma) {
+    float gainG = scale * (1 - COLOR_WARM_GREEN * warmth / 100);
+    float gainB = scale * (1 - COLOR_WARM_BLUE * warmth / 100);
+    for(int i = 0; i < 32; i++) {
+        lut.r[i] = colorLutSwap(colorLutChannel(i, 31, scale, gamma) << 11);
+        lut.b[i] = colorLutSwap(colorLutChannel(i, 31, gainB, gamma));
+    }
+    for(int i = 0; i < 64; i++) {
+        lut.g[i] = colorLutSwap(colorLutChannel(i, 63, gainG, gamma) << 5);
+    }
+}
+
+// 对已交换字节的像素就地做变换
+inline void colorLutApply(const ColorLut& lut, uint16_t* px, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) {
+        uint16_t s = px[i];
+        px[i] = lut.r[(s >> 3) & 31] | lut.g[((s & 7) << 3) | (s >> 13)] | lut.b[(s >> 8) & 31];
+    }
+}
@@ -0,0 +1,141 @@
+// JPEG重启标记(DRI)拆分: 解析文件头, 找到靠近中间的重启边界, 把扫描数据拆成两个可以
+// 独立解码的片段. 不依赖Arduino, 主机上的单元测试(test/test_jpeg_restart)直接包含本文件
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+inline size_t jpegMin(size_t a, size_t b) {
+    return a < b ? a : b;
+}
+
+// JPEG文件头信息, 用于按重启标记拆分扫描数据
+struct JpegInfo {
+    uint16_t width, height;
+    uint8_t mcuW, mcuH;          // MCU尺寸(8或16)
+    uint16_t restartInterval;    // DRI, 0表示没有重启标记
+    size_t sofHeightPos;         // SOF中高度字段的偏移
+    size_t scanStart;            // 熵编码数据起始偏移
+};
+
+inline bool parseJpegHeader(const uint8_t* data, size_t len, JpegInfo* info) {
+    memset(info, 0, sizeof(JpegInfo));
+    if(len < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+    
+    size_t pos = 2;
+    while(pos + 4 <= len) {
+        if(data[pos] != 0xFF) return false;
+        uint8_t marker = data[pos + 1];
+        if(marker == 0xFF) {  // 填充字节
+            pos++;
+            continue;
+        }
+        size_t segLen = (data[pos + 2] << 8) | data[pos + 3];
+        if(segLen < 2 || pos + 2 + segLen > len) return false;
+        const uint8_t* seg = data + pos + 4;
+        
+        if(marker == 0xC0 || marker == 0xC1) {
+            info->height = (seg[1] << 8) | seg[2];
+            info->width = (seg[3] << 8) | seg[4];
+            // 灰度图MCU固定8x8, 彩色图由Y分量采样因子决定
+            uint8_t hv = (seg[5] == 1) ? 0x11 : seg[7];
+            info->mcuW = 8 * (hv >> 4);
+            info->mcuH = 8 * (hv & 0x0F);
+            info->sofHeightPos = pos + 5;
+        } else if(marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return false;  // 渐进式/无损等格式TJpgDec不支持
+        } else if(marker == 0xDD) {
+            info->restartInterval = (seg[0] << 8) | seg[1];
+        } else if(marker == 0xDA) {
+            info->scanStart = pos + 2 + segLen;
+            return info->width > 0 && info->mcuW > 0 && info->mcuH > 0;
+        }
+        pos += 2 + segLen;
+    }
+    return false;
+}
+
+// 找到最接近图像中间、且落在重启间隔边界上的MCU行, 返回下半部分数据的起始偏移
+inline bool findRestartSplit(const uint8_t* data, size_t len, const JpegInfo& info,
+                      size_t* splitPos, uint16_t* splitY, uint8_t* rstShift) {
+    if(info.restartInterval == 0) return false;
+    
+    uint16_t mcusPerRow = (info.width + info.mcuW - 1) / info.mcuW;
+    uint16_t mcuRows = (info.height + info.mcuH - 1) / info.mcuH;
+    int best = -1;
+    for(int r = 1; r < mcuRows; r++) {
+        if(((uint32_t)r * mcusPerRow) % info.restartInterval != 0) continue;
+        if(best < 0 || abs(r - mcuRows / 2) < abs(best - mcuRows / 2)) best = r;
+    }
+    if(best < 0) return false;
+    
+    // 下半部分从第k个RST标记之后开始
+    uint32_t k = (uint32_t)best * mcusPerRow / info.restartInterval;
+    uint32_t seen = 0;
+    for(size_t p = info.scanStart; p + 1 < len; p++) {
+        if(data[p] == 0xFF && data[p + 1] >= 0xD0 && data[p + 1] <= 0xD7) {
+            if(++seen == k) {
+                *splitPos = p + 2;
+                *splitY = best * info.mcuH;
+                *rstShift = k & 7;
+                return true;
+            }
+            p++;
+        }
+    }
+    return false;
+}
+
+// 一个独立解码的图像片段的输入流: 共用原文件头(改写高度)加上一段熵编码数据
+struct JpegSliceStream {
+    const uint8_t* header;
+    size_t headerLen;
+    const uint8_t* data;
+    size_t dataLen;
+    size_t pos;               // 在header+data中的读取位置
+    size_t heightPos;         // 需要改写的高度字段偏移
+    uint16_t height;          // 本片段高度
+    uint8_t rstShift;         // RST标记重新编号, 使片段从RST0开始
+    bool lastFF;
+    
+    // tjpgd的输入回调语义: buf为NULL时跳过len字节
+    size_t read(uint8_t* buf, size_t len) {
+        size_t total = headerLen + dataLen;
+        if(pos + len > total) len = total - pos;
+        
+        size_t done = 0;
+        while(done < len) {
+            size_t p = pos + done;
+            if(p < headerLen) {
+                size_t n = jpegMin(headerLen - p, len - done);
+                if(buf) {
+                    memcpy(buf + done, header + p, n);
+                    // 改写SOF高度, 解码器只解码本片段的行
+                    for(int i = 0; i < 2; i++) {
+                        size_t off = heightPos + i;
+                        if(off >= p && off < p + n) {
+                            buf[done + off - p] = i == 0 ? (height >> 8) : (height & 0xFF);
+                        }
+                    }
+                }
+                done += n;
+            } else {
+                size_t n = jpegMin(total - p, len - done);
+                if(buf) {
+                    memcpy(buf + done, data + (p - headerLen), n);
+                    for(size_t i = 0; i < n; i++) {
+                        uint8_t b = buf[done + i];
+                        if(lastFF && b >= 0xD0 && b <= 0xD7) {
+                            buf[done + i] = 0xD0 | ((b - rstShift) & 7);
+                        }
+                        lastFF = (b == 0xFF);
+                    }
+                }
+                done += n;
+            }
+        }
+        pos += len;
+        return len;
+    }
+};
@@ -0,0 +1,211 @@
+// 延迟格式化的日志记录: 调用处只扫描格式串, 把参数按原始字节存下(字符串复制内容),
+// 由日志任务按同一格式串还原成文本. 不依赖Arduino, 主机上的单元测试(test/test_log_record)直接包含本文件
+// 格式串必须是字符串常量(记录中只保存指针); 支持 d i u x X o c s p f e g 及 h/l/ll/z 长度和 * 宽度/精度
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_SPEC_MAX 16         // 单个转换说明的最大长度
+
+enum LogArgKind {
+    LOG_ARG_NONE,               // %% 或不支持的转换
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_LLONG,
+    LOG_ARG_SIZE,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STR,
+    LOG_ARG_PTR
+};
+
+// 解析fmt中从'%'开始的一个转换说明, 返回它的长度; 宽度/精度为'*'的个数写入stars
+inline size_t logParseSpec(const char* fmt, LogArgKind* kind, int* stars) {
+    const char* p = fmt + 1;
+    *stars = 0;
+    while(*p && strchr("-+ #0", *p)) p++;
+    if(*p == '*') {
+        (*stars)++;
+        p++;
+    }
+    while(*p >= '0' && *p <= '9') p++;
+    if(*p == '.') {
+        p++;
+        if(*p == '*') {
+            (*stars)++;
+            p++;
+        }
+        while(*p >= '0' && *p <= '9') p++;
+    }
+    int longs = 0;
+    bool sized = false;
+    while(*p == 'h' || *p == 'l' || *p == 'z') {
+        if(*p == 'l') longs++;
+        if(*p == 'z') sized = true;
+        p++;
+    }
+    switch(*p) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            *kind = sized ? LOG_ARG_SIZE : longs >= 2 ? LOG_ARG_LLONG : longs == 1 ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            *kind = LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            *kind = LOG_ARG_STR;
+            break;
+        case 'p':
+            *kind = LOG_ARG_PTR;
+            break;
+        default:
+            *kind = LOG_ARG_NONE;
+            break;
+    }
+    return *p ? p - fmt + 1 : p - fmt;
+}
+
+template<typename T> inline bool logPut(uint8_t* out, size_t cap, size_t* n, T v) {
+    if(*n + sizeof(T) > cap) return false;
+    memcpy(out + *n, &v, sizeof(T));
+    *n += sizeof(T);
+    return true;
+}
+
+template<typename T> inline bool logGet(const uint8_t* in, size_t len, size_t* n, T* v) {
+    if(*n + sizeof(T) > len) return false;
+    memcpy(v, in + *n, sizeof(T));
+    *n += sizeof(T);
+    return true;
+}
+
+// 调用处: 按格式串把参数存入out, 返回使用的字节数. 空间不够时字符串被截断, 其余参数丢弃
+inline size_t logEncodeArgs(uint8_t* out, size_t cap, const char* fmt, va_list args) {
+    size_t n = 0;
+    for(const char* p = fmt; *p; p++) {
+        if(*p != '%') continue;
+        LogArgKind kind;
+        int stars;
+        size_t specLen = logParseSpec(p, &kind, &stars);
+        for(int i = 0; i < stars; i++) {
+            if(!logPut(out, cap, &n, va_arg(args, int))) return n;
+        }
+        bool ok = true;
+        switch(kind) {
+            case LOG_ARG_INT:    ok = logPut(out, cap, &n, va_arg(args, int)); break;
+            case LOG_ARG_LONG:   ok = logPut(out, cap, &n, va_arg(args, long)); break;
+            case LOG_ARG_LLONG:  ok = logPut(out, cap, &n, va_arg(args, long long)); break;
+            case LOG_ARG_SIZE:   ok = logPut(out, cap, &n, va_arg(args, size_t)); break;
+            case LOG_ARG_DOUBLE: ok = logPut(out, cap, &n, va_arg(args, double)); break;
+            case LOG_ARG_PTR:    ok = logPut(out, cap, &n, va_arg(args, void*)); break;
+            case LOG_ARG_STR: {
+                const char* s = va_arg(args, const char*);
+                if(!s) s = "(null)";
+                if(n >= cap) return n;
+                size_t len = strlen(s);
+                if(len > cap - n - 1) len = cap - n - 1;
+                memcpy(out + n, s, len);
+                out[n + len] = 0;
+                n += len + 1;
+                break;
+            }
+            default: break;
+        }
+        if(!ok) return n;
+        p += specLen - 1;
+    }
+    return n;
+}
+
+// 日志任务: 按格式串和存下的参数输出文本, 返回长度(不超过cap - 1). 参数不全时在缺的位置停止
+inline size_t logFormatArgs(char* out, size_t cap, const char* fmt, const uint8_t* args, size_t len) {
+    size_t n = 0, a = 0;
+    if(cap == 0) return 0;
+    for(const char* p = fmt; *p && n < cap - 1; ) {
+        if(*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        LogArgKind kind;
+        int stars;
+        size_t specLen = logParseSpec(p, &kind, &stars);
+        if(kind == LOG_ARG_NONE) {
+            // %%输出一个%, 不支持的转换原样输出
+            if(p[1] == '%') {
+                out[n++] = '%';
+            } else {
+                for(size_t i = 0; i < specLen && n < cap - 1; i++) out[n++] = p[i];
+            }
+            p += specLen;
+            continue;
+        }
+
+        // 把'*'换成存下的数值
+        char spec[LOG_SPEC_MAX + 24];
+        size_t s = 0;
+        for(size_t i = 0; i < specLen && s < LOG_SPEC_MAX; i++) {
+            if(p[i] != '*') {
+                spec[s++] = p[i];
+                continue;
+            }
+            int v;
+            if(!logGet(args, len, &a, &v)) {
+                out[n] = 0;
+                return n;
+            }
+            s += snprintf(spec + s, sizeof(spec) - s, "%d", v);
+        }
+        spec[s] = 0;
+
+        int w = 0;
+        bool ok = true;
+        switch(kind) {
+            case LOG_ARG_INT: {
+                int v;
+                if((ok = logGet(args, len, &a, &v))) w = snprintf(out + n, cap - n, spec, v);
+                break;
+            }
+            case LOG_ARG_LONG: {
+                long v;
+                if((ok = logGet(args, len, &a, &v))) w = snprintf(out + n, cap - n, spec, v);
+                break;
+            }
+            case LOG_ARG_LLONG: {
+                long long v;
+                if((ok = logGet(args, len, &a, &v))) w = snprintf(out + n, cap - n, spec, v);
+                break;
+            }
+            case LOG_ARG_SIZE: {
+                size_t v;
+                if((ok = logGet(args, len, &a, &v))) w = snprintf(out + n, cap - n, spec, v);
+                break;
+            }
+            case LOG_ARG_DOUBLE: {
+                double v;
+                if((ok = logGet(args, len, &a, &v))) w = snprintf(out + n, cap - n, spec, v);
+                break;
+            }
+            case LOG_ARG_PTR: {
+                void* v;
+                if((ok = logGet(args, len, &a, &v))) w = snprintf(out + n, cap - n, spec, v);
+                break;
+            }
+            default: {
+                const char* str = (const char*)args + a;
+                size_t l = a < len ? strnlen(str, len - a) : 0;
+                ok = a + l < len;
+                if(ok) {
+                    w = snprintf(out + n, cap - n, spec, str);
+                    a += l + 1;
+                }
+                break;
+            }
+        }
+        if(!ok) break;
+        if(w > 0) n += (size_t)w < cap - n ? (size_t)w : cap - n - 1;
+        p += specLen;
+    }
+    out[n] = 0;
+    return n;
+}
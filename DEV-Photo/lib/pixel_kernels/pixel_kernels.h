@@ -0,0 +1,202 @@
+// 像素核心: 作用于一行像素的基本操作(交换字节/填充/混合/取样), 不依赖Arduino,
+// 主机上的单元测试(test/test_pixel_kernels)直接包含本文件
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// 编译时选择的实现, 下标与pixelKernels对应
+#define PIXEL_KERNELS_SCALAR 0
+#define PIXEL_KERNELS_SWAR 1
+#define PIXEL_KERNELS_VECTOR 2
+#ifndef PIXEL_KERNELS
+#define PIXEL_KERNELS PIXEL_KERNELS_SWAR
+#endif
+
+// 每个操作有三种实现: 标量版本是参考实现, 用于校验; SWAR版本在32位字中同时处理两个像素(ESP32没有SIMD);
+// 向量版本用GCC向量扩展写成, 在主机模拟和带SIMD的型号上由编译器生成向量指令.
+// 除了注明的以外, 像素都是交换过字节的(与TJpgDec.setSwapBytes(true)一致)
+typedef uint32_t __attribute__((may_alias)) PixelWord;
+typedef uint16_t __attribute__((vector_size(16), aligned(2), may_alias)) PixelVec16;
+typedef uint32_t __attribute__((vector_size(16), aligned(2), may_alias)) PixelVec32;
+
+// 565打包混合(未交换字节): R/B和G拆到32位的不同位段, 一次乘法同时算三个通道
+// alpha为0..32, 结果 = bg + (fg - bg) * alpha / 32
+inline uint16_t blend565(uint16_t fg, uint16_t bg, uint8_t alpha) {
+    uint32_t x = (fg | ((uint32_t)fg << 16)) & 0x07E0F81F;
+    uint32_t y = (bg | ((uint32_t)bg << 16)) & 0x07E0F81F;
+    uint32_t r = ((((x - y) * alpha) >> 5) + y) & 0x07E0F81F;
+    return (uint16_t)(r | (r >> 16));
+}
+
+// 一个字(或向量的每个元素)中的两个像素同时交换字节
+template<typename T> inline T swap565x2(T w) {
+    return ((w & 0x00FF00FF) << 8) | ((w >> 8) & 0x00FF00FF);
+}
+
+// 两个交换过字节的像素同时混合: 换回原字节序后高低半字各做一次blend565
+template<typename T> inline T blend565x2(T fg, T bg, uint32_t alpha) {
+    fg = swap565x2(fg);
+    bg = swap565x2(bg);
+    T flo = fg & 0xFFFF, fhi = fg >> 16, blo = bg & 0xFFFF, bhi = bg >> 16;
+    T x = (flo | (flo << 16)) & 0x07E0F81F, y = (blo | (blo << 16)) & 0x07E0F81F;
+    T lo = ((((x - y) * alpha) >> 5) + y) & 0x07E0F81F;
+    x = (fhi | (fhi << 16)) & 0x07E0F81F;
+    y = (bhi | (bhi << 16)) & 0x07E0F81F;
+    T hi = ((((x - y) * alpha) >> 5) + y) & 0x07E0F81F;
+    lo = (lo | (lo >> 16)) & 0xFFFF;
+    hi = (hi | (hi >> 16)) & 0xFFFF;
+    return swap565x2(lo | (hi << 16));
+}
+
+// 标量参考实现
+inline void pxSwapScalar(uint16_t* px, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) px[i] = (px[i] >> 8) | (px[i] << 8);
+}
+
+inline void pxFillScalar(uint16_t* px, uint32_t count, uint16_t color) {
+    for(uint32_t i = 0; i < count; i++) px[i] = color;
+}
+
+// dst = dst * (32 - alpha) + src * alpha
+inline void pxBlendScalar(uint16_t* dst, const uint16_t* src, uint32_t count, uint8_t alpha) {
+    for(uint32_t i = 0; i < count; i++) {
+        uint16_t fg = (src[i] >> 8) | (src[i] << 8);
+        uint16_t bg = (dst[i] >> 8) | (dst[i] << 8);
+        uint16_t r = blend565(fg, bg, alpha);
+        dst[i] = (r >> 8) | (r << 8);
+    }
+}
+
+// dst[i] = src[index[i]], 变形和缩放的取样
+inline void pxGatherScalar(uint16_t* dst, const uint16_t* src, const int32_t* index, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) dst[i] = src[index[i]];
+}
+
+// SWAR: 先处理到dst按4字节对齐, 中间按字, 末尾不足一个字的像素走标量
+inline void pxSwapSwar(uint16_t* px, uint32_t count) {
+    if(count && ((uintptr_t)px & 2)) {
+        pxSwapScalar(px++, 1);
+        count--;
+    }
+    PixelWord* w = (PixelWord*)px;
+    for(uint32_t i = 0; i < count / 2; i++) w[i] = swap565x2(w[i]);
+    if(count & 1) pxSwapScalar(px + count - 1, 1);
+}
+
+inline void pxFillSwar(uint16_t* px, uint32_t count, uint16_t color) {
+    if(count && ((uintptr_t)px & 2)) {
+        *px++ = color;
+        count--;
+    }
+    PixelWord* w = (PixelWord*)px;
+    uint32_t c = color | ((uint32_t)color << 16);
+    uint32_t words = count / 2, i = 0;
+    for(; i + 4 <= words; i += 4) {
+        w[i] = c;
+        w[i + 1] = c;
+        w[i + 2] = c;
+        w[i + 3] = c;
+    }
+    for(; i < words; i++) w[i] = c;
+    if(count & 1) px[count - 1] = color;
+}
+
+inline void pxBlendSwar(uint16_t* dst, const uint16_t* src, uint32_t count, uint8_t alpha) {
+    // 两个指针的对齐不同时无法按字读取
+    if(((uintptr_t)dst ^ (uintptr_t)src) & 2) {
+        pxBlendScalar(dst, src, count, alpha);
+        return;
+    }
+    if(count && ((uintptr_t)dst & 2)) {
+        pxBlendScalar(dst++, src++, 1, alpha);
+        count--;
+    }
+    PixelWord* d = (PixelWord*)dst;
+    const PixelWord* s = (const PixelWord*)src;
+    for(uint32_t i = 0; i < count / 2; i++) d[i] = blend565x2<uint32_t>(s[i], d[i], alpha);
+    if(count & 1) pxBlendScalar(dst + count - 1, src + count - 1, 1, alpha);
+}
+
+inline void pxGatherSwar(uint16_t* dst, const uint16_t* src, const int32_t* index, uint32_t count) {
+    if(count && ((uintptr_t)dst & 2)) {
+        *dst++ = src[*index++];
+        count--;
+    }
+    PixelWord* w = (PixelWord*)dst;
+    for(uint32_t i = 0; i < count / 2; i++) {
+        w[i] = src[index[2 * i]] | ((uint32_t)src[index[2 * i + 1]] << 16);
+    }
+    if(count & 1) dst[count - 1] = src[index[count - 1]];
+}
+
+// 向量: 每次8个像素, 向量类型只要求2字节对齐, 不需要处理开头
+#define PIXEL_VEC 8
+
+inline void pxSwapVector(uint16_t* px, uint32_t count) {
+    uint32_t i = 0;
+    for(; i + PIXEL_VEC <= count; i += PIXEL_VEC) {
+        PixelVec16* v = (PixelVec16*)(px + i);
+        *v = (*v >> 8) | (*v << 8);
+    }
+    pxSwapScalar(px + i, count - i);
+}
+
+inline void pxFillVector(uint16_t* px, uint32_t count, uint16_t color) {
+    PixelVec16 c = (PixelVec16){} + color;
+    uint32_t i = 0;
+    for(; i + PIXEL_VEC <= count; i += PIXEL_VEC) *(PixelVec16*)(px + i) = c;
+    pxFillScalar(px + i, count - i, color);
+}
+
+inline void pxBlendVector(uint16_t* dst, const uint16_t* src, uint32_t count, uint8_t alpha) {
+    uint32_t i = 0;
+    for(; i + PIXEL_VEC <= count; i += PIXEL_VEC) {
+        PixelVec32* d = (PixelVec32*)(dst + i);
+        *d = blend565x2<PixelVec32>(*(const PixelVec32*)(src + i), *d, alpha);
+    }
+    pxBlendScalar(dst + i, src + i, count - i, alpha);
+}
+
+// 向量扩展没有gather, 按元素装配后整体写出
+inline void pxGatherVector(uint16_t* dst, const uint16_t* src, const int32_t* index, uint32_t count) {
+    uint32_t i = 0;
+    for(; i + PIXEL_VEC <= count; i += PIXEL_VEC) {
+        const int32_t* k = index + i;
+        PixelVec16 v = {src[k[0]], src[k[1]], src[k[2]], src[k[3]], src[k[4]], src[k[5]], src[k[6]], src[k[7]]};
+        *(PixelVec16*)(dst + i) = v;
+    }
+    pxGatherScalar(dst + i, src, index + i, count - i);
+}
+
+struct PixelKernels {
+    const char* name;
+    void (*swap)(uint16_t* px, uint32_t count);
+    void (*fill)(uint16_t* px, uint32_t count, uint16_t color);
+    void (*blend)(uint16_t* dst, const uint16_t* src, uint32_t count, uint8_t alpha);
+    void (*gather)(uint16_t* dst, const uint16_t* src, const int32_t* index, uint32_t count);
+};
+
+// 下标与PIXEL_KERNELS_*对应
+const PixelKernels pixelKernels[] = {
+    {"scalar", pxSwapScalar, pxFillScalar, pxBlendScalar, pxGatherScalar},
+    {"swar", pxSwapSwar, pxFillSwar, pxBlendSwar, pxGatherSwar},
+    {"vector", pxSwapVector, pxFillVector, pxBlendVector, pxGatherVector},
+};
+const int PIXEL_KERNEL_IMPLS = sizeof(pixelKernels) / sizeof(pixelKernels[0]);
+
+// 编译时选定的实现, 常量下标, 编译器直接调用
+inline void pxSwap(uint16_t* px, uint32_t count) {
+    pixelKernels[PIXEL_KERNELS].swap(px, count);
+}
+
+inline void pxFill(uint16_t* px, uint32_t count, uint16_t color) {
+    pixelKernels[PIXEL_KERNELS].fill(px, count, color);
+}
+
+inline void pxBlend(uint16_t* dst, const uint16_t* src, uint32_t count, uint8_t alpha) {
+    pixelKernels[PIXEL_KERNELS].blend(dst, src, count, alpha);
+}
+
+inline void pxGather(uint16_t* dst, const uint16_t* src, const int32_t* index, uint32_t count) {
+    pixelKernels[PIXEL_KERNELS].gather(dst, src, index, count);
+}
@@ -0,0 +1,50 @@
+// 功耗策略: 按显示状态和空闲时间决定loop节拍、CPU频率和是否调暗. 纯函数, 不依赖Arduino,
+// 主机上的单元测试(test/test_power_policy)直接包含本文件
+#pragma once
+#include <stdint.h>
+
+enum PowerState {
+    POWER_STANDBY,      // 待机动画
+    POWER_STATIC,       // 清晰模式静态照片
+    POWER_DYNAMIC,      // 动态模式照片
+    POWER_ANIMATION,    // GIF播放
+    POWER_BUSY          // 上传或投屏
+};
+
+struct PowerPolicy {
+    uint8_t fps;        // loop节拍, 0为不限速
+    uint16_t cpuMhz;
+    bool dim;           // 调暗背光
+};
+
+#define IDLE_DIM_MS (10 * 60 * 1000UL)      // 无操作多久后调暗
+#define IDLE_DEEP_MS (30 * 60 * 1000UL)     // 待机动画无操作多久后进一步降速
+#define POWER_REQUEST_BURST_MS 2000         // 最近有HTTP请求时不限速, 连续的请求不被节拍拖慢
+
+// idleMs: 距上次用户操作的时间; requestAgeMs: 距上次HTTP请求的时间
+inline PowerPolicy powerPolicy(PowerState state, unsigned long idleMs, unsigned long requestAgeMs) {
+    bool dim = idleMs >= IDLE_DIM_MS;
+    bool deep = idleMs >= IDLE_DEEP_MS;
+    PowerPolicy policy;
+    switch(state) {
+        case POWER_BUSY:      return {0, 240, false};
+        case POWER_ANIMATION: policy = {50, 240, dim}; break;
+        case POWER_DYNAMIC:   policy = {20, 160, dim}; break;
+        case POWER_STATIC:    policy = {10, 80, dim}; break;
+        default:              policy = {(uint8_t)(deep ? 5 : 15), (uint16_t)(deep ? 80 : 160), dim}; break;
+    }
+    if(requestAgeMs < POWER_REQUEST_BURST_MS) policy.fps = 0;
+    return policy;
+}
+
+// 本次节拍要让出CPU的时间: 等到wake(下一节拍或更早的GIF帧), 最多一个节拍.
+// 时间是32位的millis(), 按差值比较, 回绕时也正确
+inline uint32_t powerWaitMs(uint32_t now, uint32_t wake, uint32_t period) {
+    if((int32_t)(wake - now) <= 0) return 0;
+    return wake - now < period ? wake - now : period;
+}
+
+// 下一节拍的计划时间: 按节拍累加, 落后超过一个节拍时从现在重新计时, 不补帧
+inline uint32_t powerNextDeadline(uint32_t now, uint32_t deadline, uint32_t period) {
+    return (int32_t)(now - deadline) > (int32_t)period ? now + period : deadline + period;
+}
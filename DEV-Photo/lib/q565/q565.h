@@ -0,0 +1,113 @@
+// Q565: 浏览器端编码的无损RGB565压缩格式(QOI风格)和设备端的流式解码器, 不依赖Arduino,
+// 主机上的单元测试(test/test_q565)直接包含本文件
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pixel_kernels.h>
+
+// Q565格式:
+//   文件头: "Q565" + 宽(u16小端) + 高(u16小端)
+//   0b00iiiiii            索引: 取64项哈希表中的颜色
+//   0b01rrggbb            小差值: r/g/b相对上一像素变化-2..1
+//   0b10gggggg + 1字节    亮度差值: dg为-32..31, 次字节高/低4位为dr-dg/2和db-dg/2(偏移8)
+//   0b11rrrrrr            重复上一像素1..62次
+//   0xFE + 2字节          原始像素(大端,即已交换字节)
+#define Q565_OP_INDEX 0x00
+#define Q565_OP_DIFF  0x40
+#define Q565_OP_LUMA  0x80
+#define Q565_OP_RUN   0xC0
+#define Q565_OP_RGB   0xFE
+#define Q565_MASK_2   0xC0
+#define Q565_HEADER_SIZE 8
+
+inline uint8_t q565Hash(uint16_t px) {
+    return ((px >> 11) * 3 + ((px >> 5) & 0x3F) * 5 + (px & 0x1F) * 7) & 63;
+}
+
+// 流式解码器状态, 输入可以分多次送入
+struct Q565Decoder {
+    uint16_t index[64];
+    uint16_t prev;
+    uint8_t run;
+    uint8_t pending[3];   // 跨块的未完整操作码
+    uint8_t pendingLen;
+    
+    void reset() {
+        memset(index, 0, sizeof(index));
+        prev = 0;
+        run = 0;
+        pendingLen = 0;
+    }
+    
+    // 操作码需要的字节数
+    static uint8_t opLength(uint8_t op) {
+        if(op == Q565_OP_RGB) return 3;
+        if((op & Q565_MASK_2) == Q565_OP_LUMA) return 2;
+        return 1;
+    }
+    
+    // 解码一个完整操作码
+    void apply(const uint8_t* op) {
+        uint8_t b1 = op[0];
+        uint16_t r = prev >> 11;
+        uint16_t g = (prev >> 5) & 0x3F;
+        uint16_t b = prev & 0x1F;
+        
+        if(b1 == Q565_OP_RGB) {
+            prev = (op[1] << 8) | op[2];
+        } else if((b1 & Q565_MASK_2) == Q565_OP_INDEX) {
+            prev = index[b1];
+        } else if((b1 & Q565_MASK_2) == Q565_OP_DIFF) {
+            r = (r + ((b1 >> 4) & 0x03) - 2) & 0x1F;
+            g = (g + ((b1 >> 2) & 0x03) - 2) & 0x3F;
+            b = (b + (b1 & 0x03) - 2) & 0x1F;
+            prev = (r << 11) | (g << 5) | b;
+        } else if((b1 & Q565_MASK_2) == Q565_OP_LUMA) {
+            int dg = (b1 & 0x3F) - 32;
+            int dr = (op[1] >> 4) - 8 + (dg >> 1);
+            int db = (op[1] & 0x0F) - 8 + (dg >> 1);
+            r = (r + dr) & 0x1F;
+            g = (g + dg) & 0x3F;
+            b = (b + db) & 0x1F;
+            prev = (r << 11) | (g << 5) | b;
+        } else {
+            run = (b1 & 0x3F);   // 本像素之外还需重复的次数
+        }
+        index[q565Hash(prev)] = prev;
+    }
+    
+    // 从输入解码最多maxPixels个像素(已交换字节)到out, 返回解码数量, *used为消耗的输入字节
+    size_t decode(const uint8_t* in, size_t len, size_t* used, uint16_t* out, size_t maxPixels) {
+        size_t pos = 0, n = 0;
+        while(n < maxPixels) {
+            if(run > 0) {
+                // 重复像素整段填充
+                size_t k = run < maxPixels - n ? run : maxPixels - n;
+                pxFill(out + n, k, (prev >> 8) | (prev << 8));
+                n += k;
+                run -= k;
+                continue;
+            } else if(pendingLen > 0) {
+                // 补齐上一块遗留的操作码
+                uint8_t need = opLength(pending[0]);
+                while(pendingLen < need && pos < len) pending[pendingLen++] = in[pos++];
+                if(pendingLen < need) break;
+                apply(pending);
+                pendingLen = 0;
+            } else {
+                if(pos >= len) break;
+                uint8_t need = opLength(in[pos]);
+                if(pos + need > len) {
+                    while(pos < len) pending[pendingLen++] = in[pos++];
+                    break;
+                }
+                apply(in + pos);
+                pos += need;
+            }
+            out[n++] = (prev >> 8) | (prev << 8);
+        }
+        *used = pos;
+        return n;
+    }
+};
@@ -0,0 +1,285 @@
+// 分块上传的会话: 每个客户端一个会话(按id区分), 各自记录已提交的块(位图)和进度.
+// 同时写入的会话不超过UPLOAD_MAX_WRITERS, 超出的新会话返回503, Retry-After按剩余数据量和实测的
+// 闪存写入速度估计; 已开始的会话不受影响. 块先写到临时文件, 长度和CRC正确才改名提交, 全部到齐后按顺序拼接.
+// 文件操作通过Store参数完成(open/read/close读取一个块, remove, rename), 时间由调用者传入.
+// 不依赖Arduino, 主机上的单元测试(test/test_upload_sessions)直接包含本文件
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define UPLOAD_DIR "/upload"
+#define UPLOAD_CHUNK_SIZE (16 * 1024)
+#define UPLOAD_MAX_CHUNKS 128                 // 最大2MB
+#define UPLOAD_SESSION_TIMEOUT 120000         // 会话空闲超过该时间(ms)后可被新会话替换
+#define UPLOAD_MAX_WRITERS 2                  // 同时写闪存的会话数, 再多只会互相打乱闪存写入
+#define UPLOAD_RETRY_MAX 30                   // Retry-After的上限(秒)
+#define UPLOAD_KEY_MAX 8                      // 会话id的最大长度
+#define UPLOAD_PATH_MAX 32                    // "/upload/<id>.t<块号>"
+
+enum UploadSessionState {
+    SESSION_FREE,
+    SESSION_ACTIVE,             // 接收中
+    SESSION_DONE                // 已完成, 最后一块的响应丢失时客户端可查询结果
+};
+
+// 会话id直接用在块文件名中, 只接受页面生成的1-8位十六进制数("../"之类不能跳出UPLOAD_DIR)
+inline bool uploadKeyValid(const char* key) {
+    size_t len = 0;
+    for(; key[len]; len++) {
+        char c = key[len];
+        if(len >= UPLOAD_KEY_MAX || !((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) return false;
+    }
+    return len > 0;
+}
+
+struct UploadSession {
+    UploadSessionState state;
+    char key[UPLOAD_KEY_MAX + 1];
+    uint8_t format;             // 调用者的文件格式, 拼接时使用
+    uint32_t total;
+    uint16_t chunks;
+    uint32_t committed[UPLOAD_MAX_CHUNKS / 32];   // 已提交的块位图
+    uint16_t committedCount;
+    uint32_t lastSeen;
+    uint16_t photoId;           // 完成后的照片编号
+
+    bool has(uint16_t index) const {
+        return committed[index / 32] & (1UL << (index % 32));
+    }
+
+    // 新提交的块返回true, 重复发送的块返回false
+    bool commit(uint16_t index) {
+        if(has(index)) return false;
+        committed[index / 32] |= 1UL << (index % 32);
+        committedCount++;
+        return true;
+    }
+
+    bool allCommitted() const {
+        return committedCount == chunks;
+    }
+
+    void chunkPath(char* out, uint16_t index, bool temp) const {
+        snprintf(out, UPLOAD_PATH_MAX, "%s/%s%s%u", UPLOAD_DIR, key, temp ? ".t" : ".", (unsigned)index);
+    }
+
+    // 正在写入: 接收中且没有空闲超时
+    bool writing(uint32_t now) const {
+        return state == SESSION_ACTIVE && now - lastSeen < UPLOAD_SESSION_TIMEOUT;
+    }
+
+    uint32_t remaining() const {
+        uint32_t done = (uint32_t)committedCount * UPLOAD_CHUNK_SIZE;
+        return done < total ? total - done : 0;
+    }
+
+    void reset() {
+        state = SESSION_FREE;
+        key[0] = 0;
+        memset(committed, 0, sizeof(committed));
+        committedCount = 0;
+    }
+
+    void complete(uint16_t id, uint32_t now) {
+        char done[UPLOAD_KEY_MAX + 1];
+        memcpy(done, key, sizeof(done));
+        reset();
+        state = SESSION_DONE;
+        memcpy(key, done, sizeof(key));
+        photoId = id;
+        lastSeen = now;
+    }
+};
+
+// 删除会话已提交的块
+template<typename Store> void uploadRemoveChunks(const UploadSession& session, Store& store) {
+    char path[UPLOAD_PATH_MAX];
+    for(uint16_t i = 0; i < session.chunks; i++) {
+        if(!session.has(i)) continue;
+        session.chunkPath(path, i, false);
+        store.remove(path);
+    }
+}
+
+template<typename Store> void uploadDiscard(UploadSession& session, Store& store) {
+    uploadRemoveChunks(session, store);
+    session.reset();
+}
+
+// 按顺序读出所有块, 每段数据交给emit(buf, n), emit返回false时停止读取.
+// consume为true时每读完一块就删除它以腾出空间, 出错后剩下的块也全部删除. 全部读完返回true
+template<typename Store, typename Emit>
+bool uploadReadChunks(const UploadSession& session, Store& store, uint8_t* buf, size_t cap, bool consume, Emit emit) {
+    char path[UPLOAD_PATH_MAX];
+    bool ok = true;
+    for(uint16_t i = 0; i < session.chunks; i++) {
+        session.chunkPath(path, i, false);
+        if(ok) {
+            ok = store.open(path);
+            size_t n;
+            while(ok && (n = store.read(buf, cap)) > 0) ok = emit(buf, n);
+            store.close();
+        }
+        if(consume) store.remove(path);
+        else if(!ok) break;
+    }
+    return ok;
+}
+
+struct UploadAdmission {
+    uint32_t admitted;
+    uint32_t rejected;
+    uint64_t flashBytes;        // 上传数据写入闪存的字节数和耗时, 用于估计等待时间
+    uint64_t flashUs;
+
+    void recordWrite(size_t bytes, uint32_t us) {
+        flashBytes += bytes;
+        flashUs += us;
+    }
+};
+
+// 正在接收的块: 所属的会话、块号和应有的长度; error为出错原因
+struct UploadChunk {
+    UploadSession* session;
+    uint16_t index;
+    uint32_t expected;
+    const char* error;
+};
+
+template<int N> struct UploadTable {
+    UploadSession sessions[N];
+    UploadAdmission admission;
+
+    UploadSession* find(const char* key) {
+        for(int i = 0; i < N; i++) {
+            if(sessions[i].state != SESSION_FREE && strcmp(sessions[i].key, key) == 0) return &sessions[i];
+        }
+        return NULL;
+    }
+
+    int writers(uint32_t now) const {
+        int n = 0;
+        for(int i = 0; i < N; i++) {
+            if(sessions[i].writing(now)) n++;
+        }
+        return n;
+    }
+
+    // 新的写入者(会话或multipart请求)能否开始, 不能时计入拒绝次数
+    bool admit(uint32_t now) {
+        if(writers(now) >= UPLOAD_MAX_WRITERS) {
+            admission.rejected++;
+            return false;
+        }
+        admission.admitted++;
+        return true;
+    }
+
+    // 正在写入的会话还需要多少秒: 剩余字节数 / 实测写入速度, 至少1秒
+    uint32_t retryAfter(uint32_t now) const {
+        uint64_t remaining = 0;
+        for(int i = 0; i < N; i++) {
+            if(sessions[i].writing(now)) remaining += sessions[i].remaining();
+        }
+        if(admission.flashBytes == 0) return 1;
+        uint64_t sec = remaining * admission.flashUs / admission.flashBytes / 1000000 + 1;
+        return sec < UPLOAD_RETRY_MAX ? (uint32_t)sec : UPLOAD_RETRY_MAX;
+    }
+
+    // 新会话的槽位: 优先空闲的, 其次是不在写入的会话中最久没有活动的(超时会话的块被删除)
+    template<typename Store> UploadSession* alloc(uint32_t now, Store& store) {
+        UploadSession* oldest = NULL;
+        for(int i = 0; i < N; i++) {
+            UploadSession* s = &sessions[i];
+            if(s->state == SESSION_FREE) return s;
+            if(s->writing(now)) continue;
+            if(!oldest || now - s->lastSeen > now - oldest->lastSeen) oldest = s;
+        }
+        if(oldest) uploadDiscard(*oldest, store);
+        return oldest;
+    }
+
+    // 开始接收一个块(Content-Range为start-end/total): 校验范围, 必要时建立新会话并准入.
+    // 返回HTTP状态码; 200时chunk指向会话, 会话未完成时调用者把数据写入临时文件chunkPath(index, true)
+    template<typename Store>
+    int beginChunk(const char* key, uint32_t start, uint32_t end, uint32_t total, uint8_t format,
+                   uint32_t now, Store& store, UploadChunk* chunk) {
+        chunk->session = NULL;
+        chunk->error = NULL;
+        if(!uploadKeyValid(key)) {
+            chunk->error = "bad id";
+            return 400;
+        }
+        if(start > end || end >= total) {
+            chunk->error = "bad range";
+            return 400;
+        }
+        uint32_t chunks = (total + UPLOAD_CHUNK_SIZE - 1) / UPLOAD_CHUNK_SIZE;
+        chunk->index = start / UPLOAD_CHUNK_SIZE;
+        chunk->expected = total - start < UPLOAD_CHUNK_SIZE ? total - start : UPLOAD_CHUNK_SIZE;
+        if(chunks > UPLOAD_MAX_CHUNKS || start % UPLOAD_CHUNK_SIZE != 0 || end - start + 1 != chunk->expected) {
+            chunk->error = "range not aligned";
+            return 416;
+        }
+
+        UploadSession* session = find(key);
+        if(session && session->state == SESSION_DONE && session->total == total) {
+            // 完成后又收到同一文件的块: 完成的应答丢失后的重发, 不再写入, 调用者按会话结果应答
+            session->lastSeen = now;
+            chunk->session = session;
+            return 200;
+        }
+        bool resuming = session && session->state == SESSION_ACTIVE;
+        // 超时后恢复的会话也要重新准入
+        if(!(resuming && session->writing(now)) && !admit(now)) {
+            chunk->error = "busy";
+            return 503;
+        }
+        if(!resuming) {
+            // 已完成的会话收到大小不同的块时按新会话处理(拼接时按内容去重)
+            if(session) session->reset();
+            else session = alloc(now, store);
+            if(!session) {
+                chunk->error = "busy";
+                return 503;
+            }
+            session->state = SESSION_ACTIVE;
+            strcpy(session->key, key);
+            session->format = format;
+            session->total = total;
+            session->chunks = chunks;
+        } else if(session->total != total) {
+            chunk->error = "size changed";
+            return 400;
+        }
+        session->lastSeen = now;
+        chunk->session = session;
+        return 200;
+    }
+};
+
+// 块接收完成: 长度和CRC都正确才把临时文件改名提交(重复发送的块以新的为准). 返回HTTP状态码
+template<typename Store> int uploadEndChunk(UploadChunk& chunk, uint32_t received, bool crcOk, Store& store) {
+    if(chunk.session->state == SESSION_DONE) return 200;
+    char temp[UPLOAD_PATH_MAX], path[UPLOAD_PATH_MAX];
+    chunk.session->chunkPath(temp, chunk.index, true);
+    if(received != chunk.expected || !crcOk) {
+        store.remove(temp);
+        chunk.error = "crc mismatch";
+        return 422;
+    }
+    chunk.session->chunkPath(path, chunk.index, false);
+    if(!chunk.session->commit(chunk.index)) store.remove(path);
+    store.rename(temp, path);
+    return 200;
+}
+
+// 连接中断: 未完成的块直接丢弃, 客户端稍后重传
+template<typename Store> void uploadAbortChunk(const UploadChunk& chunk, Store& store) {
+    if(!chunk.session) return;
+    char temp[UPLOAD_PATH_MAX];
+    chunk.session->chunkPath(temp, chunk.index, true);
+    store.remove(temp);
+}
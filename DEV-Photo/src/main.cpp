@@ -7,6 +7,55 @@
 #include <TJpg_Decoder.h>
 #include <esp_wifi.h>
 #include <esp_system.h>
+#include <WebSocketsServer.h>
+#include <AnimatedGIF.h>
+#include <esp32/rom/crc.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/version.h>
+#include <Preferences.h>
+#include <multi_heap.h>
+#include <esp_heap_caps.h>
+#include <atomic>
+#include <new>
+#include <time.h>
+#include <sys/time.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+// 可选的JPEGDEC后端(bitbank2), 通常比TJpgDec快
+#ifndef IMAGE_BACKEND_JPEGDEC
+#define IMAGE_BACKEND_JPEGDEC 1
+#endif
+#if IMAGE_BACKEND_JPEGDEC
+#include <JPEGDEC.h>
+#endif
+
+// 存储后端: 默认SPIFFS, -DSTORAGE_LITTLEFS=1改用LittleFS(同一分区, 首次启动时迁移)
+#ifndef STORAGE_LITTLEFS
+#define STORAGE_LITTLEFS 0
+#endif
+#if STORAGE_LITTLEFS
+#include <LittleFS.h>
+#define PHOTO_FS LittleFS
+#define PHOTO_FS_NAME "littlefs"
+#else
+#define PHOTO_FS SPIFFS
+#define PHOTO_FS_NAME "spiffs"
+#endif
+// -DSTORAGE_BENCH=1: 启动时测试挂载/打开/顺序读写在不同占用率下的耗时(会临时写满分区)
+#ifndef STORAGE_BENCH
+#define STORAGE_BENCH 0
+#endif
+// 像素核心(lib/pixel_kernels): -DPIXEL_KERNELS=0标量/1 SWAR(默认)/2向量, /pixel-bench对比三者
+#include <pixel_kernels.h>
+#include <q565.h>
+#include <jpeg_restart.h>
+#include <anim_ops.h>
+#include <power_policy.h>
+#include <log_record.h>
+#include <color_lut.h>
+#include <upload_sessions.h>
 
 #define WIFI_SSID "ESP32-Album"     
 #define WIFI_PASSWORD "12345678"     
@@ -16,182 +65,4460 @@
 #define BEACON_INTERVAL 100 // 信标间隔100ms
 #define TX_POWER 82        // WiFi发射功率(约19.5dBm)
 
-TFT_eSPI tft = TFT_eSPI();
-WebServer server(80);
+TFT_eSPI tft = TFT_eSPI();
+// 功耗调节需要知道是否有连接在排队, WebServer的监听socket和当前连接是protected成员
+class PhotoWebServer : public WebServer {
+public:
+    PhotoWebServer(int port) : WebServer(port) {}
+    
+    bool pending() {
+        return _server.hasClient() || _currentClient.available() > 0;
+    }
+};
+
+PhotoWebServer server(80);
+
+// 屏幕分辨率
+#define SCREEN_WIDTH 240
+#define SCREEN_HEIGHT 320
+
+// 日志: 级别在编译时裁剪(-DLOG_LEVEL=...), 关闭的级别不产生代码, 参数也不求值;
+// 打开的级别在调用处只把格式串指针和原始参数(lib/log_record)存进内存环形缓冲后立即返回,
+// 由低优先级任务格式化并写串口. 每个调用点每秒最多LOG_SITE_BURST条, 超出的只计数, 在该处下一条日志中注明
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4       // 解码/过渡/上传等过程的调试信息
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#define LOG_RING_SIZE 4096      // 必须是4的倍数, 每条记录按4字节对齐
+#define LOG_LINE_MAX 160
+#define LOG_ARGS_MAX 96         // 一条记录中参数的最大字节数, 超出的字符串被截断
+#define LOG_SITE_BURST 5
+
+// 调用点状态, 两个核心上的任务可能同时写同一个调用点
+struct LogSite {
+    std::atomic<uint32_t> windowStart;
+    std::atomic<uint16_t> count;
+    std::atomic<uint16_t> suppressed;
+};
+
+// 记录内容: 长度字(4字节) + 记录头 + 按格式串存下的参数
+struct LogRecordHeader {
+    const char* fmt;
+    uint32_t time;
+    uint16_t suppressed;        // 此前该调用点被省略的条数
+    char level;
+    uint8_t reserved;
+};
+
+// 多生产者单消费者: 生产者用CAS预留空间, 写完内容后最后写入长度;
+// 消费者看到非0长度才读取, 读完把整条记录清零后再释放空间
+struct LogRing {
+    alignas(4) uint8_t data[LOG_RING_SIZE];
+    std::atomic<uint32_t> head;         // 只增不减, 取模得到下标
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> lines;
+    std::atomic<uint32_t> dropped;      // 缓冲满丢弃
+    std::atomic<uint32_t> suppressed;   // 超过调用点频率限制
+    std::atomic<uint32_t> writeUs;      // 调用处累计耗时
+    std::atomic<uint32_t> maxWriteUs;
+    std::atomic<uint32_t> formatUs;     // 日志任务中格式化的累计耗时
+} logRing;
+
+void logWrite(char level, LogSite* site, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+void logWrite(char level, LogSite* site, const char* fmt, ...) {
+    unsigned long start = micros();
+    uint32_t now = millis();
+    uint32_t window = site->windowStart.load();
+    if(now - window >= 1000 && site->windowStart.compare_exchange_strong(window, now)) {
+        site->count.store(0);
+    }
+    if(site->count.fetch_add(1) >= LOG_SITE_BURST) {
+        site->suppressed++;
+        logRing.suppressed++;
+        return;
+    }
+    
+    uint8_t line[sizeof(LogRecordHeader) + LOG_ARGS_MAX];
+    LogRecordHeader header = {fmt, now, site->suppressed.exchange(0), level, 0};
+    memcpy(line, &header, sizeof(header));
+    va_list args;
+    va_start(args, fmt);
+    int n = sizeof(header) + logEncodeArgs(line + sizeof(header), LOG_ARGS_MAX, fmt, args);
+    va_end(args);
+    
+    uint32_t need = (4 + n + 3) & ~3u;
+    uint32_t h = logRing.head.load();
+    do {
+        if(h + need - logRing.tail.load() > LOG_RING_SIZE) {
+            logRing.dropped++;
+            return;
+        }
+    } while(!logRing.head.compare_exchange_weak(h, h + need));
+    for(int i = 0; i < n; i++) {
+        logRing.data[(h + 4 + i) % LOG_RING_SIZE] = line[i];
+    }
+    __atomic_store_n((uint32_t*)&logRing.data[h % LOG_RING_SIZE], (uint32_t)n, __ATOMIC_RELEASE);
+    
+    logRing.lines++;
+    uint32_t us = micros() - start;
+    logRing.writeUs += us;
+    uint32_t max = logRing.maxWriteUs.load();
+    while(us > max && !logRing.maxWriteUs.compare_exchange_weak(max, us)) {}
+}
+
+// 低优先级任务: 取出已完成的记录, 格式化后写串口
+void logDrainTask(void* param) {
+    uint8_t record[sizeof(LogRecordHeader) + LOG_ARGS_MAX];
+    char out[LOG_LINE_MAX];
+    for(;;) {
+        uint32_t t = logRing.tail.load();
+        uint32_t len = t == logRing.head.load() ? 0 :
+            __atomic_load_n((uint32_t*)&logRing.data[t % LOG_RING_SIZE], __ATOMIC_ACQUIRE);
+        if(len == 0) {
+            vTaskDelay(pdMS_TO_TICKS(20));
+            continue;
+        }
+        for(uint32_t i = 0; i < len; i++) {
+            record[i] = logRing.data[(t + 4 + i) % LOG_RING_SIZE];
+        }
+        uint32_t need = (4 + len + 3) & ~3u;
+        for(uint32_t i = 0; i < need; i++) {
+            logRing.data[(t + i) % LOG_RING_SIZE] = 0;
+        }
+        logRing.tail.store(t + need);
+        
+        unsigned long start = micros();
+        LogRecordHeader header;
+        memcpy(&header, record, sizeof(header));
+        size_t n = snprintf(out, sizeof(out), "[%c %lu] ", header.level, (unsigned long)header.time);
+        n += logFormatArgs(out + n, sizeof(out) - n, header.fmt, record + sizeof(header), len - sizeof(header));
+        if(header.suppressed && n < LOG_LINE_MAX - 24) {
+            n += snprintf(out + n, sizeof(out) - n, " (省略%u条)", header.suppressed);
+        }
+        if(n > LOG_LINE_MAX - 2) n = LOG_LINE_MAX - 2;
+        out[n++] = '\n';
+        logRing.formatUs += micros() - start;
+        Serial.write((const uint8_t*)out, n);
+    }
+}
+
+void logBegin() {
+    xTaskCreatePinnedToCore(logDrainTask, "log", 3072, NULL, 0, NULL, 0);
+}
+
+#define LOG_AT(tag, fmt, ...) do { \
+        static LogSite logSite_; \
+        logWrite(tag, &logSite_, fmt, ##__VA_ARGS__); \
+    } while(0)
+#define LOG_NONE(fmt, ...) do {} while(0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...) LOG_AT('E', fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...) LOG_AT('W', fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...) LOG_AT('I', fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...) LOG_AT('D', fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) LOG_NONE(fmt, ##__VA_ARGS__)
+#endif
+
+// 动画相关常量
+const unsigned long ANIMATION_INTERVAL = 50;  // 动画更新间隔(ms)
+
+// 动画相关变量
+unsigned long lastAnimationUpdate = 0;  // 上次动画更新时间
+uint8_t animationFrame = 0;            // 动画帧计数器
+uint8_t breathBrightness = 0;          // 呼吸效果亮度
+volatile uint8_t activeUploads = 0;    // 正在接收的上传请求数
+volatile bool streamActive = false;    // 实时投屏中
+unsigned long lastActivity = 0;        // 上次用户操作(页面/上传/投屏/设置)的时间
+unsigned long lastRequest = 0;         // 上次处理HTTP请求的时间(包括轮询)
+
+void markActivity() {
+    lastActivity = millis();
+}
+
+// 上传处理函数在START和END/ABORTED时成对调用; 计数而不是标志, 一个请求结束不会清掉另一个
+void uploadStarted() {
+    activeUploads++;
+    markActivity();
+}
+
+void uploadFinished() {
+    if(activeUploads > 0) activeUploads--;
+}
+
+bool isUploading() {
+    return activeUploads > 0;
+}
+
+// 修改图片动画相关结构
+struct ImageAnimation {
+    float wave = 0;             // 波动效果
+    float waveStrength = 0;     // 波动强度
+    float waveSpeed = 0;        // 波动速度
+    unsigned long lastWave = 0;  // 上次波动时间
+    unsigned long waveInterval = 0; // 波动间隔
+    bool inWave = false;        // 是否在波动中
+    float damping = 0.95;       // 阻尼系数
+    bool enabled = false;       // 动画启用标志
+    
+    // 添加变形网格
+    static const int GRID_SIZE = 16;  // 网格大小
+    float gridX[GRID_SIZE][GRID_SIZE] = {0}; // X方向偏移
+    float gridY[GRID_SIZE][GRID_SIZE] = {0}; // Y方向偏移
+    float targetX[GRID_SIZE][GRID_SIZE] = {0}; // 目标X偏移
+    float targetY[GRID_SIZE][GRID_SIZE] = {0}; // 目标Y偏移
+    float springStrength = 0.2;  // 弹簧强度
+    float friction = 0.8;        // 摩擦力
+} imgAnim;
+
+// 在全局变量区域添加
+#define MIN_HEAP_SIZE 30000  // 最小堆内存(bytes)
+hw_timer_t *watchDog = NULL; // 看门狗定时器
+unsigned long lastHeapCheck = 0; // 上次内存检查时间
+const int HEAP_CHECK_INTERVAL = 10000; // 内存检查间隔(ms)
+
+// 内存预算: 启动时为绘制、上传和缓存各划出一块固定内存, 各自用独立的堆分配,
+// 互不挤占; 系统堆至少留MEM_HTTP_RESERVE给WiFi和HTTP(首页约35KB).
+// 内存紧张时降级(动态效果改为直接显示、释放缓存)而不是重启
+#define MEM_HTTP_RESERVE (64 * 1024)
+#define MEM_RENDER_ARENA (40 * 1024)      // 解码工作区、条带和过渡缓冲, 两个核心同时使用
+#define MEM_UPLOAD_ARENA (66 * 1024)      // 上传内存缓冲(48KB)和增量更新的图块(16KB)
+#define MEM_CACHE_ARENA (52 * 1024)       // 并行解码的整个JPEG、GIF录制、平移缩放图块缓存
+#define MEM_ARENA_MIN (8 * 1024)          // 剩余内存不足这么多时不建立该区
+#define MEM_RECOVER_MARGIN (16 * 1024)    // 系统堆回升超过下限这么多后解除降级
+
+enum MemArena {
+    ARENA_RENDER,
+    ARENA_UPLOAD,
+    ARENA_CACHE,
+    ARENA_COUNT
+};
+
+struct ArenaState {
+    const char* name;
+    size_t request;             // 配置的大小
+    size_t capacity;            // 实际划出的大小
+    uint8_t* base;
+    multi_heap_handle_t heap;
+    size_t used;                // 按分配块实际大小计
+    size_t highWater;
+    uint32_t allocs;
+    uint32_t failures;
+};
+
+ArenaState arenas[ARENA_COUNT] = {
+    {"render", MEM_RENDER_ARENA},
+    {"upload", MEM_UPLOAD_ARENA},
+    {"cache", MEM_CACHE_ARENA},
+};
+portMUX_TYPE arenaMux = portMUX_INITIALIZER_UNLOCKED;
+
+struct MemoryState {
+    bool degraded;              // 降级中: 不做动态效果, 缓存已释放
+    uint32_t degradations;
+    uint32_t heapFailures;      // 解码器对象等从系统堆分配失败的次数(不抛异常, 跳过该功能)
+    size_t systemAtBoot;        // 划分后留给系统的堆
+    size_t systemLow;           // 系统堆的最低值
+} memoryState;
+
+// 启动时按顺序划分, 内存不够时后面的区变小或不建立(对应功能退回闪存或跳过)
+void memoryBegin() {
+    for(int i = 0; i < ARENA_COUNT; i++) {
+        ArenaState& a = arenas[i];
+        size_t avail = ESP.getFreeHeap();
+        size_t size = avail > MEM_HTTP_RESERVE ? avail - MEM_HTTP_RESERVE : 0;
+        size = min(min(size, a.request), (size_t)ESP.getMaxAllocHeap());
+        if(size >= MEM_ARENA_MIN) a.base = (uint8_t*)malloc(size);
+        if(a.base) a.heap = multi_heap_register(a.base, size);
+        if(!a.heap) {
+            free(a.base);
+            a.base = NULL;
+            size = 0;
+        }
+        a.capacity = size;
+        LOG_INFO("内存区 %s: %u/%u 字节", a.name, (unsigned)a.capacity, (unsigned)a.request);
+    }
+    memoryState.systemAtBoot = memoryState.systemLow = ESP.getFreeHeap();
+}
+
+// O(1)查询: 按已用量判断, 碎片导致的失败由arenaAlloc返回NULL体现
+bool arenaAdmit(MemArena which, size_t bytes) {
+    const ArenaState& a = arenas[which];
+    return a.heap && !memoryState.degraded && a.used + bytes <= a.capacity;
+}
+
+void* arenaAlloc(MemArena which, size_t bytes) {
+    ArenaState& a = arenas[which];
+    if(!a.heap) return NULL;
+    portENTER_CRITICAL(&arenaMux);
+    void* p = multi_heap_malloc(a.heap, bytes);
+    if(p) {
+        a.used += multi_heap_get_allocated_size(a.heap, p);
+        if(a.used > a.highWater) a.highWater = a.used;
+        a.allocs++;
+    } else {
+        a.failures++;
+    }
+    portEXIT_CRITICAL(&arenaMux);
+    return p;
+}
+
+void arenaFree(MemArena which, void* p) {
+    ArenaState& a = arenas[which];
+    if(!p) return;
+    portENTER_CRITICAL(&arenaMux);
+    a.used -= multi_heap_get_allocated_size(a.heap, p);
+    multi_heap_free(a.heap, p);
+    portEXIT_CRITICAL(&arenaMux);
+}
+
+// 添加显示模式枚举
+enum DisplayMode {
+    CLEAR_MODE,      // 清晰显示模式
+    DYNAMIC_MODE     // 动态油画模式
+};
+
+// 添加全局变量
+DisplayMode currentDisplayMode = DYNAMIC_MODE;
+const char* DISPLAY_MODE_FILE = "/display_mode.txt";  // 旧版本保存显示模式的文件, 现在只用于迁移
+
+// 照片格式: JPEG由TJpgDec解码, Q565为浏览器预先编码的无损压缩RGB565
+enum PhotoFormat {
+    PHOTO_NONE,      // 没有照片
+    PHOTO_JPEG,      // JPEG格式
+    PHOTO_Q565,      // QOI风格压缩的RGB565格式
+    PHOTO_RAW,       // 未压缩RGB565("R565"文件头, 大端像素)
+    PHOTO_GIF        // GIF动画, 显示时循环播放
+};
+
+unsigned long lastDecodeTime = 0;             // 上次解码耗时(us)
+const char* lastDecoderName = "";             // 上次使用的解码后端
+
+// 解码输出回调, 与TJpgDec回调签名一致(像素已交换字节)
+typedef bool (*PixelSink)(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap);
+
+// 解码数据源: 文件、内存或网络流
+enum ImageSourceType {
+    IMAGE_SRC_FILE   = 1,
+    IMAGE_SRC_MEMORY = 2,
+    IMAGE_SRC_STREAM = 4
+};
+
+struct ImageSource {
+    ImageSourceType type;
+    const char* path;        // IMAGE_SRC_FILE
+    const uint8_t* data;     // IMAGE_SRC_MEMORY
+    Stream* stream;          // IMAGE_SRC_STREAM
+    size_t size;             // 数据总长度
+    int8_t restart;          // JPEG是否带DRI重启间隔: -1未知, 0没有, 1有
+};
+
+ImageSource fileSource(const char* path, size_t size) {
+    ImageSource src = {IMAGE_SRC_FILE, path, NULL, NULL, size, -1};
+    return src;
+}
+
+ImageSource memorySource(const uint8_t* data, size_t size) {
+    ImageSource src = {IMAGE_SRC_MEMORY, NULL, data, NULL, size, -1};
+    return src;
+}
+
+ImageSource streamSource(Stream* stream, size_t size) {
+    ImageSource src = {IMAGE_SRC_STREAM, NULL, NULL, stream, size, -1};
+    return src;
+}
+
+// 解码结果: SKIPPED表示后端不适用(还未输出任何像素), 可以换下一个后端
+enum DecodeResult {
+    DECODE_OK,
+    DECODE_SKIPPED,
+    DECODE_ERROR
+};
+
+// 双核并行JPEG解码(需要JPEG带DRI重启间隔)
+#define PARALLEL_JPEG_DECODE true
+#ifndef TJPGD_WORKSPACE_SIZE
+#define TJPGD_WORKSPACE_SIZE 3100
+#endif
+SemaphoreHandle_t tftMutex = NULL;  // 两个核心同时输出时保护SPI总线和动画状态
+
+// 色彩变换: 亮度、夜间暖色和伽马合成为按通道的查找表, 每个像素三次查表
+// 表项已按屏幕字节序放好位置, 直接对交换过字节的像素取下标再按位或
+#define NIGHT_BRIGHTNESS 30       // 夜间模式的最高亮度(%)
+#define NIGHT_WARMTH 60           // 夜间模式的最低暖色强度(%)
+#define IDLE_DIM_PERCENT 30       // 长时间无操作后的亮度比例(%)
+
+#ifdef TFT_BL
+#define BACKLIGHT_PWM_CHANNEL 7
+#define BACKLIGHT_PWM_FREQ 5000
+#define BACKLIGHT_PWM_BITS 8
+#define BACKLIGHT_MIN_LEVEL 10    // 低于该占空比背光会闪烁, 更暗的部分由查找表完成
+#endif
+
+struct ColorSettings {
+    uint8_t brightness = 100;     // 0..100
+    bool night = false;
+    uint8_t warmth = 0;           // 0..100, 降低绿色和蓝色
+    uint8_t gamma = 10;           // 十分之一为单位, 10为不变
+} colorSettings;
+
+// 叠加层设置(时钟开关和时区), 说明文字只在运行时保存
+struct OverlaySettings {
+    bool clock = false;
+    int tzMinutes = 480;          // 与UTC相差的分钟数, 由页面加载时设置
+} overlaySettings;
+
+ColorLut colorLut;
+bool colorIdentity = true;        // 查找表不改变像素时跳过变换
+bool colorLutDirty = true;        // 设置改变后在loop中重建
+uint8_t backlightLevel = 100;     // 当前背光占空比(%)
+bool idleDimmed = false;          // 由功耗调节器设置
+
+// 设置: 保存在nvs分区, 运行时以内存中的变量为准; 修改后延迟写回,
+// 连续的修改只写一次, 改回原值则不写
+#define SETTINGS_NAMESPACE "album"
+#define SETTINGS_VERSION 1
+#define SETTINGS_FLUSH_DELAY 2000     // 最后一次修改后多久写入(ms)
+
+enum SettingType {
+    SETTING_U8,
+    SETTING_BOOL,
+    SETTING_ENUM,       // 枚举变量, 按int保存
+    SETTING_INT         // int变量
+};
+
+struct SettingDef {
+    const char* key;    // NVS键名, 最长15个字符
+    SettingType type;
+    void* value;
+    int32_t minValue;   // 读出超出范围的值时保留默认值
+    int32_t maxValue;
+};
+
+const SettingDef settingDefs[] = {
+    {"mode",       SETTING_ENUM, &currentDisplayMode,       CLEAR_MODE, DYNAMIC_MODE},
+    {"brightness", SETTING_U8,   &colorSettings.brightness, 0, 100},
+    {"night",      SETTING_BOOL, &colorSettings.night,      0, 1},
+    {"warmth",     SETTING_U8,   &colorSettings.warmth,     0, 100},
+    {"gamma",      SETTING_U8,   &colorSettings.gamma,      5, 30},
+    {"clock",      SETTING_BOOL, &overlaySettings.clock,    0, 1},
+    {"tz",         SETTING_INT,  &overlaySettings.tzMinutes, -720, 840},
+};
+#define SETTINGS_COUNT (sizeof(settingDefs) / sizeof(settingDefs[0]))
+
+Preferences settingsPrefs;
+
+struct SettingsState {
+    int32_t stored[SETTINGS_COUNT];   // 闪存中的值, 写回时只写有变化的项
+    bool dirty;
+    unsigned long changedAt;
+    uint32_t loadUs;                  // 启动时读取全部设置的耗时
+    uint32_t changes;                 // markSettingsChanged调用次数
+    uint32_t flushes;
+    uint32_t writes;                  // 实际写入的项数
+} settings;
+
+int32_t settingGet(const SettingDef& def) {
+    switch(def.type) {
+        case SETTING_U8:   return *(uint8_t*)def.value;
+        case SETTING_BOOL: return *(bool*)def.value;
+        default:           return *(int*)def.value;
+    }
+}
+
+void settingSet(const SettingDef& def, int32_t v) {
+    if(v < def.minValue || v > def.maxValue) return;
+    switch(def.type) {
+        case SETTING_U8:   *(uint8_t*)def.value = v; break;
+        case SETTING_BOOL: *(bool*)def.value = v != 0; break;
+        default:           *(int*)def.value = v; break;
+    }
+}
+
+bool settingWrite(const SettingDef& def, int32_t v) {
+    switch(def.type) {
+        case SETTING_U8:   return settingsPrefs.putUChar(def.key, v) > 0;
+        case SETTING_BOOL: return settingsPrefs.putBool(def.key, v) > 0;
+        default:           return settingsPrefs.putInt(def.key, v) > 0;
+    }
+}
+
+// 写入有变化的项
+void flushSettings() {
+    settings.dirty = false;
+    bool any = false;
+    for(size_t i = 0; i < SETTINGS_COUNT; i++) {
+        int32_t v = settingGet(settingDefs[i]);
+        if(v == settings.stored[i]) continue;
+        if(settingWrite(settingDefs[i], v)) {
+            settings.stored[i] = v;
+            settings.writes++;
+            any = true;
+        }
+    }
+    if(any) settings.flushes++;
+}
+
+void markSettingsChanged() {
+    settings.dirty = true;
+    settings.changedAt = millis();
+    settings.changes++;
+}
+
+// 在loop中调用
+void settingsTick() {
+    if(settings.dirty && millis() - settings.changedAt >= SETTINGS_FLUSH_DELAY) flushSettings();
+}
+
+// 启动时读取; 没有版本号说明是旧固件, 从文件迁移显示模式; 版本比固件新(降级)时恢复默认
+void loadSettings() {
+    unsigned long start = micros();
+    settingsPrefs.begin(SETTINGS_NAMESPACE, false);
+    uint16_t version = settingsPrefs.getUShort("version", 0);
+    if(version > SETTINGS_VERSION) {
+        settingsPrefs.clear();
+        version = 0;
+    }
+    for(size_t i = 0; i < SETTINGS_COUNT; i++) {
+        const SettingDef& def = settingDefs[i];
+        int32_t v = settingGet(def);
+        if(version > 0 && settingsPrefs.isKey(def.key)) {
+            switch(def.type) {
+                case SETTING_U8:   v = settingsPrefs.getUChar(def.key, v); break;
+                case SETTING_BOOL: v = settingsPrefs.getBool(def.key, v); break;
+                default:           v = settingsPrefs.getInt(def.key, v); break;
+            }
+            settingSet(def, v);
+            settings.stored[i] = v;
+        } else {
+            settings.stored[i] = INT32_MIN;     // 闪存中没有, 下次写回时写入
+        }
+    }
+    settings.loadUs = micros() - start;
+
+    if(version < SETTINGS_VERSION) {
+        if(PHOTO_FS.exists(DISPLAY_MODE_FILE)) {
+            File file = PHOTO_FS.open(DISPLAY_MODE_FILE, FILE_READ);
+            if(file) {
+                settingSet(settingDefs[0], file.read());
+                file.close();
+            }
+            PHOTO_FS.remove(DISPLAY_MODE_FILE);
+        }
+        settingsPrefs.putUShort("version", SETTINGS_VERSION);
+        flushSettings();
+        settings.flushes = settings.writes = 0;     // 统计只计运行中的修改
+    }
+    LOG_INFO("设置读取 %lu us", (unsigned long)settings.loadUs);
+}
+
+// 亮度优先由背光PWM完成, 查找表只承担背光下限以下的部分和色调调整
+void rebuildColorLut() {
+    uint8_t bright = colorSettings.night ? min(colorSettings.brightness, (uint8_t)NIGHT_BRIGHTNESS) : colorSettings.brightness;
+    uint8_t warmth = colorSettings.night ? max(colorSettings.warmth, (uint8_t)NIGHT_WARMTH) : colorSettings.warmth;
+    if(idleDimmed) bright = bright * IDLE_DIM_PERCENT / 100;
+#ifdef TFT_BL
+    backlightLevel = max(bright, (uint8_t)BACKLIGHT_MIN_LEVEL);
+    ledcWrite(BACKLIGHT_PWM_CHANNEL, backlightLevel * ((1 << BACKLIGHT_PWM_BITS) - 1) / 100);
+#else
+    backlightLevel = 100;
+#endif
+    
+    colorLutBuild(colorLut, (float)bright / backlightLevel, warmth, colorSettings.gamma / 10.0f);
+    colorIdentity = bright == backlightLevel && warmth == 0 && colorSettings.gamma == 10;
+    colorLutDirty = false;
+}
+
+// 在loop中调用, 避免解码过程中修改正在使用的表
+void updateColorLut() {
+    if(colorLutDirty) rebuildColorLut();
+}
+
+// 对已交换字节的像素就地做色彩变换
+void applyColorLut(uint16_t* px, uint32_t count) {
+    if(!colorIdentity) colorLutApply(colorLut, px, count);
+}
+
+// 动态模式: 第一次显示照片时初始化网格(这一次不变形), 之后返回true
+bool warpReady() {
+    if(imgAnim.enabled) return true;
+    // 首次显示图片时初始化网格
+    static bool firstDisplay = true;
+    if(firstDisplay) {
+        firstDisplay = false;
+        // 初始化网格位置
+        for(int i = 0; i < imgAnim.GRID_SIZE; i++) {
+            for(int j = 0; j < imgAnim.GRID_SIZE; j++) {
+                imgAnim.gridX[i][j] = 0;
+                imgAnim.gridY[i][j] = 0;
+                imgAnim.targetX[i][j] = 0;
+                imgAnim.targetY[i][j] = 0;
+            }
+        }
+        imgAnim.enabled = true;
+    }
+    return false;
+}
+
+// 网格弹簧前进一步, 把src按网格偏移变形到dst; 流式路径按块调用, 整帧缓冲时对整帧调用
+void warpImage(const uint16_t* src, uint16_t* dst, uint16_t w, uint16_t h) {
+    if(w > SCREEN_WIDTH) {
+        memcpy(dst, src, w * h * sizeof(uint16_t));
+        return;
+    }
+    
+    // 计算网格单元大小
+    float cellWidth = (float)w / (imgAnim.GRID_SIZE - 1);
+    float cellHeight = (float)h / (imgAnim.GRID_SIZE - 1);
+    
+    // 更新网格变形
+    for(int i = 0; i < imgAnim.GRID_SIZE; i++) {
+        for(int j = 0; j < imgAnim.GRID_SIZE; j++) {
+            // 计算弹簧
+            float dx = imgAnim.targetX[i][j] - imgAnim.gridX[i][j];
+            float dy = imgAnim.targetY[i][j] - imgAnim.gridY[i][j];
+            
+            // 应用弹簧力和摩擦力
+            imgAnim.gridX[i][j] += dx * imgAnim.springStrength;
+            imgAnim.gridY[i][j] += dy * imgAnim.springStrength;
+            
+            // 应用摩擦力
+            imgAnim.gridX[i][j] *= imgAnim.friction;
+            imgAnim.gridY[i][j] *= imgAnim.friction;
+        }
+    }
+    
+    // 应用网格变形到图像: 列所在的网格和小数只与x有关, 先算好;
+    // 每行先在竖直方向插值出各网格列的偏移(8位小数定点), 行内每个像素只剩一次水平插值,
+    // 得到的取样下标由pxGather取出(越界的像素保持原样)
+    static uint8_t colGrid[SCREEN_WIDTH];
+    static uint16_t colFrac[SCREEN_WIDTH];      // 0..256
+    static int32_t index[SCREEN_WIDTH];
+    int cellW = max(1, (int)cellWidth), cellH = max(1, (int)cellHeight);
+    for(int px = 0; px < w; px++) {
+        colGrid[px] = px / cellWidth;
+        colFrac[px] = (px % cellW) / cellWidth * 256;
+    }
+    
+    for(int py = 0; py < h; py++) {
+        int gridY = py / cellHeight;
+        float fracY = (py % cellH) / cellHeight;
+        int32_t rowX[imgAnim.GRID_SIZE], rowY[imgAnim.GRID_SIZE];
+        for(int i = 0; i < imgAnim.GRID_SIZE; i++) {
+            rowX[i] = (imgAnim.gridX[i][gridY] * (1 - fracY) + imgAnim.gridX[i][gridY + 1] * fracY) * 256;
+            rowY[i] = (imgAnim.gridY[i][gridY] * (1 - fracY) + imgAnim.gridY[i][gridY + 1] * fracY) * 256;
+        }
+        
+        for(int px = 0; px < w; px++) {
+            int g = colGrid[px];
+            int32_t f = colFrac[px];
+            int32_t offsetX = rowX[g] + (((rowX[g + 1] - rowX[g]) * f) >> 8);
+            int32_t offsetY = rowY[g] + (((rowY[g + 1] - rowY[g]) * f) >> 8);
+            int sourceX = (px * 256 + offsetX) >> 8;
+            int sourceY = (py * 256 + offsetY) >> 8;
+            
+            // 确保在边界
+            if(sourceX >= 0 && sourceX < w && sourceY >= 0 && sourceY < h) {
+                index[px] = sourceY * w + sourceX;
+            } else {
+                index[px] = py * w + px;
+            }
+        }
+        pxGather(dst + py * w, src, index, w);
+    }
+}
+
+// 修改JPEG解码回调函数
+bool tft_output(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap)
+{
+    applyColorLut(bitmap, w * h);
+    
+    if(currentDisplayMode == CLEAR_MODE) {
+        // 清晰模式直接显示
+        tft.pushImage(x, y, w, h, bitmap);
+        return true;
+    }
+    
+    // 动态油画模式的现有代码; 内存降级时直接显示
+    if(memoryState.degraded) {
+        tft.pushImage(x, y, w, h, bitmap);
+        return true;
+    }
+    
+    if(!warpReady()) {
+        // 直接显示原图
+        tft.pushImage(x, y, w, h, bitmap);
+        return true;
+    }
+
+    // 创建临时缓冲区
+    uint16_t* tempBitmap = (uint16_t*)arenaAlloc(ARENA_RENDER, w * h * sizeof(uint16_t));
+    if(!tempBitmap) {
+        tft.pushImage(x, y, w, h, bitmap);
+        return true;
+    }
+    warpImage(bitmap, tempBitmap, w, h);
+    
+    // 显示处理后的图像
+    tft.pushImage(x, y, w, h, tempBitmap);
+    arenaFree(ARENA_RENDER, tempBitmap);
+    
+    return true;
+}
+
+// Q565格式和流式解码器见lib/q565
+#define Q565_STRIP_ROWS 16     // 每次推送的行数
+#define Q565_READ_BUF 512      // 文件读取缓冲
+
+// 统一的顺序读取接口, 解码器不关心数据来自哪里
+struct ImageReader {
+    ImageSource src;
+    File file;
+    size_t pos;
+    
+    bool open(const ImageSource& source) {
+        src = source;
+        pos = 0;
+        if(src.type == IMAGE_SRC_FILE) {
+            file = PHOTO_FS.open(src.path, FILE_READ);
+            if(!file) return false;
+            src.size = file.size();
+        }
+        return src.type != IMAGE_SRC_MEMORY || src.data != NULL;
+    }
+    
+    size_t read(uint8_t* buf, size_t len) {
+        size_t n = 0;
+        if(src.type == IMAGE_SRC_FILE) {
+            n = file.read(buf, len);
+        } else if(src.type == IMAGE_SRC_MEMORY) {
+            n = min(len, src.size - pos);
+            memcpy(buf, src.data + pos, n);
+        } else {
+            if(src.size > 0 && pos + len > src.size) len = src.size - pos;
+            n = src.stream->readBytes(buf, len);
+        }
+        pos += n;
+        return n;
+    }
+    
+    void close() {
+        if(file) file.close();
+    }
+};
+
+// 把逐行产生的像素按缩放比例抽取, 攒成条带后送给输出回调
+struct StripWriter {
+    PixelSink sink;
+    int16_t x, y;
+    uint16_t srcW, outW;
+    uint8_t scale;
+    uint16_t* strip;
+    uint16_t stripRows;     // 条带中已有的行数
+    uint16_t outY;          // 条带第一行的输出坐标
+    uint16_t srcRow;        // 已收到的源行数
+    bool ok;
+    
+    bool begin(PixelSink s, int16_t px, int16_t py, uint16_t w, uint8_t sc) {
+        sink = s;
+        x = px;
+        y = py;
+        srcW = w;
+        scale = sc ? sc : 1;
+        outW = (w + scale - 1) / scale;
+        stripRows = 0;
+        outY = 0;
+        srcRow = 0;
+        ok = true;
+        strip = (uint16_t*)arenaAlloc(ARENA_RENDER, outW * Q565_STRIP_ROWS * sizeof(uint16_t));
+        return strip != NULL;
+    }
+    
+    void addRow(const uint16_t* row) {
+        if(srcRow++ % scale != 0) return;
+        uint16_t* dst = strip + stripRows * outW;
+        if(scale == 1) {
+            memcpy(dst, row, outW * sizeof(uint16_t));
+        } else {
+            for(uint16_t i = 0; i < outW; i++) dst[i] = row[i * scale];
+        }
+        if(++stripRows == Q565_STRIP_ROWS) flush();
+    }
+    
+    void flush() {
+        if(stripRows > 0 && ok) {
+            ok = sink(x, y + outY, outW, stripRows, strip);
+        }
+        outY += stripRows;
+        stripRows = 0;
+    }
+    
+    bool end() {
+        flush();
+        arenaFree(ARENA_RENDER, strip);
+        strip = NULL;
+        return ok;
+    }
+};
+
+// 读取Q565/R565共用的8字节文件头
+bool readRgb565Header(ImageReader& reader, const char* magic, uint16_t* w, uint16_t* h) {
+    uint8_t header[Q565_HEADER_SIZE];
+    if(reader.read(header, Q565_HEADER_SIZE) != Q565_HEADER_SIZE || memcmp(header, magic, 4) != 0) {
+        return false;
+    }
+    *w = header[4] | (header[5] << 8);
+    *h = header[6] | (header[7] << 8);
+    return *w > 0 && *h > 0 && *w <= SCREEN_WIDTH * 2 && *h <= SCREEN_HEIGHT * 2;
+}
+
+// Q565后端: 流式解码, 逐行输出
+DecodeResult q565Draw(const ImageSource& src, int16_t x, int16_t y, uint8_t scale, PixelSink sink) {
+    ImageReader reader;
+    uint16_t w, h;
+    if(!reader.open(src)) return DECODE_ERROR;
+    if(!readRgb565Header(reader, "Q565", &w, &h)) {
+        LOG_WARN("Q565文件头无效");
+        reader.close();
+        return DECODE_ERROR;
+    }
+    
+    StripWriter out;
+    uint16_t* row = (uint16_t*)arenaAlloc(ARENA_RENDER, w * sizeof(uint16_t));
+    uint8_t* inBuf = (uint8_t*)arenaAlloc(ARENA_RENDER, Q565_READ_BUF);
+    if(!row || !inBuf || !out.begin(sink, x, y, w, scale)) {
+        arenaFree(ARENA_RENDER, row);
+        arenaFree(ARENA_RENDER, inBuf);
+        reader.close();
+        return DECODE_ERROR;
+    }
+    
+    Q565Decoder dec;
+    dec.reset();
+    size_t inLen = 0, inPos = 0;
+    bool ok = true;
+    
+    for(uint16_t r = 0; r < h && ok; r++) {
+        size_t got = 0;
+        while(got < w) {
+            if(inPos >= inLen) {
+                inLen = reader.read(inBuf, Q565_READ_BUF);
+                inPos = 0;
+                if(inLen == 0 && dec.run == 0) {
+                    ok = false;  // 数据不完整
+                    break;
+                }
+            }
+            size_t used = 0;
+            got += dec.decode(inBuf + inPos, inLen - inPos, &used, row + got, w - got);
+            inPos += used;
+        }
+        if(ok) {
+            out.addRow(row);
+            ok = out.ok;
+        }
+    }
+    
+    ok = out.end() && ok;
+    arenaFree(ARENA_RENDER, inBuf);
+    arenaFree(ARENA_RENDER, row);
+    reader.close();
+    return ok ? DECODE_OK : DECODE_ERROR;
+}
+
+// 原始RGB565后端: 文件中的像素已是大端, 直接按行读取
+DecodeResult rawDraw(const ImageSource& src, int16_t x, int16_t y, uint8_t scale, PixelSink sink) {
+    ImageReader reader;
+    uint16_t w, h;
+    if(!reader.open(src)) return DECODE_ERROR;
+    if(!readRgb565Header(reader, "R565", &w, &h)) {
+        reader.close();
+        return DECODE_ERROR;
+    }
+    
+    StripWriter out;
+    uint16_t* row = (uint16_t*)arenaAlloc(ARENA_RENDER, w * sizeof(uint16_t));
+    if(!row || !out.begin(sink, x, y, w, scale)) {
+        arenaFree(ARENA_RENDER, row);
+        reader.close();
+        return DECODE_ERROR;
+    }
+    
+    bool ok = true;
+    for(uint16_t r = 0; r < h && ok; r++) {
+        ok = reader.read((uint8_t*)row, w * sizeof(uint16_t)) == w * sizeof(uint16_t);
+        if(ok) {
+            out.addRow(row);
+            ok = out.ok;
+        }
+    }
+    
+    ok = out.end() && ok;
+    arenaFree(ARENA_RENDER, row);
+    reader.close();
+    return ok ? DECODE_OK : DECODE_ERROR;
+}
+
+// JPEG文件头解析和按重启标记拆分见lib/jpeg_restart
+// 一个在某个核心上独立解码的片段
+struct JpegSlice {
+    JpegSliceStream stream;
+    int16_t x, y;             // 输出位置
+    PixelSink sink;
+    JRESULT result;
+};
+
+size_t jpegSliceInput(JDEC* jd, uint8_t* buf, size_t len) {
+    return ((JpegSlice*)jd->device)->stream.read(buf, len);
+}
+
+int jpegSliceOutput(JDEC* jd, void* bitmap, JRECT* rect) {
+    JpegSlice* s = (JpegSlice*)jd->device;
+    uint16_t* px = (uint16_t*)bitmap;
+    uint16_t w = rect->right - rect->left + 1;
+    uint16_t h = rect->bottom - rect->top + 1;
+    pxSwap(px, (uint32_t)w * h);
+    
+    xSemaphoreTake(tftMutex, portMAX_DELAY);
+    bool ok = s->sink(s->x + rect->left, s->y + rect->top, w, h, px);
+    xSemaphoreGive(tftMutex);
+    return ok ? 1 : 0;
+}
+
+void decodeJpegSlice(JpegSlice* slice) {
+    uint8_t* pool = (uint8_t*)arenaAlloc(ARENA_RENDER, TJPGD_WORKSPACE_SIZE);
+    if(!pool) {
+        slice->result = JDR_MEM1;
+        return;
+    }
+    JDEC jd;
+    slice->result = jd_prepare(&jd, jpegSliceInput, pool, TJPGD_WORKSPACE_SIZE, slice);
+    if(slice->result == JDR_OK) {
+        slice->result = jd_decomp(&jd, jpegSliceOutput, 0);
+    }
+    arenaFree(ARENA_RENDER, pool);
+}
+
+// 直接用tjpgd从文件解码, 不使用全局TJpgDec对象, 可以在后台任务中与前台解码同时进行
+struct JpegFileJob {
+    File file;
+    PixelSink sink;
+};
+
+size_t jpegFileInput(JDEC* jd, uint8_t* buf, size_t len) {
+    JpegFileJob* job = (JpegFileJob*)jd->device;
+    if(buf) return job->file.read(buf, len);
+    return job->file.seek(len, SeekCur) ? len : 0;
+}
+
+int jpegFileOutput(JDEC* jd, void* bitmap, JRECT* rect) {
+    JpegFileJob* job = (JpegFileJob*)jd->device;
+    uint16_t* px = (uint16_t*)bitmap;
+    uint16_t w = rect->right - rect->left + 1;
+    uint16_t h = rect->bottom - rect->top + 1;
+    pxSwap(px, (uint32_t)w * h);
+    return job->sink(rect->left, rect->top, w, h, px) ? 1 : 0;
+}
+
+bool decodeJpegFile(const char* path, PixelSink sink, uint8_t scale) {
+    JpegFileJob job;
+    job.file = PHOTO_FS.open(path, FILE_READ);
+    job.sink = sink;
+    uint8_t* pool = (uint8_t*)arenaAlloc(ARENA_RENDER, TJPGD_WORKSPACE_SIZE);
+    if(!job.file || !pool) {
+        arenaFree(ARENA_RENDER, pool);
+        return false;
+    }
+    JDEC jd;
+    JRESULT r = jd_prepare(&jd, jpegFileInput, pool, TJPGD_WORKSPACE_SIZE, &job);
+    if(r == JDR_OK) {
+        uint8_t shift = 0;
+        while(shift < 3 && (1 << shift) < scale) shift++;
+        r = jd_decomp(&jd, jpegFileOutput, shift);
+    }
+    arenaFree(ARENA_RENDER, pool);
+    job.file.close();
+    return r == JDR_OK;
+}
+
+// 核心0上的解码任务, 负责下半部分
+TaskHandle_t jpegWorker = NULL;
+SemaphoreHandle_t jpegWorkStart = NULL;
+SemaphoreHandle_t jpegWorkDone = NULL;
+JpegSlice* jpegWorkSlice = NULL;
+
+void jpegWorkerTask(void* param) {
+    for(;;) {
+        xSemaphoreTake(jpegWorkStart, portMAX_DELAY);
+        decodeJpegSlice(jpegWorkSlice);
+        xSemaphoreGive(jpegWorkDone);
+    }
+}
+
+// 按重启标记把图像分成上下两半, 分别在两个核心上解码
+DecodeResult drawJpgParallel(const uint8_t* data, size_t len, int16_t x, int16_t y, PixelSink sink) {
+    JpegInfo info;
+    size_t splitPos = 0;
+    uint16_t splitY = 0;
+    uint8_t rstShift = 0;
+    if(!parseJpegHeader(data, len, &info) ||
+       !findRestartSplit(data, len, info, &splitPos, &splitY, &rstShift)) {
+        return DECODE_SKIPPED;
+    }
+    
+    if(!jpegWorker) {
+        jpegWorkStart = xSemaphoreCreateBinary();
+        jpegWorkDone = xSemaphoreCreateBinary();
+        xTaskCreatePinnedToCore(jpegWorkerTask, "jpegWorker", 4096, NULL, 1, &jpegWorker, 0);
+    }
+    
+    JpegSlice top = {{data, info.scanStart, data + info.scanStart, len - info.scanStart,
+                      0, info.sofHeightPos, splitY, 0, false}, x, y, sink, JDR_OK};
+    JpegSlice bottom = {{data, info.scanStart, data + splitPos, len - splitPos,
+                         0, info.sofHeightPos, (uint16_t)(info.height - splitY), rstShift, false},
+                        x, (int16_t)(y + splitY), sink, JDR_OK};
+    
+    jpegWorkSlice = &bottom;
+    xSemaphoreGive(jpegWorkStart);
+    decodeJpegSlice(&top);
+    xSemaphoreTake(jpegWorkDone, portMAX_DELAY);
+    
+    if(top.result != JDR_OK || bottom.result != JDR_OK) {
+        LOG_WARN("并行解码错误: 上半%d 下半%d", top.result, bottom.result);
+        return DECODE_ERROR;
+    }
+    return DECODE_OK;
+}
+
+// 双核JPEG后端: 没有DRI时返回SKIPPED, 由下一个后端处理; 已知没有DRI时不再读文件头
+DecodeResult dualCoreJpegDraw(const ImageSource& src, int16_t x, int16_t y, uint8_t scale, PixelSink sink) {
+    if(!PARALLEL_JPEG_DECODE || !tftMutex || scale != 1 || src.restart == 0) return DECODE_SKIPPED;
+    if(src.type == IMAGE_SRC_MEMORY) {
+        return drawJpgParallel(src.data, src.size, x, y, sink);
+    }
+    
+    File file = PHOTO_FS.open(src.path, FILE_READ);
+    if(!file) return DECODE_ERROR;
+    size_t len = file.size();
+    
+    // 先只读文件头, 没有DRI时不必把整个文件读进内存
+    uint8_t head[1024];
+    size_t headLen = file.read(head, min(len, sizeof(head)));
+    JpegInfo info;
+    if(parseJpegHeader(head, headLen, &info) && info.restartInterval == 0) {
+        file.close();
+        return DECODE_SKIPPED;
+    }
+    if(!arenaAdmit(ARENA_CACHE, len)) {
+        file.close();
+        return DECODE_SKIPPED;
+    }
+    
+    // 整个文件读入内存, 两个片段共用同一份数据
+    uint8_t* data = (uint8_t*)arenaAlloc(ARENA_CACHE, len);
+    if(!data) {
+        file.close();
+        return DECODE_SKIPPED;
+    }
+    memcpy(data, head, headLen);
+    bool ok = file.read(data + headLen, len - headLen) == len - headLen;
+    file.close();
+    
+    DecodeResult result = ok ? drawJpgParallel(data, len, x, y, sink) : DECODE_ERROR;
+    arenaFree(ARENA_CACHE, data);
+    return result;
+}
+
+// TJpgDec后端
+DecodeResult tjpgdecDraw(const ImageSource& src, int16_t x, int16_t y, uint8_t scale, PixelSink sink) {
+    TJpgDec.setJpgScale(scale);
+    TJpgDec.setCallback(sink);
+    JRESULT r;
+    if(src.type == IMAGE_SRC_FILE) {
+        r = TJpgDec.drawFsJpg(x, y, src.path);
+    } else {
+        r = TJpgDec.drawJpg(x, y, src.data, src.size);
+    }
+    TJpgDec.setJpgScale(1);
+    return r == JDR_OK ? DECODE_OK : DECODE_ERROR;
+}
+
+#if IMAGE_BACKEND_JPEGDEC
+// JPEGDEC后端, 解码器对象较大(约17KB), 只在解码期间分配
+PixelSink jpegdecSink = NULL;
+File jpegdecFile;
+
+int jpegdecOutput(JPEGDRAW* draw) {
+    return jpegdecSink(draw->x, draw->y, draw->iWidth, draw->iHeight, draw->pPixels) ? 1 : 0;
+}
+
+void* jpegdecOpen(const char* filename, int32_t* size) {
+    jpegdecFile = PHOTO_FS.open(filename, FILE_READ);
+    if(!jpegdecFile) return NULL;
+    *size = jpegdecFile.size();
+    return &jpegdecFile;
+}
+
+void jpegdecClose(void* handle) {
+    if(handle) ((File*)handle)->close();
+}
+
+int32_t jpegdecRead(JPEGFILE* handle, uint8_t* buf, int32_t len) {
+    return ((File*)handle->fHandle)->read(buf, len);
+}
+
+int32_t jpegdecSeek(JPEGFILE* handle, int32_t position) {
+    return ((File*)handle->fHandle)->seek(position) ? position : -1;
+}
+
+DecodeResult jpegdecDraw(const ImageSource& src, int16_t x, int16_t y, uint8_t scale, PixelSink sink) {
+    JPEGDEC* jpeg = new (std::nothrow) JPEGDEC();
+    if(!jpeg) {
+        memoryState.heapFailures++;
+        return DECODE_SKIPPED;  // 内存不够时交给不需要大对象的TJpgDec
+    }
+    
+    int opened;
+    if(src.type == IMAGE_SRC_FILE) {
+        opened = jpeg->open(src.path, jpegdecOpen, jpegdecClose, jpegdecRead, jpegdecSeek, jpegdecOutput);
+    } else {
+        opened = jpeg->openRAM((uint8_t*)src.data, src.size, jpegdecOutput);
+    }
+    if(!opened) {
+        delete jpeg;
+        return DECODE_SKIPPED;  // 例如渐进式JPEG, 交给TJpgDec
+    }
+    
+    int options = 0;
+    if(scale == 2) options = JPEG_SCALE_HALF;
+    else if(scale == 4) options = JPEG_SCALE_QUARTER;
+    else if(scale == 8) options = JPEG_SCALE_EIGHTH;
+    
+    jpegdecSink = sink;
+    jpeg->setPixelType(RGB565_BIG_ENDIAN);
+    int ok = jpeg->decode(x, y, options);
+    jpeg->close();
+    delete jpeg;
+    return ok ? DECODE_OK : DECODE_ERROR;
+}
+#endif
+
+// GIF文件回调, 每次打开单独分配File, 后端和动画播放可以同时打开
+void* gifOpen(const char* filename, int32_t* size) {
+    File* file = new (std::nothrow) File(PHOTO_FS.open(filename, FILE_READ));
+    if(!file) {
+        memoryState.heapFailures++;
+        return NULL;
+    }
+    if(!*file) {
+        delete file;
+        return NULL;
+    }
+    *size = file->size();
+    return file;
+}
+
+void gifClose(void* handle) {
+    File* file = (File*)handle;
+    if(!file) return;
+    file->close();
+    delete file;
+}
+
+int32_t gifRead(GIFFILE* handle, uint8_t* buf, int32_t len) {
+    File* file = (File*)handle->fHandle;
+    if(len > handle->iSize - handle->iPos) len = handle->iSize - handle->iPos;
+    if(len <= 0) return 0;
+    int32_t n = file->read(buf, len);
+    handle->iPos = file->position();
+    return n;
+}
+
+int32_t gifSeek(GIFFILE* handle, int32_t position) {
+    File* file = (File*)handle->fHandle;
+    file->seek(position);
+    handle->iPos = file->position();
+    return handle->iPos;
+}
+
+// 画布居中到屏幕时的偏移
+int16_t gifOffset(int canvas, int screen) {
+    return canvas < screen ? (screen - canvas) / 2 : 0;
+}
+
+// GIF静态后端: 只解码第一帧, 透明像素按黑色输出, 用于缓存/过渡/重绘
+struct GifStill {
+    PixelSink sink;
+    int16_t x, y;
+    uint16_t line[SCREEN_WIDTH];
+};
+
+void gifStillLine(GIFDRAW* draw) {
+    GifStill* still = (GifStill*)draw->pUser;
+    int16_t y = still->y + draw->iY + draw->y;
+    int16_t x = still->x + draw->iX;
+    int w = min(draw->iWidth, SCREEN_WIDTH - x);
+    if(y >= SCREEN_HEIGHT || w <= 0) return;
+    for(int i = 0; i < w; i++) {
+        uint8_t c = draw->pPixels[i];
+        still->line[i] = (draw->ucHasTransparency && c == draw->ucTransparent) ? 0 : draw->pPalette[c];
+    }
+    still->sink(x, y, w, 1, still->line);
+}
+
+DecodeResult gifDraw(const ImageSource& src, int16_t x, int16_t y, uint8_t scale, PixelSink sink) {
+    AnimatedGIF* gif = new (std::nothrow) AnimatedGIF();
+    GifStill* still = new (std::nothrow) GifStill();
+    if(!gif || !still) {
+        // 还没有输出像素, 调用方按没有可用后端处理
+        delete gif;
+        delete still;
+        memoryState.heapFailures++;
+        return DECODE_SKIPPED;
+    }
+    gif->begin(GIF_PALETTE_RGB565_BE);
+    int opened;
+    if(src.type == IMAGE_SRC_FILE) {
+        opened = gif->open(src.path, gifOpen, gifClose, gifRead, gifSeek, gifStillLine);
+    } else {
+        opened = gif->open((uint8_t*)src.data, src.size, gifStillLine);
+    }
+    
+    int r = -1;
+    if(opened) {
+        still->sink = sink;
+        still->x = x + gifOffset(gif->getCanvasWidth(), SCREEN_WIDTH);
+        still->y = y + gifOffset(gif->getCanvasHeight(), SCREEN_HEIGHT);
+        int delayMs;
+        r = gif->playFrame(false, &delayMs, still);
+        gif->close();
+    }
+    delete gif;
+    delete still;
+    return r >= 0 ? DECODE_OK : DECODE_ERROR;
+}
+
+// 解码后端表: 同一格式有多个后端时按实测速度自动选择.
+// 速度按图像类别(是否带DRI, 是否缩小解码)分开统计, 例如双核后端只和其他后端比较带DRI的原尺寸JPEG
+#define DECODER_PROBE_RUNS 2    // 每个后端在每个类别中至少试用的次数
+#define DECODER_CLASSES 4       // 位0: 缩小解码, 位1: 带DRI
+struct DecoderStats {
+    uint32_t runs;              // 成功解码次数
+    uint64_t totalUs;           // 累计耗时
+    uint64_t totalBytes;        // 累计输入字节
+    
+    void add(unsigned long us, size_t bytes) {
+        runs++;
+        totalUs += us;
+        totalBytes += bytes;
+    }
+};
+
+struct ImageDecoder {
+    const char* name;
+    PhotoFormat format;
+    uint8_t sources;            // 支持的数据源(ImageSourceType位掩码)
+    DecodeResult (*draw)(const ImageSource& src, int16_t x, int16_t y, uint8_t scale, PixelSink sink);
+    DecoderStats stats[DECODER_CLASSES];
+    uint32_t errors;            // 出错后换下一个后端的次数
+};
+
+ImageDecoder decoders[] = {
+    {"dualcore", PHOTO_JPEG, IMAGE_SRC_FILE | IMAGE_SRC_MEMORY, dualCoreJpegDraw},
+#if IMAGE_BACKEND_JPEGDEC
+    {"jpegdec", PHOTO_JPEG, IMAGE_SRC_FILE | IMAGE_SRC_MEMORY, jpegdecDraw},
+#endif
+    {"tjpgdec", PHOTO_JPEG, IMAGE_SRC_FILE | IMAGE_SRC_MEMORY, tjpgdecDraw},
+    {"q565", PHOTO_Q565, IMAGE_SRC_FILE | IMAGE_SRC_MEMORY | IMAGE_SRC_STREAM, q565Draw},
+    {"raw", PHOTO_RAW, IMAGE_SRC_FILE | IMAGE_SRC_MEMORY | IMAGE_SRC_STREAM, rawDraw},
+    {"gif", PHOTO_GIF, IMAGE_SRC_FILE | IMAGE_SRC_MEMORY, gifDraw},
+};
+const int DECODER_COUNT = sizeof(decoders) / sizeof(decoders[0]);
+int forcedDecoder = -1;   // -1为自动选择, 否则固定使用该后端(不适用时仍会回退)
+
+int decoderClass(const ImageSource& src, uint8_t scale) {
+    return (scale > 1 ? 1 : 0) | (src.restart > 0 ? 2 : 0);
+}
+
+// 每KB输入的平均解码耗时(us), 未测量时为0
+uint32_t decoderCostPerKB(const DecoderStats& s) {
+    if(s.totalBytes == 0) return 0;
+    return (uint32_t)(s.totalUs * 1024 / s.totalBytes);
+}
+
+// 所有类别合计, 用于列表和编码建议
+DecoderStats decoderTotals(const ImageDecoder& d) {
+    DecoderStats total = {};
+    for(int c = 0; c < DECODER_CLASSES; c++) {
+        total.runs += d.stats[c].runs;
+        total.totalUs += d.stats[c].totalUs;
+        total.totalBytes += d.stats[c].totalBytes;
+    }
+    return total;
+}
+
+// 排序键: 强制指定最优先, 其次是在该类别还没试够次数的, 最后按该类别的实测速度
+uint32_t decoderRank(int i, int cls) {
+    if(i == forcedDecoder) return 0;
+    const DecoderStats& s = decoders[i].stats[cls];
+    if(s.runs < DECODER_PROBE_RUNS) return 1 + s.runs;
+    return DECODER_PROBE_RUNS + 1 + decoderCostPerKB(s);
+}
+
+// 选择后端解码图像, 依次尝试直到有后端成功; 出错(可能已输出部分像素)时也换下一个后端覆盖重画
+DecodeResult drawImage(PhotoFormat format, const ImageSource& src, int16_t x, int16_t y,
+                       uint8_t scale, PixelSink sink) {
+    int cls = decoderClass(src, scale);
+    int order[DECODER_COUNT];
+    int count = 0;
+    for(int i = 0; i < DECODER_COUNT; i++) {
+        if(decoders[i].format != format || !(decoders[i].sources & src.type)) continue;
+        // 插入排序, 后端数量很少
+        int j = count++;
+        while(j > 0 && decoderRank(order[j - 1], cls) > decoderRank(i, cls)) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    
+    DecodeResult result = DECODE_SKIPPED;
+    for(int k = 0; k < count; k++) {
+        ImageDecoder& d = decoders[order[k]];
+        unsigned long start = micros();
+        DecodeResult r = d.draw(src, x, y, scale, sink);
+        if(r == DECODE_SKIPPED) continue;
+        
+        lastDecodeTime = micros() - start;
+        lastDecoderName = d.name;
+        result = r;
+        if(r == DECODE_OK) {
+            if(src.size > 0) d.stats[cls].add(lastDecodeTime, src.size);
+            break;
+        }
+        // 流只能读一遍, 出错后无法交给下一个后端
+        d.errors++;
+        LOG_WARN("解码后端 %s 出错, 换下一个", d.name);
+        if(src.type == IMAGE_SRC_STREAM) break;
+    }
+    return result;
+}
+
+// 照片库: 每张上传的照片保存为/photos/<编号>.<扩展名>, 按上传顺序排列
+#define PHOTO_DIR "/photos"
+#define MAX_STORED_PHOTOS 100
+#define STORE_FREE_MARGIN (300 * 1024)   // 上传前至少保留的空闲空间
+
+// 上传参数; 分块上传的目录、块大小和写入者上限见lib/upload_sessions
+#define UPLOAD_RAM_BUFFER (48 * 1024)         // 单文件上传在内存中缓存的上限
+#define UPLOAD_MAX_SESSIONS MAX_CONNECTIONS   // 每个客户端一个分块上传会话
+
+struct StoredPhoto {
+    uint16_t id;
+    PhotoFormat format;
+    uint32_t size;
+    uint8_t hash[32];       // 文件内容的SHA-256, 全0表示未知(例如被增量更新修改过)
+    uint8_t scale;          // 显示时的缩小倍数, 高分辨率照片(平移缩放用)为2
+    uint8_t flags;          // PHOTO_FLAG_*, 不保存, 启动时重新得到
+};
+
+#define PHOTO_FLAG_DRI_KNOWN 0x01   // 已读过JPEG文件头
+#define PHOTO_FLAG_DRI       0x02   // JPEG带DRI重启间隔, 可以双核解码
+#define PHOTO_FLAG_THUMB_FAILED 0x04    // 无法生成缩略图, 内容改变前不再重试
+
+StoredPhoto photoStore[MAX_STORED_PHOTOS];
+int photoCount = 0;
+int currentPhoto = -1;       // 当前显示的照片在photoStore中的下标, -1为待机动画
+uint16_t nextPhotoId = 0;
+
+bool hasPhoto() {
+    return currentPhoto >= 0;
+}
+
+const char* photoExtension(PhotoFormat format) {
+    switch(format) {
+        case PHOTO_Q565: return "q565";
+        case PHOTO_RAW: return "raw";
+        case PHOTO_GIF: return "gif";
+        default: return "jpg";
+    }
+}
+
+String storedPhotoPath(uint16_t id, PhotoFormat format) {
+    return String(PHOTO_DIR) + "/" + String(id) + "." + photoExtension(format);
+}
+
+// 读一次文件头: 按图像宽度得到缩小到屏幕的倍数(2的幂, 解码器直接支持), JPEG同时记下有没有DRI
+void photoProbeHeader(StoredPhoto& photo) {
+    uint16_t width = 0;
+    photo.scale = 1;
+    File f = PHOTO_FS.open(storedPhotoPath(photo.id, photo.format), FILE_READ);
+    if(!f) return;
+    if(photo.format == PHOTO_JPEG) {
+        uint8_t head[1024];
+        size_t n = f.read(head, sizeof(head));
+        JpegInfo info;
+        if(parseJpegHeader(head, n, &info)) {
+            width = info.width;
+            photo.flags |= PHOTO_FLAG_DRI_KNOWN;
+            if(info.restartInterval > 0) photo.flags |= PHOTO_FLAG_DRI;
+        }
+    } else if(photo.format == PHOTO_Q565) {
+        uint8_t head[Q565_HEADER_SIZE];
+        if(f.read(head, sizeof(head)) == sizeof(head)) width = head[4] | (head[5] << 8);
+    }
+    f.close();
+    while(photo.scale < 8 && width >= SCREEN_WIDTH * photo.scale * 2) photo.scale *= 2;
+}
+
+// 照片文件作为解码数据源, 带上缓存的DRI信息, 后端选择不用再读文件头
+ImageSource photoSource(const StoredPhoto& photo, const String& path) {
+    ImageSource src = fileSource(path.c_str(), photo.size);
+    if(photo.flags & PHOTO_FLAG_DRI_KNOWN) src.restart = (photo.flags & PHOTO_FLAG_DRI) ? 1 : 0;
+    return src;
+}
+
+// 根据上传的文件名或类型判断格式, 默认为JPEG
+PhotoFormat photoFormatFromUpload(const String& filename, const String& type) {
+    if(filename.endsWith(".q565") || type == "image/x-q565") return PHOTO_Q565;
+    if(filename.endsWith(".raw") || type == "image/x-r565") return PHOTO_RAW;
+    if(filename.endsWith(".gif") || type == "image/gif") return PHOTO_GIF;
+    return PHOTO_JPEG;
+}
+
+// 内容寻址: 每张照片记录文件内容的SHA-256, 重复上传时直接显示已有的照片
+// 哈希保存在独立的索引文件中, 每条记录为 编号(u16) + 哈希(32字节)
+#define PHOTO_HASH_FILE "/photo_hashes.bin"
+
+struct DedupStats {
+    uint32_t hits;              // 命中已有照片的上传次数
+    uint64_t bytesAvoided;      // 因此没有写入闪存的字节数
+    uint32_t cacheReused;       // 命中时已有解码缓存, 省去重新解码
+} dedupStats;
+
+// mbedTLS 3.x去掉了_ret后缀
+struct Sha256 {
+    mbedtls_sha256_context ctx;
+
+    void begin() {
+        mbedtls_sha256_init(&ctx);
+#if MBEDTLS_VERSION_MAJOR >= 3
+        mbedtls_sha256_starts(&ctx, 0);
+#else
+        mbedtls_sha256_starts_ret(&ctx, 0);
+#endif
+    }
+
+    void update(const uint8_t* data, size_t len) {
+#if MBEDTLS_VERSION_MAJOR >= 3
+        mbedtls_sha256_update(&ctx, data, len);
+#else
+        mbedtls_sha256_update_ret(&ctx, data, len);
+#endif
+    }
+
+    void end(uint8_t* out) {
+#if MBEDTLS_VERSION_MAJOR >= 3
+        mbedtls_sha256_finish(&ctx, out);
+#else
+        mbedtls_sha256_finish_ret(&ctx, out);
+#endif
+        mbedtls_sha256_free(&ctx);
+    }
+};
+
+bool hashKnown(const uint8_t* hash) {
+    for(int i = 0; i < 32; i++) {
+        if(hash[i]) return true;
+    }
+    return false;
+}
+
+bool hashFile(const String& path, uint8_t* out) {
+    File f = PHOTO_FS.open(path, FILE_READ);
+    if(!f) return false;
+    uint8_t buf[512];
+    Sha256 sha;
+    sha.begin();
+    size_t n;
+    while((n = f.read(buf, sizeof(buf))) > 0) sha.update(buf, n);
+    sha.end(out);
+    f.close();
+    return true;
+}
+
+int findPhotoById(int32_t id) {
+    for(int i = 0; i < photoCount; i++) {
+        if(photoStore[i].id == id) return i;
+    }
+    return -1;
+}
+
+int findPhotoByHash(const uint8_t* hash) {
+    if(!hashKnown(hash)) return -1;
+    for(int i = 0; i < photoCount; i++) {
+        if(memcmp(photoStore[i].hash, hash, 32) == 0) return i;
+    }
+    return -1;
+}
+
+// 照片增删后重写整个索引(100张约3KB)
+void savePhotoHashes() {
+    File f = PHOTO_FS.open(PHOTO_HASH_FILE, FILE_WRITE);
+    if(!f) return;
+    for(int i = 0; i < photoCount; i++) {
+        if(!hashKnown(photoStore[i].hash)) continue;
+        f.write((const uint8_t*)&photoStore[i].id, sizeof(uint16_t));
+        f.write(photoStore[i].hash, 32);
+    }
+    f.close();
+}
+
+// 启动时读取索引; 没有记录的照片(旧版本上传的)补算一次
+void loadPhotoHashes() {
+    File f = PHOTO_FS.open(PHOTO_HASH_FILE, FILE_READ);
+    if(f) {
+        uint16_t id;
+        uint8_t hash[32];
+        while(f.read((uint8_t*)&id, sizeof(id)) == sizeof(id) && f.read(hash, 32) == 32) {
+            for(int i = 0; i < photoCount; i++) {
+                if(photoStore[i].id == id) memcpy(photoStore[i].hash, hash, 32);
+            }
+        }
+        f.close();
+    }
+
+    bool changed = false;
+    for(int i = 0; i < photoCount; i++) {
+        if(hashKnown(photoStore[i].hash)) continue;
+        changed |= hashFile(storedPhotoPath(photoStore[i].id, photoStore[i].format), photoStore[i].hash);
+    }
+    if(changed) savePhotoHashes();
+}
+
+// 删除旧版本固件留下的单张照片文件
+void removeLegacyPhotoFiles() {
+    const char* legacy[] = {"/photo.jpg", "/photo.q565", "/photo.raw"};
+    for(int i = 0; i < 3; i++) {
+        if(PHOTO_FS.exists(legacy[i])) PHOTO_FS.remove(legacy[i]);
+    }
+}
+
+// 解码缓存: 最近用到的照片解码成全屏R565文件, 切换和重绘时直接推送
+#define FRAME_CACHE_DIR "/cache"
+#define FRAME_CACHE_SLOTS 3
+#define FRAME_BAND_ROWS 16
+#define FRAME_BYTES (Q565_HEADER_SIZE + SCREEN_WIDTH * SCREEN_HEIGHT * 2)
+
+struct FrameCacheSlot {
+    int32_t photoId;        // -1为空
+    bool valid;             // 文件已完整写入
+    bool pending;           // 已排队等待后台解码
+    unsigned long lastUsed;
+};
+
+FrameCacheSlot frameCache[FRAME_CACHE_SLOTS] = {{-1, false, false, 0}, {-1, false, false, 0}, {-1, false, false, 0}};
+
+String frameCachePath(uint16_t id) {
+    return String(FRAME_CACHE_DIR) + "/" + String(id) + ".raw";
+}
+
+int frameCacheFind(uint16_t id) {
+    for(int i = 0; i < FRAME_CACHE_SLOTS; i++) {
+        if(frameCache[i].valid && frameCache[i].photoId == id) return i;
+    }
+    return -1;
+}
+
+bool frameCachePending(uint16_t id) {
+    for(int i = 0; i < FRAME_CACHE_SLOTS; i++) {
+        if(frameCache[i].pending && frameCache[i].photoId == id) return true;
+    }
+    return false;
+}
+
+// 为照片预留一个缓存槽(淘汰最久未用的), 正在后台写入的槽不会被淘汰
+int frameCacheReserve(uint16_t id) {
+    int slot = -1;
+    for(int i = 0; i < FRAME_CACHE_SLOTS; i++) {
+        if(frameCache[i].pending) continue;
+        if(slot < 0 || frameCache[i].photoId < 0 ||
+           (frameCache[slot].photoId >= 0 && frameCache[i].lastUsed < frameCache[slot].lastUsed)) {
+            slot = i;
+        }
+    }
+    if(slot < 0) return -1;
+    if(frameCache[slot].photoId >= 0) {
+        PHOTO_FS.remove(frameCachePath(frameCache[slot].photoId));
+    }
+    frameCache[slot].photoId = id;
+    frameCache[slot].valid = false;
+    frameCache[slot].pending = true;
+    frameCache[slot].lastUsed = millis();
+    return slot;
+}
+
+// 内存层级: 检测到PSRAM时已解码的照片以整帧(未做色彩变换)保留在PSRAM中,
+// 动态变形和过渡按整帧处理, 经两个内部内存的条带轮流用DMA推送(ESP32的SPI DMA
+// 不能直接读PSRAM); 没有PSRAM时保持原来的条带流式处理
+#define PSRAM_FRAME_SLOTS 4       // PSRAM中保留的已解码照片数
+#define DMA_STRIP_ROWS 16
+#define FRAME_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+enum MemoryTier {
+    TIER_STREAMING,     // 没有PSRAM: 逐块解码直接推送
+    TIER_PSRAM          // 整帧缓冲
+};
+
+struct RamFrame {
+    int32_t photoId;            // -1为空
+    uint16_t* pixels;
+    unsigned long lastUsed;
+};
+
+struct FrameTier {
+    MemoryTier tier;
+    RamFrame slots[PSRAM_FRAME_SLOTS];
+    uint16_t* work;             // 变形输出
+    uint16_t* dma[2];           // DMA条带, 推送一条的同时准备下一条
+    uint16_t* target;           // frameSink的输出帧
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t decodeUs;          // 最近一次解码到整帧的耗时
+    uint32_t warpUs;            // 最近一次整帧变形的耗时
+    uint32_t pushUs;            // 最近一次整帧推送的耗时
+} frameTier;
+
+// 启动时检测, 整帧缓冲和DMA条带都分配成功才切换到整帧模式
+void frameTierBegin() {
+    frameTier.tier = TIER_STREAMING;
+    for(int i = 0; i < PSRAM_FRAME_SLOTS; i++) frameTier.slots[i] = {-1, NULL, 0};
+    if(!psramFound()) return;
+    
+    bool ok = true;
+    const size_t frameBytes = FRAME_PIXELS * sizeof(uint16_t);
+    for(int i = 0; i < PSRAM_FRAME_SLOTS && ok; i++) {
+        frameTier.slots[i].pixels = (uint16_t*)heap_caps_malloc(frameBytes, MALLOC_CAP_SPIRAM);
+        ok = frameTier.slots[i].pixels != NULL;
+    }
+    frameTier.work = ok ? (uint16_t*)heap_caps_malloc(frameBytes, MALLOC_CAP_SPIRAM) : NULL;
+    const size_t stripBytes = SCREEN_WIDTH * DMA_STRIP_ROWS * sizeof(uint16_t);
+    for(int i = 0; i < 2 && ok; i++) {
+        frameTier.dma[i] = (uint16_t*)heap_caps_malloc(stripBytes, MALLOC_CAP_DMA);
+        ok = frameTier.dma[i] != NULL;
+    }
+    if(!ok || !frameTier.work || !tft.initDMA()) {
+        for(int i = 0; i < PSRAM_FRAME_SLOTS; i++) {
+            heap_caps_free(frameTier.slots[i].pixels);
+            frameTier.slots[i].pixels = NULL;
+        }
+        heap_caps_free(frameTier.work);
+        heap_caps_free(frameTier.dma[0]);
+        heap_caps_free(frameTier.dma[1]);
+        frameTier.work = frameTier.dma[0] = frameTier.dma[1] = NULL;
+        LOG_WARN("PSRAM整帧缓冲分配失败, 使用流式处理");
+        return;
+    }
+    frameTier.tier = TIER_PSRAM;
+    LOG_INFO("PSRAM %u 字节, 整帧缓冲 %d 帧", (unsigned)ESP.getPsramSize(), PSRAM_FRAME_SLOTS + 1);
+}
+
+// 解码输出写入整帧
+bool frameSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    if(x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) return true;
+    uint16_t cw = min((int)w, SCREEN_WIDTH - x);
+    uint16_t ch = min((int)h, SCREEN_HEIGHT - y);
+    for(uint16_t r = 0; r < ch; r++) {
+        memcpy(frameTier.target + (y + r) * SCREEN_WIDTH + x, bitmap + r * w, cw * sizeof(uint16_t));
+    }
+    return true;
+}
+
+void ramFrameInvalidate(int32_t photoId) {
+    for(int i = 0; i < PSRAM_FRAME_SLOTS; i++) {
+        if(frameTier.slots[i].photoId == photoId) frameTier.slots[i].photoId = -1;
+    }
+}
+
+// 删除目录下的所有文件; 先收集文件名再删除, 避免边遍历边修改目录
+void removeDirectory(const char* path) {
+    const int BATCH = 8;
+    int found;
+    do {
+        String names[BATCH];
+        found = 0;
+        File dir = PHOTO_FS.open(path);
+        if(!dir) break;
+        File f = dir.openNextFile();
+        while(f && found < BATCH) {
+            String name = f.name();
+            names[found++] = name.startsWith("/") ? name : String(path) + "/" + name;
+            f.close();
+            f = dir.openNextFile();
+        }
+        dir.close();
+        for(int i = 0; i < found; i++) {
+            PHOTO_FS.remove(names[i]);
+        }
+    } while(found > 0);
+}
+
+// 清空缓存目录, 启动时调用
+void clearFrameCache() {
+    removeDirectory(FRAME_CACHE_DIR);
+    for(int i = 0; i < FRAME_CACHE_SLOTS; i++) {
+        frameCache[i] = {-1, false, false, 0};
+    }
+}
+
+// 存储挂载、迁移和测速
+#define STORAGE_MIGRATE_RAM (96 * 1024)   // 迁移时能暂存在内存中的照片总量
+#define BENCH_DIR "/bench"
+#define BENCH_FILL_FILE (64 * 1024)
+#define BENCH_SEQ_BYTES (128 * 1024)
+#define BENCH_OPENS 32
+
+struct StorageBench {
+    uint8_t fillPercent;        // 实际占用率
+    uint32_t mountUs;
+    uint32_t openUs;            // 打开已有文件的平均耗时
+    uint32_t missUs;            // exists()查找不存在文件的平均耗时
+    uint32_t writeKBps;
+    uint32_t readKBps;
+};
+
+struct StorageStats {
+    uint32_t mountUs;
+    bool formatted;             // 挂载失败后格式化过
+    uint16_t migrated;          // 从SPIFFS迁移过来的文件数
+    uint16_t dropped;           // 内存放不下而丢弃的照片数
+    StorageBench bench[3];
+    uint8_t benchCount;
+} storageStats;
+
+// LittleFS的目录是真实存在的, 写文件前父目录必须已经建立; SPIFFS只有路径前缀
+void ensureStorageDirs() {
+#if STORAGE_LITTLEFS
+    const char* dirs[] = {PHOTO_DIR, FRAME_CACHE_DIR, UPLOAD_DIR};
+    for(int i = 0; i < 3; i++) {
+        if(!PHOTO_FS.exists(dirs[i])) PHOTO_FS.mkdir(dirs[i]);
+    }
+#endif
+}
+
+#if STORAGE_LITTLEFS
+struct MigratedFile {
+    String path;
+    uint8_t* data;
+    size_t size;
+};
+
+// 分区上还是旧固件的SPIFFS: 设置和最新的照片先读进内存, 格式化成LittleFS后写回.
+// 同一分区无法两种格式并存, 内存放不下的旧照片只能丢弃
+bool migrateFromSpiffs() {
+    if(!SPIFFS.begin(false)) return false;
+
+    MigratedFile files[MAX_STORED_PHOTOS + 1];
+    int count = 0;
+    size_t budget = STORAGE_MIGRATE_RAM;
+    auto take = [&](const String& path, size_t size) {
+        File f = SPIFFS.open(path, FILE_READ);
+        uint8_t* data = f && size <= budget ? (uint8_t*)malloc(size) : NULL;
+        if(data && f.read(data, size) == size) {
+            files[count++] = {path, data, size};
+            budget -= size;
+        } else {
+            free(data);
+            storageStats.dropped++;
+        }
+        f.close();
+    };
+
+    if(SPIFFS.exists(DISPLAY_MODE_FILE)) take(DISPLAY_MODE_FILE, 1);
+
+    // 照片按编号从新到旧
+    uint16_t ids[MAX_STORED_PHOTOS];
+    String names[MAX_STORED_PHOTOS];
+    uint32_t sizes[MAX_STORED_PHOTOS];
+    int found = 0;
+    File dir = SPIFFS.open(PHOTO_DIR);
+    File f = dir ? dir.openNextFile() : File();
+    while(f && found < MAX_STORED_PHOTOS) {
+        String name = f.name();
+        name = name.substring(name.lastIndexOf('/') + 1);
+        int j = found++;
+        while(j > 0 && ids[j - 1] < (uint16_t)name.toInt()) {
+            ids[j] = ids[j - 1];
+            names[j] = names[j - 1];
+            sizes[j] = sizes[j - 1];
+            j--;
+        }
+        ids[j] = name.toInt();
+        names[j] = String(PHOTO_DIR) + "/" + name;
+        sizes[j] = f.size();
+        f.close();
+        f = dir.openNextFile();
+    }
+    if(dir) dir.close();
+    for(int i = 0; i < found; i++) take(names[i], sizes[i]);
+    SPIFFS.end();
+
+    if(!LittleFS.begin(true)) return false;
+    storageStats.formatted = true;
+    ensureStorageDirs();
+    for(int i = 0; i < count; i++) {
+        File out = LittleFS.open(files[i].path, FILE_WRITE);
+        if(out && out.write(files[i].data, files[i].size) == files[i].size) storageStats.migrated++;
+        out.close();
+        free(files[i].data);
+    }
+    LOG_INFO("SPIFFS迁移到LittleFS: 保留 %u 个文件, 丢弃 %u 张照片",
+             storageStats.migrated, storageStats.dropped);
+    return true;
+}
+#endif
+
+bool mountStorage() {
+    unsigned long start = micros();
+#if STORAGE_LITTLEFS
+    bool ok = LittleFS.begin(false) || migrateFromSpiffs();
+    if(!ok) {
+        ok = LittleFS.begin(true);
+        storageStats.formatted = ok;
+    }
+#else
+    bool ok = SPIFFS.begin(true);
+#endif
+    storageStats.mountUs = micros() - start;
+    if(ok) ensureStorageDirs();
+    LOG_INFO("%s 挂载 %lu us, 已用 %u/%u 字节", PHOTO_FS_NAME, (unsigned long)storageStats.mountUs,
+             (unsigned)PHOTO_FS.usedBytes(), (unsigned)PHOTO_FS.totalBytes());
+    return ok;
+}
+
+#if STORAGE_BENCH
+// 先用填充文件把分区写到目标占用率, 再测重新挂载、打开和顺序读写; 结束后删除填充文件
+void storageBenchmark() {
+    const uint8_t targets[3] = {10, 50, 90};
+    uint8_t* buf = (uint8_t*)malloc(4096);
+    if(!buf) return;
+    for(int i = 0; i < 4096; i++) buf[i] = i * 7;
+#if STORAGE_LITTLEFS
+    PHOTO_FS.mkdir(BENCH_DIR);
+#endif
+    int fills = 0;
+    auto fillPath = [](int i) { return String(BENCH_DIR) + "/fill" + String(i); };
+    for(int t = 0; t < 3; t++) {
+        size_t total = PHOTO_FS.totalBytes();
+        while(PHOTO_FS.usedBytes() + BENCH_FILL_FILE < total * targets[t] / 100) {
+            File f = PHOTO_FS.open(fillPath(fills), FILE_WRITE);
+            size_t n = 0;
+            while(f && n < BENCH_FILL_FILE && f.write(buf, 4096) == 4096) n += 4096;
+            f.close();
+            fills++;
+            if(n < BENCH_FILL_FILE) break;
+        }
+
+        StorageBench& b = storageStats.bench[storageStats.benchCount++];
+        b.fillPercent = (uint64_t)PHOTO_FS.usedBytes() * 100 / total;
+
+        unsigned long start = micros();
+        PHOTO_FS.end();
+        PHOTO_FS.begin(false);
+        b.mountUs = micros() - start;
+
+        start = micros();
+        for(int i = 0; i < BENCH_OPENS; i++) {
+            File f = PHOTO_FS.open(fills ? fillPath(i % fills) : String(DISPLAY_MODE_FILE), FILE_READ);
+            f.close();
+        }
+        b.openUs = (micros() - start) / BENCH_OPENS;
+        start = micros();
+        for(int i = 0; i < BENCH_OPENS; i++) PHOTO_FS.exists(BENCH_DIR "/missing");
+        b.missUs = (micros() - start) / BENCH_OPENS;
+
+        String seq = String(BENCH_DIR) + "/seq";
+        File f = PHOTO_FS.open(seq, FILE_WRITE);
+        size_t n = 0;
+        start = micros();
+        while(f && n < BENCH_SEQ_BYTES && f.write(buf, 4096) == 4096) n += 4096;
+        f.close();
+        b.writeKBps = n ? (uint64_t)n * 1000000 / 1024 / max(1UL, micros() - start) : 0;
+        f = PHOTO_FS.open(seq, FILE_READ);
+        n = 0;
+        start = micros();
+        while(f && f.read(buf, 4096) == 4096) n += 4096;
+        f.close();
+        b.readKBps = n ? (uint64_t)n * 1000000 / 1024 / max(1UL, micros() - start) : 0;
+        PHOTO_FS.remove(seq);
+
+        LOG_INFO("%s 占用%u%%: 挂载 %u us, 打开 %u us, 查找不存在 %u us, 写 %u KB/s, 读 %u KB/s",
+                 PHOTO_FS_NAME, b.fillPercent, b.mountUs, b.openUs, b.missUs, b.writeKBps, b.readKBps);
+    }
+    for(int i = 0; i < fills; i++) PHOTO_FS.remove(fillPath(i));
+#if STORAGE_LITTLEFS
+    PHOTO_FS.rmdir(BENCH_DIR);
+#endif
+    free(buf);
+}
+#endif
+
+// 存储状态和测速结果: /storage
+void handleStorage() {
+    String json = "{\"backend\":\"" PHOTO_FS_NAME "\"";
+    json += ",\"totalBytes\":" + String(PHOTO_FS.totalBytes());
+    json += ",\"usedBytes\":" + String(PHOTO_FS.usedBytes());
+    json += ",\"mountUs\":" + String(storageStats.mountUs);
+    json += ",\"formatted\":" + String(storageStats.formatted ? "true" : "false");
+    json += ",\"migrated\":" + String(storageStats.migrated);
+    json += ",\"dropped\":" + String(storageStats.dropped);
+    json += ",\"bench\":[";
+    for(int i = 0; i < storageStats.benchCount; i++) {
+        const StorageBench& b = storageStats.bench[i];
+        if(i) json += ",";
+        json += "{\"fillPercent\":" + String(b.fillPercent);
+        json += ",\"mountUs\":" + String(b.mountUs);
+        json += ",\"openUs\":" + String(b.openUs);
+        json += ",\"missUs\":" + String(b.missUs);
+        json += ",\"writeKBps\":" + String(b.writeKBps);
+        json += ",\"readKBps\":" + String(b.readKBps) + "}";
+    }
+    json += "]}";
+    server.send(200, "application/json", json);
+}
+
+// 扫描照片目录, 重建内存中的索引(按编号排序)
+void loadPhotoStore() {
+    photoCount = 0;
+    nextPhotoId = 0;
+    File dir = PHOTO_FS.open(PHOTO_DIR);
+    if(!dir) return;
+    
+    File f = dir.openNextFile();
+    while(f && photoCount < MAX_STORED_PHOTOS) {
+        String name = f.name();
+        name = name.substring(name.lastIndexOf('/') + 1);
+        int dot = name.indexOf('.');
+        if(dot > 0) {
+            StoredPhoto photo = {};     // 哈希由loadPhotoHashes补上
+            photo.id = name.substring(0, dot).toInt();
+            photo.format = photoFormatFromUpload(name, "");
+            photo.size = f.size();
+            photoProbeHeader(photo);
+
+            int j = photoCount++;
+            while(j > 0 && photoStore[j - 1].id > photo.id) {
+                photoStore[j] = photoStore[j - 1];
+                j--;
+            }
+            photoStore[j] = photo;
+            if(photo.id >= nextPhotoId) nextPhotoId = photo.id + 1;
+        }
+        f.close();
+        f = dir.openNextFile();
+    }
+    LOG_INFO("照片库: %d 张", photoCount);
+}
+
+// 后台预取: 核心0上的低优先级任务把照片解码进缓存, 不打扰前台显示和HTTP处理
+struct PrefetchJob {
+    uint16_t photoId;
+    PhotoFormat format;
+    int slot;
+    uint8_t scale;
+};
+
+QueueHandle_t prefetchQueue = NULL;
+TaskHandle_t prefetchTask = NULL;
+volatile int32_t prefetchActiveId = -1;   // 正在解码的照片, -1为空闲
+volatile bool prefetchCancel = false;
+unsigned long lastPrefetchTime = 0;       // 上次预取耗时(ms)
+
+// 缩略图: 每张照片一个60x80(屏幕的1/4)的R565缩略图, 全部打包在一个文件中, 每条记录为
+// 编号(u16) + 保留(u16) + 像素的CRC32(u32) + 像素; 删除照片时只清掉记录的编号, 槽位留给下一张
+#define THUMB_FILE "/thumbs.bin"
+#define THUMB_SCALE 4
+#define THUMB_WIDTH (SCREEN_WIDTH / THUMB_SCALE)
+#define THUMB_HEIGHT (SCREEN_HEIGHT / THUMB_SCALE)
+#define THUMB_PIXELS (THUMB_WIDTH * THUMB_HEIGHT)
+#define THUMB_HEADER_SIZE 8
+#define THUMB_RECORD_SIZE (THUMB_HEADER_SIZE + THUMB_PIXELS * 2)
+#define THUMB_FREE 0xFFFF
+#define THUMB_INTERVAL 500          // 两次生成至少间隔(ms), 不连续占用loop
+
+struct ThumbIndex {
+    int32_t ids[MAX_STORED_PHOTOS];     // 每个槽位的照片编号, -1为空
+    uint32_t crcs[MAX_STORED_PHOTOS];   // 像素的CRC32, 用作地址中的版本和ETag
+    uint16_t slots;                     // 文件中的槽位数
+    uint32_t fromFrame;                 // 由已解码的整帧缩小
+    uint32_t decoded;                   // 按1/4缩放重新解码
+    uint32_t generateUs;                // 累计生成耗时
+    uint32_t served;
+    uint32_t notModified;               // 浏览器缓存仍有效(304)
+    uint32_t servedBytes;
+    uint32_t serveUs;
+} thumbs;
+
+int thumbFind(int32_t id) {
+    for(int i = 0; i < thumbs.slots; i++) {
+        if(thumbs.ids[i] == id) return i;
+    }
+    return -1;
+}
+
+bool thumbFailed(const StoredPhoto& photo) {
+    return photo.flags & PHOTO_FLAG_THUMB_FAILED;
+}
+
+// 照片被删除或内容被修改时调用
+void thumbForget(uint16_t id) {
+    int index = findPhotoById(id);
+    if(index >= 0) photoStore[index].flags &= ~PHOTO_FLAG_THUMB_FAILED;
+    int slot = thumbFind(id);
+    if(slot < 0) return;
+    thumbs.ids[slot] = -1;
+    File f = PHOTO_FS.open(THUMB_FILE, "r+");
+    if(!f) return;
+    uint8_t cleared[2] = {THUMB_FREE & 0xFF, THUMB_FREE >> 8};
+    if(f.seek(slot * THUMB_RECORD_SIZE)) f.write(cleared, sizeof(cleared));
+    f.close();
+}
+
+// 启动时在loadPhotoStore之后读取, 照片已不存在的记录视为空槽
+void loadThumbIndex() {
+    for(int i = 0; i < MAX_STORED_PHOTOS; i++) thumbs.ids[i] = -1;
+    thumbs.slots = 0;
+    File f = PHOTO_FS.open(THUMB_FILE, FILE_READ);
+    if(!f) return;
+    uint16_t slots = min(f.size() / THUMB_RECORD_SIZE, (size_t)MAX_STORED_PHOTOS);
+    for(uint16_t i = 0; i < slots; i++) {
+        uint8_t header[THUMB_HEADER_SIZE];
+        if(!f.seek(i * THUMB_RECORD_SIZE) || f.read(header, THUMB_HEADER_SIZE) != THUMB_HEADER_SIZE) break;
+        thumbs.slots = i + 1;
+        uint16_t id = header[0] | (header[1] << 8);
+        if(id == THUMB_FREE || findPhotoById(id) < 0 || thumbFind(id) >= 0) continue;
+        thumbs.ids[i] = id;
+        thumbs.crcs[i] = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+    }
+    f.close();
+    LOG_INFO("缩略图: %d 个槽位", thumbs.slots);
+}
+
+// 写入第一个空槽, 没有时追加
+bool thumbStore(uint16_t id, const uint16_t* pixels) {
+    int slot = thumbFind(-1);
+    if(slot < 0) slot = thumbs.slots;
+    if(slot >= MAX_STORED_PHOTOS) return false;
+    
+    File f = PHOTO_FS.open(THUMB_FILE, PHOTO_FS.exists(THUMB_FILE) ? "r+" : FILE_WRITE);
+    if(!f) return false;
+    uint32_t crc = crc32_le(0, (const uint8_t*)pixels, THUMB_PIXELS * 2);
+    uint8_t header[THUMB_HEADER_SIZE] = {(uint8_t)(id & 0xFF), (uint8_t)(id >> 8), 0, 0,
+        (uint8_t)crc, (uint8_t)(crc >> 8), (uint8_t)(crc >> 16), (uint8_t)(crc >> 24)};
+    bool ok = f.seek(slot * THUMB_RECORD_SIZE) &&
+              f.write(header, THUMB_HEADER_SIZE) == THUMB_HEADER_SIZE &&
+              f.write((const uint8_t*)pixels, THUMB_PIXELS * 2) == THUMB_PIXELS * 2;
+    f.close();
+    if(!ok) return false;
+    thumbs.ids[slot] = id;
+    thumbs.crcs[slot] = crc;
+    if(slot >= thumbs.slots) thumbs.slots = slot + 1;
+    return true;
+}
+
+// 删除照片库中的一张照片
+void removeStoredPhoto(int index) {
+    StoredPhoto photo = photoStore[index];
+    if(prefetchActiveId == photo.id) prefetchCancel = true;
+    int slot = frameCacheFind(photo.id);
+    if(slot >= 0) {
+        PHOTO_FS.remove(frameCachePath(photo.id));
+        frameCache[slot] = {-1, false, false, 0};
+    }
+    ramFrameInvalidate(photo.id);
+    thumbForget(photo.id);
+    PHOTO_FS.remove(storedPhotoPath(photo.id, photo.format));
+    
+    for(int i = index; i < photoCount - 1; i++) {
+        photoStore[i] = photoStore[i + 1];
+    }
+    photoCount--;
+    if(currentPhoto == index) currentPhoto = -1;
+    else if(currentPhoto > index) currentPhoto--;
+    savePhotoHashes();
+}
+
+// 淘汰最旧的照片(不淘汰当前显示的), 直到数量和空闲空间都足够
+void ensureStoreSpace(size_t bytes) {
+    while(photoCount > 0 &&
+          (photoCount >= MAX_STORED_PHOTOS ||
+           PHOTO_FS.totalBytes() - PHOTO_FS.usedBytes() < bytes + STORE_FREE_MARGIN)) {
+        int victim = (currentPhoto == 0 && photoCount > 1) ? 1 : 0;
+        if(victim == currentPhoto) break;
+        LOG_INFO("空间不足, 删除照片 %d", photoStore[victim].id);
+        removeStoredPhoto(victim);
+    }
+}
+
+int addStoredPhoto(uint16_t id, PhotoFormat format, uint32_t size, const uint8_t* hash) {
+    ensureStoreSpace(0);
+    photoStore[photoCount] = {id, format, size};
+    memcpy(photoStore[photoCount].hash, hash, 32);
+    photoProbeHeader(photoStore[photoCount]);
+    photoCount++;
+    savePhotoHashes();
+    return photoCount - 1;
+}
+
+// 把解码输出按条带拼成整行写入R565文件
+struct FrameWriter {
+    File file;
+    uint16_t* band;
+    int16_t bandY;          // 当前条带的起始行
+    int16_t rowsWritten;
+    bool background;        // 后台写入时每个条带让出CPU, 并响应取消
+    
+    bool begin(const String& path, bool inBackground) {
+        background = inBackground;
+        band = (uint16_t*)arenaAlloc(ARENA_RENDER, SCREEN_WIDTH * FRAME_BAND_ROWS * sizeof(uint16_t));
+        file = PHOTO_FS.open(path, FILE_WRITE);
+        if(!band || !file) return false;
+        uint8_t header[Q565_HEADER_SIZE] = {'R', '5', '6', '5',
+            SCREEN_WIDTH & 0xFF, SCREEN_WIDTH >> 8, SCREEN_HEIGHT & 0xFF, SCREEN_HEIGHT >> 8};
+        file.write(header, Q565_HEADER_SIZE);
+        memset(band, 0, SCREEN_WIDTH * FRAME_BAND_ROWS * sizeof(uint16_t));
+        bandY = 0;
+        rowsWritten = 0;
+        return true;
+    }
+    
+    // 写出当前条带, 然后让出CPU
+    bool flushBand() {
+        int16_t rows = min(FRAME_BAND_ROWS, SCREEN_HEIGHT - bandY);
+        size_t bytes = rows * SCREEN_WIDTH * sizeof(uint16_t);
+        if(file.write((uint8_t*)band, bytes) != bytes) return false;
+        rowsWritten = bandY + rows;
+        memset(band, 0, SCREEN_WIDTH * FRAME_BAND_ROWS * sizeof(uint16_t));
+        bandY += FRAME_BAND_ROWS;
+        
+        if(!background) return true;
+        vTaskDelay(1);
+        while((isUploading() || streamActive) && !prefetchCancel) vTaskDelay(pdMS_TO_TICKS(50));
+        return !prefetchCancel;
+    }
+    
+    bool add(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+        if(y >= SCREEN_HEIGHT || x >= SCREEN_WIDTH) return !background || !prefetchCancel;
+        while(y >= bandY + FRAME_BAND_ROWS) {
+            if(!flushBand()) return false;
+        }
+        uint16_t cw = min((int)w, SCREEN_WIDTH - x);
+        for(uint16_t r = 0; r < h; r++) {
+            int16_t row = y + r - bandY;
+            if(row < 0 || row >= FRAME_BAND_ROWS) continue;
+            memcpy(band + row * SCREEN_WIDTH + x, bitmap + r * w, cw * sizeof(uint16_t));
+        }
+        return !background || !prefetchCancel;
+    }
+    
+    bool end(bool ok) {
+        // 图像比屏幕小时用黑色补齐
+        while(ok && bandY < SCREEN_HEIGHT) {
+            ok = flushBand();
+        }
+        if(file) file.close();
+        arenaFree(ARENA_RENDER, band);
+        band = NULL;
+        return ok;
+    }
+};
+
+FrameWriter prefetchWriter;   // 预取任务使用
+FrameWriter cacheWriter;      // 前台同步解码使用
+
+bool prefetchSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    return prefetchWriter.add(x, y, w, h, bitmap);
+}
+
+bool cacheSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    return cacheWriter.add(x, y, w, h, bitmap);
+}
+
+// 把照片解码成全屏R565文件
+bool decodeToFrameFile(FrameWriter& writer, PixelSink sink, const StoredPhoto& photo,
+                       const String& dst, bool background) {
+    String src = storedPhotoPath(photo.id, photo.format);
+    bool ok = writer.begin(dst, background);
+    if(ok) {
+        if(photo.format == PHOTO_JPEG) {
+            ok = decodeJpegFile(src.c_str(), sink, photo.scale);
+        } else {
+            ok = q565Draw(fileSource(src.c_str(), 0), 0, 0, photo.scale, sink) == DECODE_OK;
+        }
+    }
+    return writer.end(ok);
+}
+
+void prefetchTaskLoop(void* param) {
+    PrefetchJob job;
+    for(;;) {
+        if(xQueueReceive(prefetchQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+        prefetchCancel = false;
+        prefetchActiveId = job.photoId;
+        unsigned long start = millis();
+        
+        StoredPhoto photo = {job.photoId, job.format, 0};
+        photo.scale = job.scale;
+        String dst = frameCachePath(job.photoId);
+        bool ok = decodeToFrameFile(prefetchWriter, prefetchSink, photo, dst, true) && !prefetchCancel;
+        
+        FrameCacheSlot& slot = frameCache[job.slot];
+        if(ok) {
+            slot.valid = true;
+            slot.lastUsed = millis();
+            lastPrefetchTime = millis() - start;
+            LOG_DEBUG("预取完成: 照片%d, %lu ms", job.photoId, lastPrefetchTime);
+        } else {
+            PHOTO_FS.remove(dst);
+            slot.photoId = -1;
+            slot.valid = false;
+        }
+        slot.pending = false;
+        prefetchActiveId = -1;
+    }
+}
+
+// 请求后台解码照片到缓存; RAW照片本身就是解码结果, 无需预取
+void requestPrefetch(int index) {
+    if(!prefetchQueue || index < 0 || index >= photoCount) return;
+    const StoredPhoto& photo = photoStore[index];
+    // GIF解码器占用内存较大, 不在后台和动画播放同时运行
+    if(photo.format == PHOTO_RAW || photo.format == PHOTO_GIF) return;
+    if(frameCacheFind(photo.id) >= 0 || frameCachePending(photo.id)) return;
+    
+    PrefetchJob job = {photo.id, photo.format, frameCacheReserve(photo.id), photo.scale};
+    if(job.slot < 0) return;
+    if(xQueueSend(prefetchQueue, &job, 0) != pdTRUE) {
+        frameCache[job.slot] = {-1, false, false, 0};
+    }
+}
+
+// 照片对应的全屏R565帧文件: RAW照片本身, 或已完成的解码缓存; 没有时返回空
+String frameSourcePath(int index) {
+    const StoredPhoto& photo = photoStore[index];
+    if(photo.format == PHOTO_RAW) {
+        return photo.size == FRAME_BYTES ? storedPhotoPath(photo.id, photo.format) : String();
+    }
+    return frameCacheFind(photo.id) >= 0 ? frameCachePath(photo.id) : String();
+}
+
+// 上传内容与已有照片相同: 记录统计并返回已有照片的下标
+int acceptDuplicate(int index, uint32_t bytes) {
+    dedupStats.hits++;
+    dedupStats.bytesAvoided += bytes;
+    if(frameSourcePath(index).length() > 0) dedupStats.cacheReused++;
+    LOG_DEBUG("重复上传, 使用已有照片 %d", photoStore[index].id);
+    return index;
+}
+
+// 在前台把照片解码进缓存(用于需要立即过渡的新上传照片)
+String decodeToFrameCache(int index) {
+    if(photoStore[index].format == PHOTO_GIF) return String();
+    String path = frameSourcePath(index);
+    if(path.length() > 0 || frameCachePending(photoStore[index].id)) return path;
+    
+    const StoredPhoto& photo = photoStore[index];
+    int slot = frameCacheReserve(photo.id);
+    if(slot < 0) return String();
+    path = frameCachePath(photo.id);
+    if(decodeToFrameFile(cacheWriter, cacheSink, photo, path, false)) {
+        frameCache[slot].valid = true;
+    } else {
+        PHOTO_FS.remove(path);
+        frameCache[slot].photoId = -1;
+        path = String();
+    }
+    frameCache[slot].pending = false;
+    return path;
+}
+
+// 过渡效果: 两个全屏R565源按条带混合后推送, 只需要两个条带缓冲
+enum TransitionType {
+    TRANSITION_NONE,
+    TRANSITION_CROSSFADE,    // 淡入淡出
+    TRANSITION_WIPE,         // 自上而下擦除
+    TRANSITION_SLIDE         // 新图从右侧推入
+};
+
+#define TRANSITION_FPS 20
+#define TRANSITION_STRIP_ROWS 16
+TransitionType transitionType = TRANSITION_CROSSFADE;
+unsigned long transitionDuration = 800;   // 过渡时长(ms)
+
+struct TransitionStats {
+    uint16_t frames;            // 上次过渡实际渲染的帧数
+    unsigned long elapsedMs;    // 上次过渡总耗时
+    uint32_t blendUs;           // 混合内核累计耗时
+    uint32_t blendPixels;       // 混合内核累计像素
+} transitionStats;
+
+// 全屏R565帧文件(或PSRAM中的整帧)的条带读取, 都没有时输出黑色
+struct FrameSource {
+    File file;
+    const uint16_t* frame = NULL;
+    
+    bool open(const String& path) {
+        if(path.length() > 0) file = PHOTO_FS.open(path, FILE_READ);
+        return file;
+    }
+    
+    bool openFrame(const uint16_t* pixels) {
+        frame = pixels;
+        return frame != NULL;
+    }
+    
+    void readRows(int16_t y, int16_t rows, uint16_t* buf) {
+        size_t bytes = rows * SCREEN_WIDTH * sizeof(uint16_t);
+        if(frame) {
+            memcpy(buf, frame + y * SCREEN_WIDTH, bytes);
+        } else if(!file || !file.seek(Q565_HEADER_SIZE + (size_t)y * SCREEN_WIDTH * sizeof(uint16_t)) ||
+           file.read((uint8_t*)buf, bytes) != bytes) {
+            memset(buf, 0, bytes);
+        }
+    }
+    
+    // 读取矩形区域, 每行单独定位
+    void readRect(int16_t x, int16_t y, int16_t w, int16_t rows, uint16_t* buf) {
+        size_t bytes = w * sizeof(uint16_t);
+        for(int16_t r = 0; r < rows; r++) {
+            size_t offset = (size_t)(y + r) * SCREEN_WIDTH + x;
+            uint16_t* row = buf + r * w;
+            if(frame) {
+                memcpy(row, frame + offset, bytes);
+            } else if(!file || !file.seek(Q565_HEADER_SIZE + offset * sizeof(uint16_t)) ||
+                      file.read((uint8_t*)row, bytes) != bytes) {
+                memset(row, 0, bytes);
+            }
+        }
+    }
+    
+    void close() {
+        if(file) file.close();
+    }
+};
+
+// 取照片的整帧, 没有时解码(优先读闪存中的解码缓存); GIF和失败时返回NULL
+uint16_t* ramFrameLoad(int index) {
+    if(frameTier.tier != TIER_PSRAM) return NULL;
+    const StoredPhoto& photo = photoStore[index];
+    if(photo.format == PHOTO_GIF) return NULL;
+    
+    int slot = 0;
+    for(int i = 0; i < PSRAM_FRAME_SLOTS; i++) {
+        if(frameTier.slots[i].photoId == photo.id) {
+            frameTier.slots[i].lastUsed = millis();
+            frameTier.hits++;
+            return frameTier.slots[i].pixels;
+        }
+        if(frameTier.slots[i].lastUsed < frameTier.slots[slot].lastUsed) slot = i;
+    }
+    
+    RamFrame& f = frameTier.slots[slot];
+    f.photoId = -1;
+    frameTier.target = f.pixels;
+    frameTier.misses++;
+    unsigned long start = micros();
+    String path = frameSourcePath(index);
+    DecodeResult r;
+    if(path.length() > 0) {
+        r = drawImage(PHOTO_RAW, fileSource(path.c_str(), FRAME_BYTES), 0, 0, 1, frameSink);
+    } else {
+        memset(f.pixels, 0, FRAME_PIXELS * sizeof(uint16_t));
+        path = storedPhotoPath(photo.id, photo.format);
+        r = drawImage(photo.format, photoSource(photo, path), 0, 0, photo.scale, frameSink);
+    }
+    frameTier.decodeUs = micros() - start;
+    if(r != DECODE_OK) return NULL;
+    f.photoId = photo.id;
+    f.lastUsed = millis();
+    return f.pixels;
+}
+
+// 整帧推送: 条带从PSRAM复制到DMA缓冲并做色彩变换, 上一条带的DMA传输同时进行
+void pushFrame(const uint16_t* frame) {
+    unsigned long start = micros();
+    tft.startWrite();
+    for(int16_t y = 0, n = 0; y < SCREEN_HEIGHT; y += DMA_STRIP_ROWS, n++) {
+        int16_t rows = min(DMA_STRIP_ROWS, SCREEN_HEIGHT - y);
+        uint16_t* strip = frameTier.dma[n & 1];
+        memcpy(strip, frame + y * SCREEN_WIDTH, rows * SCREEN_WIDTH * sizeof(uint16_t));
+        applyColorLut(strip, rows * SCREEN_WIDTH);
+        tft.pushImageDMA(0, y, SCREEN_WIDTH, rows, strip);   // 先等上一次传输结束
+    }
+    tft.dmaWait();
+    tft.endWrite();
+    frameTier.pushUs = micros() - start;
+}
+
+// 按显示模式输出整帧: 动态模式对整帧变形(网格覆盖整个画面, 而不是每个解码块)
+void presentFrame(const uint16_t* frame) {
+    if(currentDisplayMode == DYNAMIC_MODE && !memoryState.degraded && warpReady()) {
+        unsigned long start = micros();
+        warpImage(frame, frameTier.work, SCREEN_WIDTH, SCREEN_HEIGHT);
+        frameTier.warpUs = micros() - start;
+        frame = frameTier.work;
+    }
+    pushFrame(frame);
+}
+
+// 按固定帧率播放过渡, 每帧进度由实际时间决定, 慢的时候自动跳帧
+bool runTransition(FrameSource& from, FrameSource& to) {
+    const size_t stripPixels = SCREEN_WIDTH * TRANSITION_STRIP_ROWS;
+    uint16_t* a = (uint16_t*)arenaAlloc(ARENA_RENDER, stripPixels * sizeof(uint16_t));
+    uint16_t* b = (uint16_t*)arenaAlloc(ARENA_RENDER, stripPixels * sizeof(uint16_t));
+    if(!a || !b) {
+        arenaFree(ARENA_RENDER, a);
+        arenaFree(ARENA_RENDER, b);
+        return false;
+    }
+    
+    const unsigned long frameMs = 1000 / TRANSITION_FPS;
+    unsigned long start = millis();
+    int16_t wipeY = 0;
+    transitionStats.frames = 0;
+    
+    for(;;) {
+        unsigned long frameStart = millis();
+        unsigned long elapsed = frameStart - start;
+        if(elapsed >= transitionDuration) break;
+        
+        if(transitionType == TRANSITION_WIPE) {
+            // 只推送新露出的行
+            int16_t target = SCREEN_HEIGHT * elapsed / transitionDuration;
+            while(wipeY < target) {
+                int16_t rows = min(TRANSITION_STRIP_ROWS, target - wipeY);
+                to.readRows(wipeY, rows, b);
+                applyColorLut(b, rows * SCREEN_WIDTH);
+                tft.pushImage(0, wipeY, SCREEN_WIDTH, rows, b);
+                wipeY += rows;
+            }
+        } else {
+            uint8_t alpha = elapsed * 32 / transitionDuration;
+            int16_t offset = SCREEN_WIDTH * elapsed / transitionDuration;
+            for(int16_t y = 0; y < SCREEN_HEIGHT; y += TRANSITION_STRIP_ROWS) {
+                int16_t rows = min(TRANSITION_STRIP_ROWS, SCREEN_HEIGHT - y);
+                from.readRows(y, rows, a);
+                to.readRows(y, rows, b);
+                if(transitionType == TRANSITION_CROSSFADE) {
+                    unsigned long t0 = micros();
+                    pxBlend(a, b, rows * SCREEN_WIDTH, alpha);
+                    transitionStats.blendUs += micros() - t0;
+                    transitionStats.blendPixels += rows * SCREEN_WIDTH;
+                } else {
+                    for(int16_t r = 0; r < rows; r++) {
+                        uint16_t* row = a + r * SCREEN_WIDTH;
+                        memmove(row, row + offset, (SCREEN_WIDTH - offset) * sizeof(uint16_t));
+                        memcpy(row + SCREEN_WIDTH - offset, b + r * SCREEN_WIDTH, offset * sizeof(uint16_t));
+                    }
+                }
+                applyColorLut(a, rows * SCREEN_WIDTH);
+                tft.pushImage(0, y, SCREEN_WIDTH, rows, a);
+            }
+        }
+        
+        transitionStats.frames++;
+        timerWrite(watchDog, 0);
+        unsigned long spent = millis() - frameStart;
+        if(spent < frameMs) delay(frameMs - spent);
+    }
+    transitionStats.elapsedMs = millis() - start;
+    
+    arenaFree(ARENA_RENDER, a);
+    arenaFree(ARENA_RENDER, b);
+    LOG_DEBUG("过渡: %u 帧 / %lu ms", transitionStats.frames, transitionStats.elapsedMs);
+    return true;
+}
+
+// 过渡的来源是闪存中的帧文件
+bool runTransition(const String& fromPath, const String& toPath) {
+    if(transitionType == TRANSITION_NONE) return false;
+    
+    FrameSource from, to;
+    if(!to.open(toPath)) return false;
+    from.open(fromPath);
+    bool ok = runTransition(from, to);
+    from.close();
+    to.close();
+    return ok;
+}
+
+// 整帧模式: 两帧都在PSRAM中, 过渡期间不读闪存; from为NULL时从黑色开始
+bool runTransition(const uint16_t* fromFrame, const uint16_t* toFrame) {
+    if(transitionType == TRANSITION_NONE) return false;
+    
+    FrameSource from, to;
+    if(!to.openFrame(toFrame)) return false;
+    from.openFrame(fromFrame);
+    return runTransition(from, to);
+}
+
+// 缩略图生成: 在loop空闲时补做, 新照片优先. 照片已有解码好的整帧(PSRAM或闪存中的解码缓存,
+// 上传后显示或预取时产生)时直接按4x4取平均缩小; 否则用tjpgd的1/4 DCT缩放解码(高分辨率照片为1/8),
+// Q565按1/4抽取. GIF没有缩略图
+uint16_t* thumbTarget = NULL;       // thumbSink的输出
+
+bool thumbSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    if(x >= THUMB_WIDTH || y >= THUMB_HEIGHT) return true;
+    uint16_t cw = min((int)w, THUMB_WIDTH - x);
+    uint16_t ch = min((int)h, THUMB_HEIGHT - y);
+    for(uint16_t r = 0; r < ch; r++) {
+        memcpy(thumbTarget + (y + r) * THUMB_WIDTH + x, bitmap + r * w, cw * sizeof(uint16_t));
+    }
+    return true;
+}
+
+// 整帧缩小, 每个缩略图像素取4x4个像素的平均; rows为THUMB_SCALE行的缓冲
+void thumbDownsample(FrameSource& src, uint16_t* out, uint16_t* rows) {
+    for(int16_t ty = 0; ty < THUMB_HEIGHT; ty++) {
+        src.readRows(ty * THUMB_SCALE, THUMB_SCALE, rows);
+        for(int16_t tx = 0; tx < THUMB_WIDTH; tx++) {
+            uint16_t r = 0, g = 0, b = 0;
+            for(int dy = 0; dy < THUMB_SCALE; dy++) {
+                const uint16_t* p = rows + dy * SCREEN_WIDTH + tx * THUMB_SCALE;
+                for(int dx = 0; dx < THUMB_SCALE; dx++) {
+                    uint16_t c = (p[dx] >> 8) | (p[dx] << 8);
+                    r += c >> 11;
+                    g += (c >> 5) & 0x3F;
+                    b += c & 0x1F;
+                }
+            }
+            const int n = THUMB_SCALE * THUMB_SCALE;
+            uint16_t c = ((r / n) << 11) | ((g / n) << 5) | (b / n);
+            out[ty * THUMB_WIDTH + tx] = (c >> 8) | (c << 8);
+        }
+    }
+}
+
+bool thumbGenerate(int index, uint16_t* pixels, uint16_t* rows) {
+    const StoredPhoto& photo = photoStore[index];
+    const uint16_t* frame = NULL;
+    for(int i = 0; i < PSRAM_FRAME_SLOTS; i++) {
+        if(frameTier.slots[i].photoId == photo.id) frame = frameTier.slots[i].pixels;
+    }
+    
+    FrameSource src;
+    if(src.openFrame(frame) || src.open(frameSourcePath(index))) {
+        thumbDownsample(src, pixels, rows);
+        src.close();
+        thumbs.fromFrame++;
+        return true;
+    }
+    
+    memset(pixels, 0, THUMB_PIXELS * sizeof(uint16_t));
+    thumbTarget = pixels;
+    String path = storedPhotoPath(photo.id, photo.format);
+    uint8_t scale = photo.scale * THUMB_SCALE;
+    bool ok = false;
+    if(photo.format == PHOTO_JPEG && scale <= 8) {
+        ok = decodeJpegFile(path.c_str(), thumbSink, scale);
+    } else if(photo.format == PHOTO_Q565) {
+        ok = q565Draw(fileSource(path.c_str(), 0), 0, 0, scale, thumbSink) == DECODE_OK;
+    }
+    if(ok) thumbs.decoded++;
+    return ok;
+}
+
+// 在loop中调用, 每次最多生成一张
+void thumbTick() {
+    static unsigned long lastRun = 0;
+    if(millis() - lastRun < THUMB_INTERVAL || isUploading()) return;
+    lastRun = millis();
+    
+    int index = -1;
+    for(int i = photoCount - 1; i >= 0 && index < 0; i--) {
+        const StoredPhoto& photo = photoStore[i];
+        if(photo.format != PHOTO_GIF && thumbFind(photo.id) < 0 && !thumbFailed(photo)) index = i;
+    }
+    if(index < 0) return;
+    
+    uint16_t* pixels = (uint16_t*)arenaAlloc(ARENA_RENDER, THUMB_PIXELS * sizeof(uint16_t));
+    uint16_t* rows = (uint16_t*)arenaAlloc(ARENA_RENDER, SCREEN_WIDTH * THUMB_SCALE * sizeof(uint16_t));
+    if(pixels && rows) {
+        unsigned long start = micros();
+        uint16_t id = photoStore[index].id;
+        if(!thumbGenerate(index, pixels, rows) || !thumbStore(id, pixels)) {
+            LOG_WARN("照片%d无法生成缩略图", id);
+            photoStore[index].flags |= PHOTO_FLAG_THUMB_FAILED;
+        } else {
+            thumbs.generateUs += micros() - start;
+            LOG_DEBUG("缩略图: 照片%d, %lu us", id, micros() - start);
+        }
+    }
+    arenaFree(ARENA_RENDER, pixels);
+    arenaFree(ARENA_RENDER, rows);
+}
+
+// 叠加层: 照片上的时钟和说明文字. 字形第一次用到时用TFT_eSPI内置字体(User_Setup.h中
+// 启用的LOAD_FONT*)光栅化成1位掩码并缓存; 内容变化时只合成变化字符所在的矩形:
+// 背景取自当前照片的解码缓存(PSRAM整帧或闪存帧文件), 叠上字形后只推送这个矩形.
+// 整屏重绘后全部重新合成. 动态模式下背景是未变形的像素, 下一次重绘时恢复一致
+#ifdef LOAD_FONT7
+#define OVERLAY_CLOCK_FONT 7        // 7段数码字体, 只有数字和冒号
+#elif defined(LOAD_FONT4)
+#define OVERLAY_CLOCK_FONT 4
+#else
+#define OVERLAY_CLOCK_FONT 1
+#endif
+#ifdef LOAD_FONT4
+#define OVERLAY_CAPTION_FONT 4
+#elif defined(LOAD_FONT2)
+#define OVERLAY_CAPTION_FONT 2
+#else
+#define OVERLAY_CAPTION_FONT 1
+#endif
+#define OVERLAY_TEXT_MAX 32
+#define OVERLAY_MARGIN 6
+#define OVERLAY_BAND_ROWS 16
+#define OVERLAY_SHADOW_ALPHA 12     // 阴影处背景保留的比例(/32)
+#define GLYPH_CACHE_SLOTS 32
+#define GLYPH_MAX_BYTES 256         // Font 7的数字为32x48, 192字节
+
+struct Glyph {
+    uint8_t font;               // 0为空槽
+    char c;
+    uint8_t w, h;
+    unsigned long lastUsed;
+    uint8_t bits[GLYPH_MAX_BYTES];  // 按行, 每行(w+7)/8字节, 高位在左
+};
+
+struct GlyphCache {
+    Glyph slots[GLYPH_CACHE_SLOTS];
+    uint32_t hits;
+    uint32_t misses;
+} glyphCache;
+
+// 取字形, 没有时光栅化(淘汰最久未用的槽); 字体中没有或太大时返回NULL
+const Glyph* glyphGet(uint8_t font, char c) {
+    int slot = 0;
+    for(int i = 0; i < GLYPH_CACHE_SLOTS; i++) {
+        Glyph& g = glyphCache.slots[i];
+        if(g.font == font && g.c == c) {
+            g.lastUsed = millis();
+            glyphCache.hits++;
+            return &g;
+        }
+        if(g.font == 0 || (glyphCache.slots[slot].font != 0 && g.lastUsed < glyphCache.slots[slot].lastUsed)) slot = i;
+    }
+    glyphCache.misses++;
+    
+    char str[2] = {c, 0};
+    int16_t w = tft.textWidth(str, font);
+    int16_t h = tft.fontHeight(font);
+    if(w <= 0 || h <= 0 || w > 255 || h > 255 || (w + 7) / 8 * h > GLYPH_MAX_BYTES) return NULL;
+    
+    TFT_eSprite sprite(&tft);
+    sprite.setColorDepth(1);
+    if(!sprite.createSprite(w, h)) return NULL;
+    sprite.setTextColor(TFT_WHITE);
+    sprite.drawChar(c, 0, 0, font);
+    Glyph& g = glyphCache.slots[slot];
+    memset(g.bits, 0, sizeof(g.bits));
+    int stride = (w + 7) / 8;
+    for(int y = 0; y < h; y++) {
+        for(int x = 0; x < w; x++) {
+            if(sprite.readPixel(x, y)) g.bits[y * stride + x / 8] |= 0x80 >> (x & 7);
+        }
+    }
+    sprite.deleteSprite();
+    g.font = font;
+    g.c = c;
+    g.w = w;
+    g.h = h;
+    g.lastUsed = millis();
+    return &g;
+}
+
+struct OverlayText {
+    uint8_t font;
+    bool topRight;              // true为右上角, false为底部居中
+    char text[OVERLAY_TEXT_MAX + 1];        // 要显示的内容
+    char shown[OVERLAY_TEXT_MAX + 1];       // 屏幕上已合成的内容
+    int16_t shownX[OVERLAY_TEXT_MAX];       // 以及每个字符的位置
+};
+
+struct Overlay {
+    OverlayText clock;
+    OverlayText caption;
+    bool pending;               // 设置有变化, 由loop合成
+    uint32_t ticks;             // 时钟内容变化并推送的次数
+    uint32_t tickBytes;         // 时钟累计推送字节数
+    uint32_t lastTickBytes;
+    unsigned long lastTickUs;
+    uint32_t redraws;           // 随整屏重绘的合成次数
+    uint32_t opaque;            // 没有可读的背景, 文字画在黑底上的次数
+} overlay = {{OVERLAY_CLOCK_FONT, true}, {OVERLAY_CAPTION_FONT, false}};
+
+int16_t overlayTop(const OverlayText& t) {
+    return t.topRight ? OVERLAY_MARGIN : SCREEN_HEIGHT - OVERLAY_MARGIN - 1 - tft.fontHeight(t.font);
+}
+
+// 排出每个字符的位置, 放不下的字符截掉; 返回字符数
+int overlayLayout(OverlayText& t, int16_t* xs) {
+    int16_t width = 0;
+    int n = 0;
+    for(; t.text[n]; n++) {
+        const Glyph* g = glyphGet(t.font, t.text[n]);
+        int16_t w = g ? g->w : 0;
+        if(width + w > SCREEN_WIDTH - 2 * OVERLAY_MARGIN) break;
+        xs[n] = width;
+        width += w;
+    }
+    t.text[n] = 0;
+    int16_t x0 = t.topRight ? SCREEN_WIDTH - OVERLAY_MARGIN - 1 - width : (SCREEN_WIDTH - width) / 2;
+    for(int i = 0; i < n; i++) xs[i] += x0;
+    return n;
+}
+
+// 把字符串中所有字形的阴影或本体画进条带(条带左上角为bx, by)
+void overlayBlit(const OverlayText& t, const int16_t* xs, int n, int16_t bx, int16_t by, int16_t bw, int16_t rows,
+                 uint16_t* band, bool shadow) {
+    int16_t top = overlayTop(t) + (shadow ? 1 : 0);
+    for(int i = 0; i < n; i++) {
+        const Glyph* g = glyphGet(t.font, t.text[i]);
+        if(!g) continue;
+        int16_t gx = xs[i] + (shadow ? 1 : 0);
+        int stride = (g->w + 7) / 8;
+        for(int16_t r = max(0, by - top); r < g->h && top + r < by + rows; r++) {
+            uint16_t* row = band + (top + r - by) * bw;
+            for(int16_t c = max(0, bx - gx); c < g->w && gx + c < bx + bw; c++) {
+                if(!(g->bits[r * stride + c / 8] & (0x80 >> (c & 7)))) continue;
+                uint16_t* p = row + gx + c - bx;
+                if(shadow) {
+                    uint16_t v = blend565((*p >> 8) | (*p << 8), TFT_BLACK, OVERLAY_SHADOW_ALPHA);
+                    *p = (v >> 8) | (v << 8);
+                } else {
+                    *p = TFT_WHITE;
+                }
+            }
+        }
+    }
+}
+
+// 合成并推送有变化的字符所在的矩形, 返回推送的字节数.
+// 背景取自整帧或解码缓存, 都没有时同步解码一份; 仍然没有时画在黑底上, 不丢弃叠加内容
+uint32_t overlayCompose(OverlayText& t) {
+    int16_t xs[OVERLAY_TEXT_MAX];
+    int n = overlayLayout(t, xs);
+    int old = strlen(t.shown);
+    
+    // 内容或位置有变化的字符, 新旧位置都要重画(+1为阴影)
+    int16_t x0 = SCREEN_WIDTH, x1 = 0;
+    for(int i = 0; i < max(n, old); i++) {
+        if(i < n && i < old && t.text[i] == t.shown[i] && xs[i] == t.shownX[i]) continue;
+        if(i < old) {
+            const Glyph* g = glyphGet(t.font, t.shown[i]);
+            x0 = min(x0, t.shownX[i]);
+            x1 = max(x1, (int16_t)(t.shownX[i] + (g ? g->w : 0) + 1));
+        }
+        if(i < n) {
+            const Glyph* g = glyphGet(t.font, t.text[i]);
+            x0 = min(x0, xs[i]);
+            x1 = max(x1, (int16_t)(xs[i] + (g ? g->w : 0) + 1));
+        }
+    }
+    x1 = min(x1, (int16_t)SCREEN_WIDTH);
+    if(x0 >= x1) return 0;
+    
+    FrameSource bg;
+    bool ok = frameTier.tier == TIER_PSRAM ? bg.openFrame(ramFrameLoad(currentPhoto)) : bg.open(frameSourcePath(currentPhoto));
+    if(!ok && !bg.open(decodeToFrameCache(currentPhoto))) overlay.opaque++;   // readRect读不到时输出黑色
+    int16_t w = x1 - x0;
+    uint16_t* band = (uint16_t*)arenaAlloc(ARENA_RENDER, w * OVERLAY_BAND_ROWS * sizeof(uint16_t));
+    if(!band) {
+        bg.close();
+        return 0;           // 保留旧状态, 下次再试
+    }
+    
+    int16_t y0 = overlayTop(t), h = tft.fontHeight(t.font) + 1;
+    for(int16_t y = y0; y < y0 + h; y += OVERLAY_BAND_ROWS) {
+        int16_t rows = min(OVERLAY_BAND_ROWS, y0 + h - y);
+        bg.readRect(x0, y, w, rows, band);
+        overlayBlit(t, xs, n, x0, y, w, rows, band, true);
+        overlayBlit(t, xs, n, x0, y, w, rows, band, false);
+        applyColorLut(band, w * rows);
+        tft.pushImage(x0, y, w, rows, band);
+    }
+    arenaFree(ARENA_RENDER, band);
+    bg.close();
+    
+    memcpy(t.shown, t.text, n + 1);
+    memcpy(t.shownX, xs, n * sizeof(int16_t));
+    return (uint32_t)w * h * sizeof(uint16_t);
+}
+
+// 当前时间"HH:MM", 关闭或时间未设置(早于2020年)时为空
+void overlayClockText(char* out) {
+    out[0] = 0;
+    time_t now = time(NULL);
+    if(!overlaySettings.clock || now < 1577836800) return;
+    now += overlaySettings.tzMinutes * 60;
+    struct tm t;
+    gmtime_r(&now, &t);
+    snprintf(out, OVERLAY_TEXT_MAX + 1, "%02d:%02d", t.tm_hour, t.tm_min);
+}
+
+// 说明文字只支持ASCII(内置字体的字符集), 其他UTF-8字符显示为'?'
+void overlaySetCaption(const String& text) {
+    int n = 0;
+    for(size_t i = 0; i < text.length() && n < OVERLAY_TEXT_MAX; i++) {
+        uint8_t c = text[i];
+        if((c & 0xC0) == 0x80) continue;
+        overlay.caption.text[n++] = c >= 32 && c < 127 ? c : '?';
+    }
+    overlay.caption.text[n] = 0;
+}
+
+// 动态模式下照片被整体变形, 未变形的文字矩形会和周围错开, 因此不显示叠加层
+bool overlayVisible() {
+    return hasPhoto() && photoStore[currentPhoto].format != PHOTO_GIF && currentDisplayMode != DYNAMIC_MODE;
+}
+
+// 说明文字放进JSON字符串和单引号HTML属性时的转义(内容只有可打印ASCII)
+String jsonEscape(const char* s) {
+    String out;
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') out += '\\';
+        out += *s;
+    }
+    return out;
+}
+
+String htmlEscape(const char* s) {
+    String out;
+    for(; *s; s++) {
+        switch(*s) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            case '\'': out += "&#39;"; break;
+            default: out += *s; break;
+        }
+    }
+    return out;
+}
+
+// 整屏重绘后屏幕上已没有叠加内容, 全部重新合成
+void overlayRedraw() {
+    overlay.clock.shown[0] = 0;
+    overlay.caption.shown[0] = 0;
+    if(!overlayVisible()) return;
+    overlayClockText(overlay.clock.text);
+    if(overlayCompose(overlay.clock) + overlayCompose(overlay.caption) > 0) overlay.redraws++;
+}
+
+// 在loop中调用: 每秒检查一次时钟, 设置有变化时立即处理
+void overlayTick() {
+    static unsigned long lastCheck = 0;
+    if(millis() - lastCheck < 1000 && !overlay.pending) return;
+    lastCheck = millis();
+    overlay.pending = false;
+    if(!overlayVisible()) return;
+    
+    overlayClockText(overlay.clock.text);
+    unsigned long start = micros();
+    uint32_t bytes = overlayCompose(overlay.clock);
+    if(bytes > 0) {
+        overlay.ticks++;
+        overlay.tickBytes += bytes;
+        overlay.lastTickBytes = bytes;
+        overlay.lastTickUs = micros() - start;
+    }
+    overlayCompose(overlay.caption);
+}
+
+// 按格式绘制当前照片, 有解码缓存时直接推送; 返回是否命中缓存
+bool drawPhoto() {
+    if(!hasPhoto()) return false;
+    const StoredPhoto& photo = photoStore[currentPhoto];
+    int slot = frameCacheFind(photo.id);
+    bool cached = slot >= 0;
+    
+    if(frameTier.tier == TIER_PSRAM) {
+        uint32_t hits = frameTier.hits;
+        const uint16_t* frame = ramFrameLoad(currentPhoto);
+        if(frame) {
+            presentFrame(frame);
+            overlayRedraw();
+            return cached || frameTier.hits != hits;
+        }
+    }
+    
+    String path;
+    DecodeResult r;
+    if(cached) {
+        frameCache[slot].lastUsed = millis();
+        path = frameCachePath(photo.id);
+        r = drawImage(PHOTO_RAW, fileSource(path.c_str(), FRAME_BYTES), 0, 0, 1, tft_output);
+    } else {
+        path = storedPhotoPath(photo.id, photo.format);
+        r = drawImage(photo.format, photoSource(photo, path), 0, 0, photo.scale, tft_output);
+    }
+    LOG_DEBUG("解码耗时: %lu us (%s)%s", lastDecodeTime, lastDecoderName,
+              r == DECODE_OK ? "" : " 失败");
+    overlayRedraw();
+    return cached;
+}
+
+// GIF动画播放: 第一遍边解码边显示, 同时把每帧实际绘制的内容录成绘制指令(lib/anim_ops);
+// 录完整个循环后释放解码器, 之后的循环直接回放指令, 不再做LZW解码
+#define ANIM_RAM_CACHE_LIMIT (32 * 1024)  // 录制内容不超过该大小时留在内存, 否则写入闪存
+#define ANIM_MIN_DELAY 20                 // 更短的帧延时按浏览器习惯视为100ms
+#define ANIM_MAX_LAG 250                  // 落后超过该时间时重新对齐, 不再追帧
+
+struct AnimationCache {
+    uint8_t* ram;
+    size_t len;
+    File file;              // 超出内存上限后转存的文件
+    bool complete;          // 已录完一个完整循环
+    bool failed;            // 空间不足等原因放弃录制
+    size_t readPos;
+    
+    String path(uint16_t id) {
+        return String(FRAME_CACHE_DIR) + "/" + String(id) + ".anim";
+    }
+    
+    void append(uint16_t id, const void* data, size_t n) {
+        if(failed || complete) return;
+        // 缓存区放不下时直接录到闪存
+        if(!file && len + n <= ANIM_RAM_CACHE_LIMIT && (ram || arenaAdmit(ARENA_CACHE, ANIM_RAM_CACHE_LIMIT))) {
+            if(!ram) ram = (uint8_t*)arenaAlloc(ARENA_CACHE, ANIM_RAM_CACHE_LIMIT);
+            if(!ram) {
+                failed = true;
+                return;
+            }
+            memcpy(ram + len, data, n);
+            len += n;
+            return;
+        }
+        if(!file) {
+            // 转存到闪存, 保留上传新照片需要的空间
+            if(PHOTO_FS.totalBytes() - PHOTO_FS.usedBytes() < STORE_FREE_MARGIN ||
+               !(file = PHOTO_FS.open(path(id), FILE_WRITE)) || file.write(ram, len) != len) {
+                failed = true;
+                return;
+            }
+            arenaFree(ARENA_CACHE, ram);
+            ram = NULL;
+        }
+        if(file.write((const uint8_t*)data, n) != n) {
+            failed = true;
+            return;
+        }
+        len += n;
+    }
+    
+    void finish(uint16_t id) {
+        if(failed) {
+            release(id);
+            failed = true;      // 保持放弃状态, 之后的循环不再录制
+            return;
+        }
+        if(file) {
+            file.close();
+            file = PHOTO_FS.open(path(id), FILE_READ);
+            if(!file) {
+                failed = true;
+                return;
+            }
+        }
+        complete = true;
+        readPos = 0;
+    }
+    
+    // 循环读取, 读到末尾后回到开头
+    void read(void* buf, size_t n) {
+        uint8_t* out = (uint8_t*)buf;
+        while(n > 0) {
+            if(readPos >= len) {
+                readPos = 0;
+                if(file) file.seek(0);
+            }
+            size_t chunk = min(n, len - readPos);
+            if(file) file.read(out, chunk);
+            else memcpy(out, ram + readPos, chunk);
+            readPos += chunk;
+            out += chunk;
+            n -= chunk;
+        }
+    }
+    
+    void release(uint16_t id) {
+        arenaFree(ARENA_CACHE, ram);
+        ram = NULL;
+        if(file) {
+            file.close();
+            PHOTO_FS.remove(path(id));
+        }
+        len = 0;
+        complete = false;
+        failed = false;
+        readPos = 0;
+    }
+};
+
+struct AnimationPlayer {
+    bool playing;
+    uint16_t photoId;
+    AnimatedGIF* gif;               // 录制完成后释放
+    AnimationCache cache;
+    int16_t offsetX, offsetY;
+    int16_t frameX, frameY, frameW, frameH;   // 当前帧的矩形和处置方式, 在绘制回调中记录
+    uint8_t frameDisposal;
+    bool disposePending;            // 上一帧要求在下一帧前恢复背景
+    unsigned long nextFrameAt;      // 下一帧的计划时间, 按计划累加避免误差积累
+    // 统计
+    unsigned long startMs;
+    uint32_t frames;
+    uint32_t lateFrames;            // 落后太多而重新对齐的次数
+    uint64_t busyUs;                // 解码和推送占用的时间
+} anim;
+
+void animationRecord(const void* data, size_t n) {
+    anim.cache.append(anim.photoId, data, n);
+}
+
+// 播放时的绘制回调: 只推送当前帧矩形内的不透明像素段
+void gifPlayLine(GIFDRAW* draw) {
+    static uint16_t line[SCREEN_WIDTH];
+    if(draw->y == 0) {
+        anim.frameX = anim.offsetX + draw->iX;
+        anim.frameY = anim.offsetY + draw->iY;
+        anim.frameW = draw->iWidth;
+        anim.frameH = draw->iHeight;
+        anim.frameDisposal = draw->ucDisposalMethod;
+    }
+    int16_t y = anim.offsetY + draw->iY + draw->y;
+    int16_t x0 = anim.offsetX + draw->iX;
+    int w = min(draw->iWidth, SCREEN_WIDTH - x0);
+    if(y >= SCREEN_HEIGHT || w <= 0) return;
+    
+    animSplitRuns(draw->pPixels, w, draw->ucHasTransparency, draw->ucTransparent, draw->pPalette, line,
+                  [&](int start, uint16_t n) {
+        uint8_t op[ANIM_OP_RUN_SIZE];
+        animationRecord(op, animOpRun(op, x0 + start, y, n));
+        animationRecord(line, n * sizeof(uint16_t));
+        applyColorLut(line, n);
+        tft.pushImage(x0 + start, y, n, 1, line);
+    });
+}
+
+void animationStop() {
+    if(anim.gif) {
+        anim.gif->close();
+        delete anim.gif;
+        anim.gif = NULL;
+    }
+    anim.cache.release(anim.photoId);
+    anim.playing = false;
+}
+
+// 开始播放当前照片(第一帧已由drawPhoto画出, 从第一帧重新开始)
+void animationStart() {
+    animationStop();
+    if(!hasPhoto() || photoStore[currentPhoto].format != PHOTO_GIF) return;
+    
+    anim.photoId = photoStore[currentPhoto].id;
+    // 内存不够时停在drawPhoto画出的第一帧
+    anim.gif = new (std::nothrow) AnimatedGIF();
+    if(!anim.gif) {
+        memoryState.heapFailures++;
+        LOG_WARN("内存不足, GIF只显示第一帧");
+        return;
+    }
+    anim.gif->begin(GIF_PALETTE_RGB565_BE);
+    String path = storedPhotoPath(anim.photoId, PHOTO_GIF);
+    if(!anim.gif->open(path.c_str(), gifOpen, gifClose, gifRead, gifSeek, gifPlayLine)) {
+        delete anim.gif;
+        anim.gif = NULL;
+        return;
+    }
+    anim.offsetX = gifOffset(anim.gif->getCanvasWidth(), SCREEN_WIDTH);
+    anim.offsetY = gifOffset(anim.gif->getCanvasHeight(), SCREEN_HEIGHT);
+    anim.disposePending = false;
+    anim.playing = true;
+    anim.startMs = millis();
+    anim.nextFrameAt = anim.startMs;
+    anim.frames = 0;
+    anim.lateFrames = 0;
+    anim.busyUs = 0;
+}
+
+// 回放的输出: 直接画到屏幕
+struct AnimationPanel {
+    void run(int16_t x, int16_t y, uint16_t n, uint16_t* px) {
+        applyColorLut(px, n);
+        tft.pushImage(x, y, n, 1, px);
+    }
+    
+    void fill(int16_t x, int16_t y, int16_t w, int16_t h) {
+        tft.fillRect(x, y, w, h, TFT_BLACK);
+    }
+};
+
+// 回放一帧录制的指令, 返回帧延时
+int animationReplayFrame() {
+    static uint16_t line[SCREEN_WIDTH];
+    AnimationPanel panel;
+    return animReplayFrame(anim.cache, panel, line);
+}
+
+// 解码并显示下一帧, 返回帧延时, 出错返回-1
+int animationDecodeFrame() {
+    if(anim.disposePending) {
+        // 处置方式2: 下一帧之前把上一帧的区域恢复为背景
+        tft.fillRect(anim.frameX, anim.frameY, anim.frameW, anim.frameH, TFT_BLACK);
+        uint8_t op[ANIM_OP_FILL_SIZE];
+        animationRecord(op, animOpFill(op, anim.frameX, anim.frameY, anim.frameW, anim.frameH));
+        anim.disposePending = false;
+    }
+    
+    int delayMs = 0;
+    int r = anim.gif->playFrame(false, &delayMs);
+    if(r < 0) return -1;
+    anim.disposePending = anim.frameDisposal == 2;
+    uint8_t op[ANIM_OP_END_SIZE];
+    animationRecord(op, animOpEnd(op, delayMs));
+    
+    if(r == 0) {
+        // 一个循环结束: 录制成功就释放解码器, 否则从头继续解码
+        if(anim.disposePending) {
+            uint8_t fill[ANIM_OP_FILL_SIZE];
+            animationRecord(fill, animOpFill(fill, anim.frameX, anim.frameY, anim.frameW, anim.frameH));
+        }
+        anim.cache.finish(anim.photoId);
+        if(anim.cache.complete) {
+            anim.gif->close();
+            delete anim.gif;
+            anim.gif = NULL;
+            anim.disposePending = false;
+            LOG_DEBUG("动画已缓存: %u 字节(%s)", (unsigned)anim.cache.len, anim.cache.file ? "闪存" : "内存");
+        } else {
+            anim.gif->reset();
+        }
+    }
+    return delayMs;
+}
+
+// 在loop中调用, 按帧延时推进; 计划时间逐帧累加, 单帧的抖动不会积累成漂移
+void animationTick() {
+    if(!anim.playing) return;
+    unsigned long now = millis();
+    if((long)(now - anim.nextFrameAt) < 0) return;
+    if(now - anim.nextFrameAt > ANIM_MAX_LAG) {
+        anim.nextFrameAt = now;
+        anim.lateFrames++;
+    }
+    
+    unsigned long start = micros();
+    int delayMs = anim.cache.complete ? animationReplayFrame() : animationDecodeFrame();
+    anim.busyUs += micros() - start;
+    if(delayMs < 0) {
+        LOG_WARN("GIF解码失败, 停止播放");
+        animationStop();
+        return;
+    }
+    anim.frames++;
+    anim.nextFrameAt += delayMs < ANIM_MIN_DELAY ? 100 : delayMs;
+}
+
+// 动画统计: /animation
+void handleAnimation() {
+    unsigned long elapsed = millis() - anim.startMs;
+    String json = "{\"playing\":" + String(anim.playing ? "true" : "false");
+    json += ",\"frames\":" + String(anim.frames);
+    json += ",\"fps\":" + String(elapsed ? anim.frames * 1000.0f / elapsed : 0, 1);
+    json += ",\"headroom\":" + String(elapsed ? 100 - (int)(anim.busyUs / 10 / elapsed) : 100);
+    json += ",\"late\":" + String(anim.lateFrames);
+    json += ",\"cache\":\"" + String(!anim.cache.complete ? "none" : anim.cache.file ? "flash" : "ram") + "\"";
+    json += ",\"cacheBytes\":" + String(anim.cache.len) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 幻灯片: 定时切换照片, 下一张提前在后台解码
+struct Slideshow {
+    bool enabled = false;
+    unsigned long interval = 10000;   // 切换间隔(ms)
+    unsigned long lastSwitch = 0;
+    unsigned long lastSwitchUs = 0;   // 上次切换耗时(从开始到画面推送完成)
+    uint32_t cacheHits = 0;
+    uint32_t cacheMisses = 0;
+} slideshow;
+
+// 切换到指定照片; 有过渡效果时先播放过渡, 命中缓存时直接覆盖推送, 都没有黑屏
+void showPhoto(int index) {
+    if(index < 0 || index >= photoCount) return;
+    int previous = currentPhoto;
+    animationStop();
+    
+    unsigned long start = micros();
+    bool transitioned = false;
+    if(transitionType != TRANSITION_NONE && frameTier.tier == TIER_PSRAM) {
+        // 先取上一张(刷新使用时间), 再解码新的一张, 新照片不会占用上一张的帧
+        const uint16_t* from = previous >= 0 ? ramFrameLoad(previous) : NULL;
+        const uint16_t* to = ramFrameLoad(index);
+        if(to && (previous < 0 || from)) transitioned = runTransition(from, to);
+    } else if(transitionType != TRANSITION_NONE) {
+        // 从待机画面过渡时以黑色为起点; 上一张没有缓存则不做过渡
+        String fromPath = previous >= 0 ? frameSourcePath(previous) : String();
+        if(previous < 0 || fromPath.length() > 0) {
+            transitioned = runTransition(fromPath, decodeToFrameCache(index));
+        }
+    }
+    
+    currentPhoto = index;
+    if(!transitioned && frameSourcePath(index).length() == 0) {
+        tft.fillScreen(TFT_BLACK);
+    }
+    if(drawPhoto()) {
+        slideshow.cacheHits++;
+    } else {
+        slideshow.cacheMisses++;
+    }
+    slideshow.lastSwitchUs = micros() - start;
+    animationStart();
+    
+    // 当前照片缓存下来供重绘使用, 幻灯片模式再预取下一张
+    requestPrefetch(index);
+    if(slideshow.enabled && photoCount > 1) {
+        requestPrefetch((index + 1) % photoCount);
+    }
+}
+
+// 当前照片的帧耗时对比: 流式(逐块解码推送, esp32dev的方式)和整帧(PSRAM);
+// 有PSRAM的设备上两种都测, 没有时只有流式的结果. 作为绘制命令在loop中执行, /frame-bench读取上一次的结果
+struct FrameBench {
+    uint32_t runs;
+    bool pending;               // 已登记, 尚未执行
+    int32_t photoId;
+    bool psram;
+    bool dynamic;
+    bool frame;                 // 整帧结果有效
+    uint32_t streamUs;
+    uint32_t frameDecodeUs;
+    uint32_t framePresentUs;
+    uint32_t frameWarpUs;
+    uint32_t framePushUs;
+} frameBench;
+
+// 直接推送到屏幕, 调用者随后重绘当前照片(恢复叠加层)
+void frameBenchRun() {
+    frameBench.pending = false;
+    if(!hasPhoto() || photoStore[currentPhoto].format == PHOTO_GIF) return;
+    const StoredPhoto& photo = photoStore[currentPhoto];
+    String path = storedPhotoPath(photo.id, photo.format);
+    ImageSource src = photoSource(photo, path);
+    
+    // 流式: 解码直接推送, 动态模式下逐块变形
+    unsigned long start = micros();
+    drawImage(photo.format, src, 0, 0, photo.scale, tft_output);
+    frameBench.streamUs = micros() - start;
+    timerWrite(watchDog, 0);
+    
+    frameBench.photoId = photo.id;
+    frameBench.psram = frameTier.tier == TIER_PSRAM;
+    frameBench.dynamic = currentDisplayMode == DYNAMIC_MODE;
+    frameBench.frame = false;
+    if(frameTier.tier == TIER_PSRAM) {
+        // 整帧: 首次需要解码, 之后每帧只有变形和推送
+        ramFrameInvalidate(photo.id);
+        start = micros();
+        const uint16_t* frame = ramFrameLoad(currentPhoto);
+        frameBench.frameDecodeUs = micros() - start;
+        if(frame) {
+            frameTier.warpUs = 0;
+            start = micros();
+            presentFrame(frame);
+            frameBench.framePresentUs = micros() - start;
+            frameBench.frameWarpUs = frameTier.warpUs;
+            frameBench.framePushUs = frameTier.pushUs;
+            frameBench.frame = true;
+        }
+    }
+    frameBench.runs++;
+}
+
+// 绘制命令队列: HTTP处理函数只登记要做的绘制并立即应答, 由loop统一执行;
+// 一轮中积压的命令合并为一次绘制(多次切换只画最后的结果).
+// 例外是增量更新(/tiles): 图块边接收边解码推送, 排队就要先缓存整个上传; 它只改当前照片的矩形
+#define RENDER_QUEUE_LEN 8
+#define LATENCY_SAMPLES 128
+
+enum RenderCommandType {
+    RENDER_REDRAW,      // 重绘当前照片(模式/色彩改变)
+    RENDER_SHOW,        // 切换到指定照片
+    RENDER_BENCH        // 测量当前照片的帧耗时, 之后重绘
+};
+
+struct RenderCommand {
+    RenderCommandType type;
+    int32_t photoId;    // 用编号而不是下标, 执行前照片库可能有增删
+    bool redraw;        // 合并进过重绘: 要切换的照片已在屏幕上或已删除时仍需重绘当前照片
+    bool bench;         // 合并进过帧耗时测量
+};
+
+struct RenderQueue {
+    RenderCommand items[RENDER_QUEUE_LEN];
+    uint8_t head;
+    uint8_t count;
+    bool overflow;              // 队列满后的命令合并到这里, 不会丢失最后一次切换
+    RenderCommand overflowCmd;
+} renderQueue;
+
+struct RenderStats {
+    uint32_t queued;
+    uint32_t executed;          // 实际绘制次数
+    uint32_t coalesced;         // 被合并掉的命令数
+    uint32_t overflows;
+    unsigned long lastUs;
+} renderStats;
+
+// 把新命令合并进已有命令: 后来的切换取代之前的, 重绘和测量要求一直保留
+void mergeRenderCommand(RenderCommand& into, const RenderCommand& cmd) {
+    bool redraw = into.redraw || cmd.redraw;
+    bool bench = into.bench || cmd.bench;
+    if(cmd.type == RENDER_SHOW || into.type != RENDER_SHOW) into = cmd;
+    into.redraw = redraw;
+    into.bench = bench;
+}
+
+void requestRender(RenderCommandType type, int32_t photoId = -1) {
+    RenderCommand cmd = {type, photoId, type != RENDER_SHOW, type == RENDER_BENCH};
+    renderStats.queued++;
+    if(renderQueue.count < RENDER_QUEUE_LEN) {
+        renderQueue.items[(renderQueue.head + renderQueue.count) % RENDER_QUEUE_LEN] = cmd;
+        renderQueue.count++;
+        return;
+    }
+    renderStats.overflows++;
+    if(renderQueue.overflow) {
+        mergeRenderCommand(renderQueue.overflowCmd, cmd);
+    } else {
+        renderQueue.overflow = true;
+        renderQueue.overflowCmd = cmd;
+    }
+}
+
+// 在loop中调用: 取出全部积压命令合并后执行一次
+void processRenderQueue() {
+    uint32_t taken = renderQueue.count + (renderQueue.overflow ? 1 : 0);
+    if(taken == 0) return;
+
+    RenderCommand merged = renderQueue.items[renderQueue.head];
+    for(uint8_t i = 1; i < renderQueue.count; i++) {
+        mergeRenderCommand(merged, renderQueue.items[(renderQueue.head + i) % RENDER_QUEUE_LEN]);
+    }
+    if(renderQueue.count == 0) merged = renderQueue.overflowCmd;
+    else if(renderQueue.overflow) mergeRenderCommand(merged, renderQueue.overflowCmd);
+    renderQueue.head = 0;
+    renderQueue.count = 0;
+    renderQueue.overflow = false;
+
+    unsigned long start = micros();
+    int index = merged.type == RENDER_SHOW ? findPhotoById(merged.photoId) : -1;
+    if(merged.bench) frameBenchRun();     // 在切换之前测量, 之后的绘制覆盖测量留下的画面
+    if(index >= 0 && index != currentPhoto) {
+        showPhoto(index);
+    } else if(merged.redraw && hasPhoto()) {
+        drawPhoto();
+    } else {
+        // 要显示的照片已在屏幕上或已被删除
+        renderStats.coalesced += taken;
+        return;
+    }
+    renderStats.executed++;
+    renderStats.coalesced += taken - 1;
+    renderStats.lastUs = micros() - start;
+}
+
+// 请求处理耗时(不含上传数据的接收), 保留最近的样本用于计算分位数
+struct LatencyStats {
+    uint32_t samples[LATENCY_SAMPLES];
+    uint16_t count;
+    uint16_t next;
+    uint32_t maxUs;
+} handlerLatency;
+
+void recordHandlerLatency(uint32_t us) {
+    handlerLatency.samples[handlerLatency.next] = us;
+    handlerLatency.next = (handlerLatency.next + 1) % LATENCY_SAMPLES;
+    if(handlerLatency.count < LATENCY_SAMPLES) handlerLatency.count++;
+    if(us > handlerLatency.maxUs) handlerLatency.maxUs = us;
+}
+
+// 最近样本的分位数, percent为0..100
+uint32_t handlerLatencyPercentile(uint8_t percent) {
+    if(handlerLatency.count == 0) return 0;
+    uint32_t sorted[LATENCY_SAMPLES];
+    memcpy(sorted, handlerLatency.samples, handlerLatency.count * sizeof(uint32_t));
+    std::sort(sorted, sorted + handlerLatency.count);
+    return sorted[(handlerLatency.count - 1) * percent / 100];
+}
+
+// 注册路由时包一层计时
+WebServer::THandlerFunction timed(void (*handler)()) {
+    return [handler]() {
+        unsigned long start = micros();
+        handler();
+        recordHandlerLatency(micros() - start);
+        lastRequest = millis();
+    };
+}
+
+// 绘制队列和请求耗时统计: /render
+void handleRenderStats() {
+    String json = "{\"queued\":" + String(renderStats.queued);
+    json += ",\"executed\":" + String(renderStats.executed);
+    json += ",\"coalesced\":" + String(renderStats.coalesced);
+    json += ",\"coalescePercent\":" + String(renderStats.queued ? renderStats.coalesced * 100 / renderStats.queued : 0);
+    json += ",\"overflows\":" + String(renderStats.overflows);
+    json += ",\"lastRenderUs\":" + String(renderStats.lastUs);
+    json += ",\"requests\":" + String(handlerLatency.count);
+    json += ",\"p50Us\":" + String(handlerLatencyPercentile(50));
+    json += ",\"p99Us\":" + String(handlerLatencyPercentile(99));
+    json += ",\"maxUs\":" + String(handlerLatency.maxUs) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 平移缩放(Ken Burns): 高分辨率照片按原尺寸解码成128x16像素的图块, 每块4096字节正好一个扇区;
+// 每帧只读视窗覆盖的图块, 用定点双线性插值缩放成条带推送, 不需要整帧缓冲
+// 图块文件只保留当前照片的一份, 第一个图块位置存放文件头
+#define KB_TILES_PATH FRAME_CACHE_DIR "/kb.tiles"
+#define KB_TILE_W 128
+#define KB_TILE_H 16
+#define KB_TILE_PIXELS (KB_TILE_W * KB_TILE_H)
+#define KB_TILE_BYTES (KB_TILE_PIXELS * 2)
+#define KB_MAX_TILE_COLS 4                // 最大宽度512像素
+#define KB_TILE_CACHE 8                   // 相邻两行源像素最多跨2x4个图块
+#define KB_STRIP_ROWS 8
+#define KB_FPS 15
+#define KB_MOVE_MS 12000                  // 每段镜头运动的时长
+
+struct KenBurns {
+    bool enabled;
+    int32_t tilesId;            // 图块文件对应的照片, -1为没有
+    int32_t failedId;           // 生成失败的照片, 不再重试
+    uint16_t width, height;
+    uint8_t cols;
+    File tiles;
+    uint16_t* cache;            // KB_TILE_CACHE个图块
+    int16_t cacheIndex[KB_TILE_CACHE];
+    uint32_t cacheUsed[KB_TILE_CACHE];
+    uint32_t useClock;
+    int32_t from[3], to[3];     // 镜头起止: 视窗左上角x, y和宽度, 源图坐标16.16定点
+    unsigned long moveStart;
+    unsigned long lastFrame;
+
+    // 统计
+    unsigned long buildMs;
+    unsigned long lastFrameUs;
+    uint32_t frames;
+    uint32_t tileReads;
+    unsigned long windowStart;
+    uint32_t windowFrames;
+    uint32_t windowReads;
+    float fps;
+    uint32_t readKBps;          // 图块读取带宽(KB/s)
+} kenBurns = {false, -1, -1};
+
+// 生成图块: 一个图块行(16行像素)的条带按图块顺序排列, 攒满后一次写出
+struct KbTileWriter {
+    File file;
+    uint16_t* band;
+    int16_t bandY;
+    bool ok;
+} kbWriter;
+
+bool kbFlushBand() {
+    size_t bytes = kenBurns.cols * KB_TILE_BYTES;
+    kbWriter.ok = kbWriter.ok && kbWriter.file.write((uint8_t*)kbWriter.band, bytes) == bytes;
+    memset(kbWriter.band, 0, bytes);
+    kbWriter.bandY += KB_TILE_H;
+    timerWrite(watchDog, 0);
+    return kbWriter.ok;
+}
+
+bool kbTileSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    if(y >= kenBurns.height || x >= kenBurns.width) return kbWriter.ok;
+    while(y >= kbWriter.bandY + KB_TILE_H) {
+        if(!kbFlushBand()) return false;
+    }
+    int16_t right = min((int)(x + w), (int)kenBurns.width);
+    for(uint16_t r = 0; r < h; r++) {
+        int16_t row = y + r - kbWriter.bandY;
+        if(row < 0 || row >= KB_TILE_H) continue;
+        for(int16_t c = x; c < right; ) {
+            int16_t tx = c / KB_TILE_W;
+            int16_t n = min((int)right, (tx + 1) * KB_TILE_W) - c;
+            memcpy(kbWriter.band + tx * KB_TILE_PIXELS + row * KB_TILE_W + c % KB_TILE_W,
+                   bitmap + r * w + (c - x), n * sizeof(uint16_t));
+            c += n;
+        }
+    }
+    return true;
+}
+
+void kenBurnsClose() {
+    if(kenBurns.tiles) kenBurns.tiles.close();
+    arenaFree(ARENA_CACHE, kenBurns.cache);
+    kenBurns.cache = NULL;
+}
+
+// 为当前照片生成图块文件(阻塞, 640KB约需数秒)
+bool kenBurnsBuild() {
+    const StoredPhoto& photo = photoStore[currentPhoto];
+    kenBurnsClose();
+    kenBurns.tilesId = -1;
+    PHOTO_FS.remove(KB_TILES_PATH);
+
+    kenBurns.width = SCREEN_WIDTH * photo.scale;
+    kenBurns.height = SCREEN_HEIGHT * photo.scale;
+    kenBurns.cols = (kenBurns.width + KB_TILE_W - 1) / KB_TILE_W;
+    if(photo.scale < 2 || kenBurns.cols > KB_MAX_TILE_COLS) return false;
+    size_t bytes = (1 + kenBurns.cols * (kenBurns.height / KB_TILE_H)) * KB_TILE_BYTES;
+    if(PHOTO_FS.totalBytes() - PHOTO_FS.usedBytes() < bytes + STORE_FREE_MARGIN) return false;
+
+    unsigned long start = millis();
+    size_t bandBytes = kenBurns.cols * KB_TILE_BYTES;
+    kbWriter.band = (uint16_t*)arenaAlloc(ARENA_RENDER, bandBytes);
+    if(kbWriter.band) memset(kbWriter.band, 0, bandBytes);
+    kbWriter.file = PHOTO_FS.open(KB_TILES_PATH, FILE_WRITE);
+    kbWriter.bandY = 0;
+    kbWriter.ok = kbWriter.band && kbWriter.file;
+    if(kbWriter.ok) {
+        // 文件头占满一个图块, 图块从4096字节边界开始; 借用还是全0的条带缓冲
+        uint8_t header[8] = {'K', 'B', 'T', '1',
+            (uint8_t)(kenBurns.width & 0xFF), (uint8_t)(kenBurns.width >> 8),
+            (uint8_t)(kenBurns.height & 0xFF), (uint8_t)(kenBurns.height >> 8)};
+        memcpy(kbWriter.band, header, sizeof(header));
+        kbWriter.ok = kbWriter.file.write((uint8_t*)kbWriter.band, KB_TILE_BYTES) == KB_TILE_BYTES;
+        memset(kbWriter.band, 0, sizeof(header));
+    }
+    if(kbWriter.ok) {
+        String src = storedPhotoPath(photo.id, photo.format);
+        bool decoded = photo.format == PHOTO_JPEG ? decodeJpegFile(src.c_str(), kbTileSink, 1) :
+                       q565Draw(fileSource(src.c_str(), 0), 0, 0, 1, kbTileSink) == DECODE_OK;
+        while(decoded && kbWriter.ok && kbWriter.bandY < kenBurns.height) kbFlushBand();
+        kbWriter.ok = decoded && kbWriter.ok;
+    }
+    arenaFree(ARENA_RENDER, kbWriter.band);
+    kbWriter.band = NULL;
+    if(kbWriter.file) kbWriter.file.close();
+    if(!kbWriter.ok) {
+        PHOTO_FS.remove(KB_TILES_PATH);
+        return false;
+    }
+
+    kenBurns.buildMs = millis() - start;
+    kenBurns.tilesId = photo.id;
+    LOG_DEBUG("平移缩放图块: %ux%u, %u 字节, %lu ms", kenBurns.width, kenBurns.height,
+              (unsigned)bytes, kenBurns.buildMs);
+    return true;
+}
+
+// 取图块(最近最少使用淘汰), 返回图块像素, 读取失败为NULL
+const uint16_t* kbTile(int tx, int ty) {
+    int16_t index = ty * kenBurns.cols + tx;
+    int slot = 0;
+    for(int i = 0; i < KB_TILE_CACHE; i++) {
+        if(kenBurns.cacheIndex[i] == index) {
+            kenBurns.cacheUsed[i] = ++kenBurns.useClock;
+            return kenBurns.cache + i * KB_TILE_PIXELS;
+        }
+        if(kenBurns.cacheUsed[i] < kenBurns.cacheUsed[slot]) slot = i;
+    }
+
+    uint16_t* data = kenBurns.cache + slot * KB_TILE_PIXELS;
+    kenBurns.cacheIndex[slot] = -1;
+    if(!kenBurns.tiles.seek((uint32_t)(1 + index) * KB_TILE_BYTES) ||
+       kenBurns.tiles.read((uint8_t*)data, KB_TILE_BYTES) != KB_TILE_BYTES) {
+        return NULL;
+    }
+    kenBurns.cacheIndex[slot] = index;
+    kenBurns.cacheUsed[slot] = ++kenBurns.useClock;
+    kenBurns.tileReads++;
+    kenBurns.windowReads++;
+    return data;
+}
+
+// 选下一段镜头: 在推近和拉远之间交替, 位置随机
+void kenBurnsPlan() {
+    memcpy(kenBurns.from, kenBurns.to, sizeof(kenBurns.to));
+    int32_t maxW = min((int)kenBurns.width, kenBurns.height * SCREEN_WIDTH / SCREEN_HEIGHT);
+    int32_t mid = (SCREEN_WIDTH + maxW) / 2;
+    int32_t w = (kenBurns.from[2] >> 16) > mid ? random(SCREEN_WIDTH, mid) : random(mid, maxW + 1);
+    int32_t h = w * SCREEN_HEIGHT / SCREEN_WIDTH;
+    kenBurns.to[0] = random(0, kenBurns.width - w + 1) << 16;
+    kenBurns.to[1] = random(0, kenBurns.height - h + 1) << 16;
+    kenBurns.to[2] = w << 16;
+    kenBurns.moveStart = millis();
+}
+
+// 从整张照片开始, 和普通显示的画面衔接
+void kenBurnsStart() {
+    int32_t maxW = min((int)kenBurns.width, kenBurns.height * SCREEN_WIDTH / SCREEN_HEIGHT);
+    kenBurns.to[0] = ((kenBurns.width - maxW) / 2) << 16;
+    kenBurns.to[1] = ((kenBurns.height - maxW * SCREEN_HEIGHT / SCREEN_WIDTH) / 2) << 16;
+    kenBurns.to[2] = maxW << 16;
+    kenBurnsPlan();
+    kenBurns.frames = 0;
+    kenBurns.tileReads = 0;
+    kenBurns.windowStart = millis();
+    kenBurns.windowFrames = 0;
+    kenBurns.windowReads = 0;
+}
+
+bool kenBurnsFrame() {
+    unsigned long start = micros();
+    float t = (float)(millis() - kenBurns.moveStart) / KB_MOVE_MS;
+    if(t >= 1) {
+        kenBurnsPlan();
+        t = 0;
+    }
+    float e = t * t * (3 - 2 * t);
+    int32_t view[3];
+    for(int i = 0; i < 3; i++) {
+        view[i] = kenBurns.from[i] + (int32_t)((kenBurns.to[i] - kenBurns.from[i]) * e);
+    }
+
+    // 每个输出像素对应的源坐标: 整数部分和5位小数(blend565的权重)
+    static int16_t colX[SCREEN_WIDTH];
+    static uint8_t colF[SCREEN_WIDTH];
+    static uint16_t strip[SCREEN_WIDTH * KB_STRIP_ROWS];
+    int32_t step = view[2] / SCREEN_WIDTH;
+    for(int x = 0; x < SCREEN_WIDTH; x++) {
+        int32_t sx = view[0] + x * step;
+        colX[x] = min(sx >> 16, kenBurns.width - 2);
+        colF[x] = (sx >> 11) & 31;
+    }
+    int tx0 = colX[0] / KB_TILE_W;
+    int tx1 = (colX[SCREEN_WIDTH - 1] + 1) / KB_TILE_W;
+
+    for(int y0 = 0; y0 < SCREEN_HEIGHT; y0 += KB_STRIP_ROWS) {
+        uint16_t* out = strip;
+        for(int r = 0; r < KB_STRIP_ROWS; r++) {
+            int32_t sy = view[1] + (y0 + r) * step;
+            int row = min(sy >> 16, kenBurns.height - 2);
+            uint8_t fy = (sy >> 11) & 31;
+
+            // 上下两行源像素在各图块中的行指针
+            const uint16_t* top[KB_MAX_TILE_COLS];
+            const uint16_t* bottom[KB_MAX_TILE_COLS];
+            for(int tx = tx0; tx <= tx1; tx++) {
+                const uint16_t* a = kbTile(tx, row / KB_TILE_H);
+                const uint16_t* b = kbTile(tx, (row + 1) / KB_TILE_H);
+                if(!a || !b) return false;
+                top[tx] = a + (row % KB_TILE_H) * KB_TILE_W;
+                bottom[tx] = b + ((row + 1) % KB_TILE_H) * KB_TILE_W;
+            }
+
+            for(int x = 0; x < SCREEN_WIDTH; x++) {
+                int sx = colX[x];
+                int t0 = sx / KB_TILE_W, c0 = sx % KB_TILE_W;
+                int t1 = (sx + 1) / KB_TILE_W, c1 = (sx + 1) % KB_TILE_W;
+                uint16_t p00 = top[t0][c0], p01 = top[t1][c1];
+                uint16_t p10 = bottom[t0][c0], p11 = bottom[t1][c1];
+                // 像素是交换过字节的, 插值前后各换一次
+                uint16_t upper = blend565((p01 >> 8) | (p01 << 8), (p00 >> 8) | (p00 << 8), colF[x]);
+                uint16_t lower = blend565((p11 >> 8) | (p11 << 8), (p10 >> 8) | (p10 << 8), colF[x]);
+                uint16_t v = blend565(lower, upper, fy);
+                *out++ = (v >> 8) | (v << 8);
+            }
+        }
+        applyColorLut(strip, SCREEN_WIDTH * KB_STRIP_ROWS);
+        tft.pushImage(0, y0, SCREEN_WIDTH, KB_STRIP_ROWS, strip);
+    }
+
+    kenBurns.lastFrameUs = micros() - start;
+    kenBurns.frames++;
+    kenBurns.windowFrames++;
+    unsigned long window = millis() - kenBurns.windowStart;
+    if(window >= 2000) {
+        kenBurns.fps = kenBurns.windowFrames * 1000.0f / window;
+        kenBurns.readKBps = (uint32_t)((uint64_t)kenBurns.windowReads * KB_TILE_BYTES / window * 1000 / 1024);
+        kenBurns.windowStart = millis();
+        kenBurns.windowFrames = 0;
+        kenBurns.windowReads = 0;
+    }
+    return true;
+}
+
+// 在loop中调用; 当前照片不适用(分辨率不够等)时返回false, 按普通方式显示
+bool kenBurnsTick() {
+    if(!kenBurns.enabled || !hasPhoto()) return false;
+    const StoredPhoto& photo = photoStore[currentPhoto];
+    if(photo.id == kenBurns.failedId || photo.scale < 2 ||
+       (photo.format != PHOTO_JPEG && photo.format != PHOTO_Q565)) return false;
+
+    if(kenBurns.tilesId != photo.id) {
+        if(!kenBurnsBuild()) {
+            kenBurns.failedId = photo.id;
+            return false;
+        }
+        kenBurnsStart();
+    }
+    if(!kenBurns.tiles) {
+        kenBurns.tiles = PHOTO_FS.open(KB_TILES_PATH, FILE_READ);
+        kenBurns.cache = arenaAdmit(ARENA_CACHE, KB_TILE_CACHE * KB_TILE_BYTES) ?
+            (uint16_t*)arenaAlloc(ARENA_CACHE, KB_TILE_CACHE * KB_TILE_BYTES) : NULL;
+        if(!kenBurns.tiles || !kenBurns.cache) {
+            kenBurnsClose();
+            kenBurns.failedId = photo.id;
+            return false;
+        }
+        for(int i = 0; i < KB_TILE_CACHE; i++) {
+            kenBurns.cacheIndex[i] = -1;
+            kenBurns.cacheUsed[i] = 0;
+        }
+    }
+
+    if(millis() - kenBurns.lastFrame < 1000 / KB_FPS) return true;
+    kenBurns.lastFrame = millis();
+    if(!kenBurnsFrame()) {
+        kenBurnsClose();
+        kenBurns.tilesId = -1;
+        kenBurns.failedId = photo.id;
+        return false;
+    }
+    return true;
+}
+
+// 平移缩放开关和统计: /kenburns?on=0|1
+void handleKenBurns() {
+    markActivity();
+    if(server.hasArg("on")) {
+        bool on = server.arg("on") == "1";
+        if(kenBurns.enabled && !on) {
+            // 图块文件较大, 关闭时删除, 下次开启重新生成
+            kenBurnsClose();
+            kenBurns.tilesId = -1;
+            PHOTO_FS.remove(KB_TILES_PATH);
+            requestRender(RENDER_REDRAW);
+        }
+        kenBurns.enabled = on;
+        kenBurns.failedId = -1;
+    }
+
+    bool active = kenBurns.enabled && hasPhoto() && kenBurns.tilesId == photoStore[currentPhoto].id;
+    String json = "{\"enabled\":" + String(kenBurns.enabled ? "true" : "false");
+    json += ",\"active\":" + String(active ? "true" : "false");
+    json += ",\"width\":" + String(kenBurns.width);
+    json += ",\"height\":" + String(kenBurns.height);
+    json += ",\"buildMs\":" + String(kenBurns.buildMs);
+    json += ",\"frames\":" + String(kenBurns.frames);
+    json += ",\"fps\":" + String(kenBurns.fps, 1);
+    json += ",\"frameUs\":" + String(kenBurns.lastFrameUs);
+    json += ",\"tileReads\":" + String(kenBurns.tileReads);
+    json += ",\"readKBps\":" + String(kenBurns.readKBps) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 定期检查系统堆: 低于下限时降级(动态效果改为直接显示, 释放平移缩放图块缓存,
+// 新的缓存申请被拒绝), 回升后恢复
+void memoryTick() {
+    if(millis() - lastHeapCheck <= HEAP_CHECK_INTERVAL) return;
+    lastHeapCheck = millis();
+
+    size_t freeHeap = ESP.getFreeHeap();
+    if(freeHeap < memoryState.systemLow) memoryState.systemLow = freeHeap;
+    if(!memoryState.degraded && freeHeap < MIN_HEAP_SIZE) {
+        memoryState.degraded = true;
+        memoryState.degradations++;
+        kenBurnsClose();
+        LOG_WARN("内存不足 %u bytes, 降级运行", (unsigned)freeHeap);
+    } else if(memoryState.degraded && freeHeap > MIN_HEAP_SIZE + MEM_RECOVER_MARGIN) {
+        memoryState.degraded = false;
+        LOG_INFO("内存恢复 %u bytes", (unsigned)freeHeap);
+    }
+    
+    // 打印内存信息
+    LOG_INFO("空闲堆内存: %u bytes, 最大空闲块: %u bytes", (unsigned)freeHeap, (unsigned)ESP.getMaxAllocHeap());
+}
+
+// 各内存区的用量和最高水位: /memory
+void handleMemory() {
+    String json = "{\"tier\":\"" + String(frameTier.tier == TIER_PSRAM ? "psram" : "streaming") + "\"";
+    json += ",\"degraded\":" + String(memoryState.degraded ? "true" : "false");
+    json += ",\"degradations\":" + String(memoryState.degradations);
+    json += ",\"heapFailures\":" + String(memoryState.heapFailures);
+    json += ",\"arenas\":[";
+    for(int i = 0; i < ARENA_COUNT; i++) {
+        const ArenaState& a = arenas[i];
+        if(i > 0) json += ",";
+        json += "{\"name\":\"" + String(a.name) + "\"";
+        json += ",\"capacity\":" + String(a.capacity);
+        json += ",\"used\":" + String(a.used);
+        json += ",\"highWater\":" + String(a.highWater);
+        json += ",\"allocs\":" + String(a.allocs);
+        json += ",\"failures\":" + String(a.failures) + "}";
+    }
+    // 系统堆(WiFi/HTTP)的最高水位按启动后的最低空闲量计
+    json += "],\"system\":{\"reserve\":" + String(MEM_HTTP_RESERVE);
+    json += ",\"atBoot\":" + String(memoryState.systemAtBoot);
+    json += ",\"free\":" + String(ESP.getFreeHeap());
+    json += ",\"highWater\":" + String(memoryState.systemAtBoot - min(memoryState.systemLow, memoryState.systemAtBoot)) + "}}";
+    server.send(200, "application/json", json);
+}
+
+void handleSlideshow() {
+    markActivity();
+    if(server.hasArg("interval")) {
+        long seconds = server.arg("interval").toInt();
+        if(seconds >= 2) slideshow.interval = seconds * 1000;
+    }
+    if(server.hasArg("on")) {
+        slideshow.enabled = server.arg("on") == "1";
+        slideshow.lastSwitch = millis();
+        if(slideshow.enabled && photoCount > 0) {
+            requestPrefetch(hasPhoto() ? (currentPhoto + 1) % photoCount : 0);
+        }
+    }
+    
+    String json = "{\"enabled\":" + String(slideshow.enabled ? "true" : "false");
+    json += ",\"interval\":" + String(slideshow.interval / 1000);
+    json += ",\"photos\":" + String(photoCount);
+    json += ",\"current\":" + String(currentPhoto);
+    json += ",\"lastSwitchUs\":" + String(slideshow.lastSwitchUs);
+    json += ",\"cacheHits\":" + String(slideshow.cacheHits);
+    json += ",\"cacheMisses\":" + String(slideshow.cacheMisses);
+    json += ",\"lastPrefetchMs\":" + String(lastPrefetchTime) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 过渡效果设置和统计: /transition?type=crossfade|wipe|slide|none&ms=800
+void handleTransition() {
+    const char* names[] = {"none", "crossfade", "wipe", "slide"};
+    if(server.hasArg("type")) {
+        String type = server.arg("type");
+        for(int i = 0; i < 4; i++) {
+            if(type == names[i]) transitionType = (TransitionType)i;
+        }
+    }
+    if(server.hasArg("ms")) {
+        long ms = server.arg("ms").toInt();
+        if(ms >= 100 && ms <= 5000) transitionDuration = ms;
+    }
+    
+    String json = "{\"type\":\"" + String(names[transitionType]) + "\"";
+    json += ",\"ms\":" + String(transitionDuration);
+    json += ",\"frames\":" + String(transitionStats.frames);
+    json += ",\"fps\":" + String(transitionStats.elapsedMs ? transitionStats.frames * 1000 / transitionStats.elapsedMs : 0);
+    json += ",\"blendMpxPerSec\":" + String(transitionStats.blendUs ? transitionStats.blendPixels / transitionStats.blendUs : 0) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 实时投屏: 客户端通过WebSocket推送帧, 直接在内存中解码到屏幕, 不经过闪存
+// 消息格式: 4字节帧序号(小端) + JPEG/Q565/R565数据; 每帧处理后回复JSON确认
+#define STREAM_PORT 81
+#define STREAM_MAX_FRAME (64 * 1024)
+#define STREAM_IDLE_TIMEOUT 3000      // 超过该时间没有新帧则退出投屏
+#define STREAM_DRAIN_LIMIT 4          // 每轮最多收取的消息数, 只解码最新一帧
 
-// 屏幕分辨率
-#define SCREEN_WIDTH 240
-#define SCREEN_HEIGHT 320
+WebSocketsServer webSocket(STREAM_PORT);
 
-// 调试标志
-#define DEBUG_ANIMATION true
+// 最新帧缓冲: 新帧到达时直接覆盖还没解码的旧帧
+struct StreamFrame {
+    uint8_t* data;
+    size_t capacity;
+    size_t size;
+    uint32_t seq;
+    uint8_t client;
+    bool ready;
+} streamFrame;
 
-// 动画相关常量
-const unsigned long ANIMATION_INTERVAL = 50;  // 动画更新间隔(ms)
+struct StreamStats {
+    uint32_t received;          // 收到的帧数
+    uint32_t frames;            // 已显示帧数
+    uint32_t dropped;           // 被新帧覆盖而丢弃的帧数
+    uint32_t errors;
+    unsigned long lastFrame;    // 上次收到帧的时间(ms)
+    unsigned long lastDecodeUs;
+    uint64_t totalDecodeUs;
+    uint32_t windowFrames;      // 统计窗口内显示的帧数
+    unsigned long windowStart;
+    uint16_t fps;               // 最近一个统计窗口的帧率
+} streamStats;
 
-// 动画相关变量
-unsigned long lastAnimationUpdate = 0;  // 上次动画更新时间
-uint8_t animationFrame = 0;            // 动画帧计数器
-uint8_t breathBrightness = 0;          // 呼吸效果亮度
-bool isUploading = false;              // 上传状态标志
+bool streamSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    if(y >= SCREEN_HEIGHT) return true;
+    applyColorLut(bitmap, w * h);
+    tft.pushImage(x, y, w, h, bitmap);
+    return true;
+}
 
-// 修改图片动画相关结构
-struct ImageAnimation {
-    float wave = 0;             // 波动效果
-    float waveStrength = 0;     // 波动强度
-    float waveSpeed = 0;        // 波动速度
-    unsigned long lastWave = 0;  // 上次波动时间
-    unsigned long waveInterval = 0; // 波动间隔
-    bool inWave = false;        // 是否在波动中
-    float damping = 0.95;       // 阻尼系数
-    bool enabled = false;       // 动画启用标志
+void sendStreamAck(uint8_t client, uint32_t seq, bool shown) {
+    char ack[96];
+    int len = snprintf(ack, sizeof(ack), "{\"seq\":%lu,\"shown\":%s,\"decodeUs\":%lu,\"fps\":%u}",
+                       (unsigned long)seq, shown ? "true" : "false", streamStats.lastDecodeUs, streamStats.fps);
+    webSocket.sendTXT(client, ack, len);
+}
+
+void onStreamEvent(uint8_t client, WStype_t type, uint8_t* payload, size_t length) {
+    if(type == WStype_CONNECTED) {
+        LOG_DEBUG("投屏客户端%u已连接", client);
+        return;
+    }
+    if(type != WStype_BIN) return;
+    markActivity();
+    if(length <= 4) {
+        streamStats.errors++;
+        return;
+    }
+    uint32_t seq = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+    if(length - 4 > STREAM_MAX_FRAME) {
+        streamStats.errors++;
+        sendStreamAck(client, seq, false);
+        return;
+    }
     
-    // 添加变形网格
-    static const int GRID_SIZE = 16;  // 网格大小
-    float gridX[GRID_SIZE][GRID_SIZE] = {0}; // X方向偏移
-    float gridY[GRID_SIZE][GRID_SIZE] = {0}; // Y方向偏移
-    float targetX[GRID_SIZE][GRID_SIZE] = {0}; // 目标X偏移
-    float targetY[GRID_SIZE][GRID_SIZE] = {0}; // 目标Y偏移
-    float springStrength = 0.2;  // 弹簧强度
-    float friction = 0.8;        // 摩擦力
-} imgAnim;
+    streamStats.received++;
+    if(streamFrame.ready) {
+        // 还没来得及显示的旧帧直接丢弃, 仍然确认以便客户端继续发送
+        streamStats.dropped++;
+        sendStreamAck(streamFrame.client, streamFrame.seq, false);
+        streamFrame.ready = false;
+    }
+    
+    size_t size = length - 4;
+    if(size > streamFrame.capacity) {
+        uint8_t* data = (uint8_t*)realloc(streamFrame.data, size);
+        if(!data) {
+            streamStats.errors++;
+            sendStreamAck(client, seq, false);
+            return;
+        }
+        streamFrame.data = data;
+        streamFrame.capacity = size;
+    }
+    memcpy(streamFrame.data, payload + 4, size);
+    streamFrame.size = size;
+    streamFrame.seq = seq;
+    streamFrame.client = client;
+    streamFrame.ready = true;
+    streamStats.lastFrame = millis();
+    
+    if(!streamActive) {
+        streamActive = true;
+        streamStats.windowStart = millis();
+        streamStats.windowFrames = 0;
+    }
+}
 
-// 在全局变量区域添加
-#define MIN_HEAP_SIZE 30000  // 最小堆内存(bytes)
-hw_timer_t *watchDog = NULL; // 看门狗定时器
-unsigned long lastHeapCheck = 0; // 上次内存检查时间
-const int HEAP_CHECK_INTERVAL = 10000; // 内存检查间隔(ms)
-int lowMemCount = 0; // 低内存计数
+// 按数据头判断帧格式
+PhotoFormat streamFrameFormat(const uint8_t* data, size_t size) {
+    if(size >= 2 && data[0] == 0xFF && data[1] == 0xD8) return PHOTO_JPEG;
+    if(size >= 4 && memcmp(data, "Q565", 4) == 0) return PHOTO_Q565;
+    if(size >= 4 && memcmp(data, "R565", 4) == 0) return PHOTO_RAW;
+    return PHOTO_NONE;
+}
 
-// 添加显示模式枚举
-enum DisplayMode {
-    CLEAR_MODE,      // 清晰显示模式
-    DYNAMIC_MODE     // 动态油画模式
-};
+// 在loop中调用: 收取积压的消息后只显示最新一帧
+void handleStream() {
+    for(int i = 0; i < STREAM_DRAIN_LIMIT; i++) {
+        uint32_t before = streamStats.received;
+        webSocket.loop();
+        if(streamStats.received == before) break;
+    }
+    
+    if(streamFrame.ready) {
+        streamFrame.ready = false;
+        PhotoFormat format = streamFrameFormat(streamFrame.data, streamFrame.size);
+        DecodeResult r = DECODE_ERROR;
+        unsigned long start = micros();
+        if(format != PHOTO_NONE) {
+            r = drawImage(format, memorySource(streamFrame.data, streamFrame.size), 0, 0, 1, streamSink);
+        }
+        streamStats.lastDecodeUs = micros() - start;
+        if(r == DECODE_OK) {
+            streamStats.frames++;
+            streamStats.windowFrames++;
+            streamStats.totalDecodeUs += streamStats.lastDecodeUs;
+        } else {
+            streamStats.errors++;
+        }
+        
+        unsigned long window = millis() - streamStats.windowStart;
+        if(window >= 1000) {
+            streamStats.fps = streamStats.windowFrames * 1000 / window;
+            streamStats.windowFrames = 0;
+            streamStats.windowStart = millis();
+        }
+        sendStreamAck(streamFrame.client, streamFrame.seq, r == DECODE_OK);
+        return;
+    }
+    
+    if(streamActive && millis() - streamStats.lastFrame > STREAM_IDLE_TIMEOUT) {
+        // 投屏结束: 释放帧缓冲, 恢复原来的画面
+        streamActive = false;
+        streamStats.fps = 0;
+        free(streamFrame.data);
+        streamFrame.data = NULL;
+        streamFrame.capacity = 0;
+        tft.fillScreen(TFT_BLACK);
+        if(hasPhoto()) drawPhoto();
+        LOG_DEBUG("投屏结束: %lu 帧, 丢弃 %lu 帧", (unsigned long)streamStats.frames,
+                  (unsigned long)streamStats.dropped);
+    }
+}
 
-// 添加全局变量
-DisplayMode currentDisplayMode = DYNAMIC_MODE;
-const char* DISPLAY_MODE_FILE = "/display_mode.txt";  // 用于保存显示模式
+// 投屏统计: /stream
+void handleStreamStats() {
+    String json = "{\"active\":" + String(streamActive ? "true" : "false");
+    json += ",\"port\":" + String(STREAM_PORT);
+    json += ",\"received\":" + String(streamStats.received);
+    json += ",\"frames\":" + String(streamStats.frames);
+    json += ",\"dropped\":" + String(streamStats.dropped);
+    json += ",\"errors\":" + String(streamStats.errors);
+    json += ",\"fps\":" + String(streamStats.fps);
+    json += ",\"avgDecodeUs\":" + String(streamStats.frames ? (uint32_t)(streamStats.totalDecodeUs / streamStats.frames) : 0) + "}";
+    server.send(200, "application/json", json);
+}
 
-// 添加保存和读取显示模式的函数
-void saveDisplayMode() {
-    File file = SPIFFS.open(DISPLAY_MODE_FILE, FILE_WRITE);
-    if(file) {
-        file.write((uint8_t)currentDisplayMode);
-        file.close();
+// 去重统计: /dedup
+void handleDedup() {
+    String json = "{\"hits\":" + String(dedupStats.hits);
+    json += ",\"bytesAvoided\":" + String((uint32_t)dedupStats.bytesAvoided);
+    json += ",\"cacheReused\":" + String(dedupStats.cacheReused);
+    json += ",\"photos\":" + String(photoCount) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 色彩设置: /color?brightness=0..100&night=0|1&warmth=0..100&gamma=5..30, 改变后重绘当前照片
+void handleColor() {
+    markActivity();
+    ColorSettings old = colorSettings;
+    if(server.hasArg("brightness")) colorSettings.brightness = constrain(server.arg("brightness").toInt(), 0, 100);
+    if(server.hasArg("night")) colorSettings.night = server.arg("night") == "1";
+    if(server.hasArg("warmth")) colorSettings.warmth = constrain(server.arg("warmth").toInt(), 0, 100);
+    if(server.hasArg("gamma")) colorSettings.gamma = constrain(server.arg("gamma").toInt(), 5, 30);
+    if(memcmp(&old, &colorSettings, sizeof(old)) != 0) {
+        colorLutDirty = true;
+        updateColorLut();
+        requestRender(RENDER_REDRAW);
+        markSettingsChanged();
     }
+    
+    String json = "{\"brightness\":" + String(colorSettings.brightness);
+    json += ",\"night\":" + String(colorSettings.night ? "true" : "false");
+    json += ",\"warmth\":" + String(colorSettings.warmth);
+    json += ",\"gamma\":" + String(colorSettings.gamma);
+    json += ",\"backlight\":" + String(backlightLevel);
+    json += ",\"identity\":" + String(colorIdentity ? "true" : "false") + "}";
+    server.send(200, "application/json", json);
 }
 
-void loadDisplayMode() {
-    if(SPIFFS.exists(DISPLAY_MODE_FILE)) {
-        File file = SPIFFS.open(DISPLAY_MODE_FILE, FILE_READ);
-        if(file) {
-            currentDisplayMode = (DisplayMode)file.read();
-            file.close();
+// 丢弃像素的输出回调, 只用于测量解码速度
+bool nullSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    return true;
+}
+
+// 解码后端列表和选择: /decoders?use=<name|auto>
+void handleDecoders() {
+    if(server.hasArg("use")) {
+        String use = server.arg("use");
+        forcedDecoder = -1;
+        for(int i = 0; i < DECODER_COUNT; i++) {
+            if(use == decoders[i].name) forcedDecoder = i;
         }
     }
+    
+    String json = "{\"forced\":\"";
+    json += forcedDecoder >= 0 ? decoders[forcedDecoder].name : "auto";
+    json += "\",\"decoders\":[";
+    for(int i = 0; i < DECODER_COUNT; i++) {
+        if(i > 0) json += ",";
+        json += "{\"name\":\"" + String(decoders[i].name) + "\"";
+        json += ",\"format\":" + String((int)decoders[i].format);
+        DecoderStats total = decoderTotals(decoders[i]);
+        json += ",\"runs\":" + String(total.runs);
+        json += ",\"errors\":" + String(decoders[i].errors);
+        json += ",\"usPerKB\":" + String(decoderCostPerKB(total));
+        // 按类别(位0缩小, 位1带DRI)的平均耗时, 自动选择依据的是这些值
+        json += ",\"classUsPerKB\":[";
+        for(int c = 0; c < DECODER_CLASSES; c++) {
+            if(c > 0) json += ",";
+            json += String(decoderCostPerKB(decoders[i].stats[c]));
+        }
+        json += "]}";
+    }
+    json += "]}";
+    server.send(200, "application/json", json);
 }
 
-// 修改JPEG解码回调函数
-bool tft_output(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap)
-{
-    if(currentDisplayMode == CLEAR_MODE) {
-        // 清晰模式直接显示
-        tft.pushImage(x, y, w, h, bitmap);
-        return true;
+// 日志统计: /log; writeUs为调用处(存参数+写入缓冲)的耗时, formatUs为日志任务中格式化的耗时, 都不含串口输出
+void handleLogStats() {
+    uint32_t lines = logRing.lines.load();
+    String json = "{\"level\":" + String(LOG_LEVEL);
+    json += ",\"lines\":" + String(lines);
+    json += ",\"dropped\":" + String(logRing.dropped.load());
+    json += ",\"suppressed\":" + String(logRing.suppressed.load());
+    json += ",\"pendingBytes\":" + String(logRing.head.load() - logRing.tail.load());
+    json += ",\"avgWriteUs\":" + String(lines ? logRing.writeUs.load() / lines : 0);
+    json += ",\"maxWriteUs\":" + String(logRing.maxWriteUs.load());
+    json += ",\"avgFormatUs\":" + String(lines ? logRing.formatUs.load() / lines : 0) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 帧耗时对比: /frame-bench 登记一次测量并返回上一次的结果, 测量由绘制队列执行
+void handleFrameBench() {
+    if(!hasPhoto() || photoStore[currentPhoto].format == PHOTO_GIF) {
+        server.send(404, "text/plain", "No photo");
+        return;
+    }
+    if(!frameBench.pending) {
+        frameBench.pending = true;
+        requestRender(RENDER_BENCH);
     }
     
-    // 动态油画模式的现有代码
-    if(ESP.getFreeHeap() < MIN_HEAP_SIZE) {
-        Serial.println("内存不足,跳过图像处理");
-        tft.pushImage(x, y, w, h, bitmap);
-        return true;
+    String json = "{\"runs\":" + String(frameBench.runs);
+    json += ",\"pending\":true";
+    if(frameBench.runs > 0) {
+        json += ",\"photo\":" + String(frameBench.photoId);
+        json += ",\"tier\":\"" + String(frameBench.psram ? "psram" : "streaming") + "\"";
+        json += ",\"mode\":\"" + String(frameBench.dynamic ? "dynamic" : "clear") + "\"";
+        json += ",\"streamUs\":" + String(frameBench.streamUs);
+        if(frameBench.frame) {
+            json += ",\"frameDecodeUs\":" + String(frameBench.frameDecodeUs);
+            json += ",\"framePresentUs\":" + String(frameBench.framePresentUs);
+            json += ",\"frameWarpUs\":" + String(frameBench.frameWarpUs);
+            json += ",\"framePushUs\":" + String(frameBench.framePushUs);
+        }
+    }
+    json += "}";
+    server.send(200, "application/json", json);
+}
+
+// 像素核心测试: /pixel-bench
+// 每个操作的每种实现先在不对齐的奇数长度上与标量参考实现比对, 再测对齐时每像素的时钟周期
+#define PIXEL_BENCH_PIXELS 2048
+#define PIXEL_BENCH_RUNS 8
+
+void handlePixelBench() {
+    const size_t bytes = PIXEL_BENCH_PIXELS * sizeof(uint16_t);
+    uint16_t* src = (uint16_t*)arenaAlloc(ARENA_RENDER, bytes);
+    uint16_t* dst = (uint16_t*)arenaAlloc(ARENA_RENDER, bytes);
+    uint16_t* ref = (uint16_t*)arenaAlloc(ARENA_RENDER, bytes);
+    int32_t* index = (int32_t*)arenaAlloc(ARENA_RENDER, PIXEL_BENCH_PIXELS * sizeof(int32_t));
+    if(!src || !dst || !ref || !index) {
+        arenaFree(ARENA_RENDER, src);
+        arenaFree(ARENA_RENDER, dst);
+        arenaFree(ARENA_RENDER, ref);
+        arenaFree(ARENA_RENDER, index);
+        server.send(503, "text/plain", "Out of memory");
+        return;
     }
+    uint32_t seed = 12345;
+    for(int i = 0; i < PIXEL_BENCH_PIXELS; i++) {
+        seed = seed * 1103515245 + 12345;
+        src[i] = seed >> 16;
+        index[i] = (seed >> 8) % PIXEL_BENCH_PIXELS;
+    }
+    const char* kernelNames[] = {"swap", "fill", "blend", "gather"};
     
-    if(!imgAnim.enabled) {
-        // 首次显示图片时初始化网格
-        static bool firstDisplay = true;
-        if(firstDisplay) {
-            firstDisplay = false;
-            // 初始化网格位置
-            for(int i = 0; i < imgAnim.GRID_SIZE; i++) {
-                for(int j = 0; j < imgAnim.GRID_SIZE; j++) {
-                    imgAnim.gridX[i][j] = 0;
-                    imgAnim.gridY[i][j] = 0;
-                    imgAnim.targetX[i][j] = 0;
-                    imgAnim.targetY[i][j] = 0;
+    String json = "{\"active\":\"" + String(pixelKernels[PIXEL_KERNELS].name) + "\"";
+    json += ",\"pixels\":" + String(PIXEL_BENCH_PIXELS) + ",\"results\":[";
+    for(int k = 0; k < 4; k++) {
+        if(k) json += ",";
+        json += "{\"kernel\":\"" + String(kernelNames[k]) + "\"";
+        bool ok = true;
+        for(int impl = 0; impl < PIXEL_KERNEL_IMPLS; impl++) {
+            const PixelKernels& kernels = pixelKernels[impl];
+            uint32_t best = UINT32_MAX;
+            for(int run = -1; run < PIXEL_BENCH_RUNS; run++) {
+                // run为-1时是校验: 从第二个像素开始, 长度为奇数
+                int offset = run < 0 ? 1 : 0;
+                uint32_t n = PIXEL_BENCH_PIXELS - offset - (run < 0 ? 2 : 0);
+                memcpy(dst, src + PIXEL_BENCH_PIXELS / 2, bytes / 2);
+                memcpy(dst + PIXEL_BENCH_PIXELS / 2, src, bytes / 2);
+                uint32_t start = ESP.getCycleCount();
+                switch(k) {
+                    case 0: kernels.swap(dst + offset, n); break;
+                    case 1: kernels.fill(dst + offset, n, 0x1234); break;
+                    case 2: kernels.blend(dst + offset, src + offset, n, 11); break;
+                    default: kernels.gather(dst + offset, src, index + offset, n); break;
+                }
+                uint32_t cycles = ESP.getCycleCount() - start;
+                if(run >= 0) {
+                    best = min(best, cycles);
+                    continue;
                 }
+                memcpy(ref, src + PIXEL_BENCH_PIXELS / 2, bytes / 2);
+                memcpy(ref + PIXEL_BENCH_PIXELS / 2, src, bytes / 2);
+                switch(k) {
+                    case 0: pxSwapScalar(ref + offset, n); break;
+                    case 1: pxFillScalar(ref + offset, n, 0x1234); break;
+                    case 2: pxBlendScalar(ref + offset, src + offset, n, 11); break;
+                    default: pxGatherScalar(ref + offset, src, index + offset, n); break;
+                }
+                if(memcmp(dst, ref, bytes) != 0) ok = false;
             }
-            imgAnim.enabled = true;
+            // 百分之一周期/像素
+            uint32_t perPixel = (uint64_t)best * 100 / PIXEL_BENCH_PIXELS;
+            json += ",\"" + String(kernels.name) + "\":" + String(perPixel / 100) + "." +
+                    (perPixel % 100 < 10 ? "0" : "") + String(perPixel % 100);
+            LOG_INFO("像素核心 %s/%s: %lu.%02lu 周期/像素", kernelNames[k], kernels.name,
+                     (unsigned long)(perPixel / 100), (unsigned long)(perPixel % 100));
         }
-        // 直接显示原图
-        tft.pushImage(x, y, w, h, bitmap);
-        return true;
+        json += ",\"ok\":" + String(ok ? "true" : "false") + "}";
     }
+    json += "]}";
+    arenaFree(ARENA_RENDER, src);
+    arenaFree(ARENA_RENDER, dst);
+    arenaFree(ARENA_RENDER, ref);
+    arenaFree(ARENA_RENDER, index);
+    server.send(200, "application/json", json);
+}
 
-    // 创建临时缓冲区
-    uint16_t* tempBitmap = new uint16_t[w * h];
-    if(!tempBitmap) return false;
-    
-    // 复制原始图像
-    memcpy(tempBitmap, bitmap, w * h * sizeof(uint16_t));
+// 客户端JPEG编码参考: 不超过上传内存缓冲(重复时零闪存写入); 4:2:0采样的MCU最少;
+// 每个MCU行一个重启标记才能用双核解码; 所有后端都不支持渐进式
+#define ENCODE_TARGET_DECODE_US 80000
+#define ENCODE_DEFAULT_US_PER_KB 2500     // 还没有JPEG解码统计时的估计值
+
+// 设置和写回统计: /settings
+void handleSettings() {
+    String json = "{\"version\":" + String(SETTINGS_VERSION);
+    for(size_t i = 0; i < SETTINGS_COUNT; i++) {
+        json += ",\"" + String(settingDefs[i].key) + "\":" + String(settingGet(settingDefs[i]));
+    }
+    json += ",\"pending\":" + String(settings.dirty ? "true" : "false");
+    json += ",\"loadUs\":" + String(settings.loadUs);
+    json += ",\"changes\":" + String(settings.changes);
+    json += ",\"flushes\":" + String(settings.flushes);
+    json += ",\"writes\":" + String(settings.writes);
+    // 每次修改平均写入的项数(百分之一)
+    json += ",\"writesPerChangeX100\":" + String(settings.changes ? settings.writes * 100 / settings.changes : 0) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 叠加层: /overlay?clock=0|1&caption=文字&time=<Unix秒>&tz=<与UTC相差的分钟>, 返回状态和统计;
+// 每次时钟变化推送的字节数对比整屏的153600字节
+void handleOverlay() {
+    if(server.hasArg("time")) {
+        struct timeval tv = {(time_t)strtoul(server.arg("time").c_str(), NULL, 10), 0};
+        settimeofday(&tv, NULL);
+    }
+    if(server.hasArg("tz")) {
+        overlaySettings.tzMinutes = constrain(server.arg("tz").toInt(), -720, 840);
+        markSettingsChanged();
+    }
+    if(server.hasArg("clock")) {
+        overlaySettings.clock = server.arg("clock").toInt() != 0;
+        markSettingsChanged();
+    }
+    if(server.hasArg("caption")) overlaySetCaption(server.arg("caption"));
+    overlay.pending = true;
+    markActivity();
     
-    // 计算网格单元大小
-    float cellWidth = (float)w / (imgAnim.GRID_SIZE - 1);
-    float cellHeight = (float)h / (imgAnim.GRID_SIZE - 1);
+    String json = "{\"clock\":" + String(overlaySettings.clock ? "true" : "false");
+    json += ",\"tz\":" + String(overlaySettings.tzMinutes);
+    json += ",\"timeSet\":" + String(time(NULL) >= 1577836800 ? "true" : "false");
+    json += ",\"caption\":\"" + jsonEscape(overlay.caption.text) + "\"";
+    json += ",\"visible\":" + String(overlayVisible() ? "true" : "false");
+    json += ",\"clockFont\":" + String(OVERLAY_CLOCK_FONT);
+    json += ",\"ticks\":" + String(overlay.ticks);
+    json += ",\"lastTickBytes\":" + String(overlay.lastTickBytes);
+    json += ",\"avgTickBytes\":" + String(overlay.ticks ? overlay.tickBytes / overlay.ticks : 0);
+    json += ",\"lastTickUs\":" + String(overlay.lastTickUs);
+    json += ",\"fullScreenBytes\":" + String(SCREEN_WIDTH * SCREEN_HEIGHT * 2);
+    json += ",\"redraws\":" + String(overlay.redraws);
+    json += ",\"opaque\":" + String(overlay.opaque);
+    json += ",\"glyphHits\":" + String(glyphCache.hits);
+    json += ",\"glyphMisses\":" + String(glyphCache.misses) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 相册: /gallery 返回照片列表和缩略图地址(列表本身不缓存), /gallery?show=<编号> 切换显示的照片;
+// 缩略图地址带CRC版本, 内容变化时地址随之改变
+void handleGallery() {
+    if(server.hasArg("show")) {
+        requestRender(RENDER_SHOW, server.arg("show").toInt());
+        markActivity();
+    }
     
-    // 更新网格变形
-    for(int i = 0; i < imgAnim.GRID_SIZE; i++) {
-        for(int j = 0; j < imgAnim.GRID_SIZE; j++) {
-            // 计算弹簧
-            float dx = imgAnim.targetX[i][j] - imgAnim.gridX[i][j];
-            float dy = imgAnim.targetY[i][j] - imgAnim.gridY[i][j];
-            
-            // 应用弹簧力和摩擦力
-            imgAnim.gridX[i][j] += dx * imgAnim.springStrength;
-            imgAnim.gridY[i][j] += dy * imgAnim.springStrength;
-            
-            // 应用摩擦力
-            imgAnim.gridX[i][j] *= imgAnim.friction;
-            imgAnim.gridY[i][j] *= imgAnim.friction;
+    String json;
+    json.reserve(photoCount * 56 + 384);
+    json = "{\"photos\":[";
+    int pending = 0, failed = 0;
+    for(int i = 0; i < photoCount; i++) {
+        const StoredPhoto& photo = photoStore[i];
+        if(i > 0) json += ",";
+        json += "{\"id\":" + String(photo.id) + ",\"format\":\"" + photoExtension(photo.format) + "\"";
+        int slot = thumbFind(photo.id);
+        if(slot >= 0) {
+            char version[9];
+            snprintf(version, sizeof(version), "%08x", (unsigned)thumbs.crcs[slot]);
+            json += ",\"thumb\":\"/thumb?id=" + String(photo.id) + "&v=" + version + "\"";
+        } else if(thumbFailed(photo)) {
+            failed++;
+        } else if(photo.format != PHOTO_GIF) {
+            pending++;
         }
+        json += "}";
+    }
+    uint32_t generated = thumbs.fromFrame + thumbs.decoded;
+    json += "],\"current\":" + String(hasPhoto() ? photoStore[currentPhoto].id : -1);
+    json += ",\"pending\":" + String(pending);
+    json += ",\"width\":" + String(THUMB_WIDTH) + ",\"height\":" + String(THUMB_HEIGHT);
+    json += ",\"fromFrame\":" + String(thumbs.fromFrame);
+    json += ",\"decoded\":" + String(thumbs.decoded);
+    json += ",\"failed\":" + String(failed);
+    json += ",\"avgGenerateUs\":" + String(generated ? thumbs.generateUs / generated : 0);
+    json += ",\"served\":" + String(thumbs.served);
+    json += ",\"notModified\":" + String(thumbs.notModified);
+    json += ",\"servedBytes\":" + String(thumbs.servedBytes);
+    json += ",\"avgServeUs\":" + String(thumbs.served ? thumbs.serveUs / thumbs.served : 0);
+    json += ",\"fileBytes\":" + String(thumbs.slots * THUMB_RECORD_SIZE) + "}";
+    server.sendHeader("Cache-Control", "no-cache");
+    server.send(200, "application/json", json);
+}
+
+// 16位BMP文件头(BI_BITFIELDS, 行从上到下), 浏览器可以直接显示565像素
+#define THUMB_BMP_HEADER_SIZE 66
+
+void thumbBmpHeader(uint8_t* h) {
+    const uint32_t fields[] = {
+        THUMB_BMP_HEADER_SIZE + THUMB_PIXELS * 2, 0, THUMB_BMP_HEADER_SIZE,    // 文件大小, 保留, 像素偏移
+        40, THUMB_WIDTH, (uint32_t)-THUMB_HEIGHT,                              // 信息头大小, 宽, 高(负数为从上到下)
+        1 | (16 << 16), 3, THUMB_PIXELS * 2, 2835, 2835, 0, 0,                 // 平面数和位深, 压缩方式, 像素字节数...
+        0xF800, 0x07E0, 0x001F                                                 // 颜色掩码
+    };
+    h[0] = 'B';
+    h[1] = 'M';
+    for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        for(int b = 0; b < 4; b++) h[2 + i * 4 + b] = fields[i] >> (b * 8);
+    }
+}
+
+// 缩略图: /thumb?id=<编号>&v=<版本>; 版本与当前内容一致时允许浏览器永久缓存
+void handleThumb() {
+    unsigned long start = micros();
+    int slot = server.hasArg("id") ? thumbFind(server.arg("id").toInt()) : -1;
+    if(slot < 0) {
+        server.send(404, "text/plain", "not found");
+        return;
+    }
+    char version[9];
+    snprintf(version, sizeof(version), "%08x", (unsigned)thumbs.crcs[slot]);
+    String etag = "\"" + String(version) + "\"";
+    server.sendHeader("ETag", etag);
+    server.sendHeader("Cache-Control", server.arg("v") == version ? "public, max-age=31536000, immutable" : "no-cache");
+    if(server.header("If-None-Match") == etag) {
+        thumbs.notModified++;
+        server.send(304);
+        return;
     }
     
-    // 应用网格变形到图像
-    for(int py = 0; py < h; py++) {
-        for(int px = 0; px < w; px++) {
-            // 找到周围的网格点
-            int gridX = px / cellWidth;
-            int gridY = py / cellHeight;
-            float fracX = (px % (int)cellWidth) / cellWidth;
-            float fracY = (py % (int)cellHeight) / cellHeight;
-            
-            // 双线性插值计算偏移
-            float offsetX = 0, offsetY = 0;
-            for(int i = 0; i < 2; i++) {
-                for(int j = 0; j < 2; j++) {
-                    float weight = (i ? fracX : (1-fracX)) * (j ? fracY : (1-fracY));
-                    offsetX += imgAnim.gridX[gridX+i][gridY+j] * weight;
-                    offsetY += imgAnim.gridY[gridX+i][gridY+j] * weight;
-                }
-            }
-            
-            // 应用偏移
-            int sourceX = px + offsetX;
-            int sourceY = py + offsetY;
-            
-            // 确保在边界
-            if(sourceX >= 0 && sourceX < w && sourceY >= 0 && sourceY < h) {
-                tempBitmap[py * w + px] = bitmap[sourceY * w + sourceX];
+    File f = PHOTO_FS.open(THUMB_FILE, FILE_READ);
+    if(!f || !f.seek(slot * THUMB_RECORD_SIZE + THUMB_HEADER_SIZE)) {
+        server.send(500, "text/plain", "read failed");
+        return;
+    }
+    uint8_t header[THUMB_BMP_HEADER_SIZE];
+    thumbBmpHeader(header);
+    server.setContentLength(THUMB_BMP_HEADER_SIZE + THUMB_PIXELS * 2);
+    server.send(200, "image/bmp", "");
+    server.sendContent((const char*)header, THUMB_BMP_HEADER_SIZE);
+    // 文件中是字节交换的565, BMP要求小端
+    uint16_t rows[THUMB_WIDTH * 16];
+    for(int16_t y = 0; y < THUMB_HEIGHT; y += 16) {
+        int16_t n = min(16, THUMB_HEIGHT - y);
+        size_t bytes = n * THUMB_WIDTH * sizeof(uint16_t);
+        if(f.read((uint8_t*)rows, bytes) != bytes) memset(rows, 0, bytes);
+        pxSwap(rows, n * THUMB_WIDTH);
+        server.sendContent((const char*)rows, bytes);
+    }
+    f.close();
+    thumbs.served++;
+    thumbs.servedBytes += THUMB_BMP_HEADER_SIZE + THUMB_PIXELS * 2;
+    thumbs.serveUs += micros() - start;
+}
+
+// 编码参数建议: /encoding-profile
+void handleEncodingProfile() {
+    uint32_t usPerKB = 0;
+    for(int i = 0; i < DECODER_COUNT; i++) {
+        DecoderStats total = decoderTotals(decoders[i]);
+        if(decoders[i].format != PHOTO_JPEG || total.runs == 0) continue;
+        uint32_t cost = decoderCostPerKB(total);
+        if(usPerKB == 0 || cost < usPerKB) usPerKB = cost;
+    }
+
+    String json = "{\"maxBytes\":" + String(UPLOAD_RAM_BUFFER);
+    json += ",\"subsampling\":\"4:2:0\"";
+    json += ",\"restartInterval\":" + String(SCREEN_WIDTH / 16);
+    json += ",\"baselineOnly\":true";
+    json += ",\"decodeUsPerKB\":" + String(usPerKB ? usPerKB : ENCODE_DEFAULT_US_PER_KB);
+    json += ",\"measured\":" + String(usPerKB ? "true" : "false");
+    json += ",\"targetDecodeUs\":" + String(ENCODE_TARGET_DECODE_US) + "}";
+    server.send(200, "application/json", json);
+}
+
+// 用当前照片依次测试每个适用的后端(输出丢弃), 结果同时计入自动选择的统计
+void handleDecoderBench() {
+    if(!hasPhoto()) {
+        server.send(404, "text/plain", "No photo");
+        return;
+    }
+    const int BENCH_RUNS = 3;
+    const StoredPhoto& photo = photoStore[currentPhoto];
+    String path = storedPhotoPath(photo.id, photo.format);
+    ImageSource src = photoSource(photo, path);
+    
+    String json = "{\"bytes\":" + String(photo.size) + ",\"results\":[";
+    bool first = true;
+    for(int i = 0; i < DECODER_COUNT; i++) {
+        ImageDecoder& d = decoders[i];
+        if(d.format != photo.format) continue;
+        
+        unsigned long best = 0;
+        DecodeResult r = DECODE_OK;
+        for(int n = 0; n < BENCH_RUNS && r == DECODE_OK; n++) {
+            timerWrite(watchDog, 0);
+            unsigned long start = micros();
+            r = d.draw(src, 0, 0, 1, nullSink);
+            unsigned long us = micros() - start;
+            if(r == DECODE_OK) {
+                d.stats[decoderClass(src, 1)].add(us, src.size);
+                if(best == 0 || us < best) best = us;
             }
         }
+        
+        if(!first) json += ",";
+        first = false;
+        json += "{\"name\":\"" + String(d.name) + "\",\"result\":" + String((int)r);
+        json += ",\"bestUs\":" + String(best) + "}";
+        LOG_INFO("解码测试 %s: %lu us", d.name, best);
     }
-    
-    // 显示处理后的图像
-    tft.pushImage(x, y, w, h, tempBitmap);
-    delete[] tempBitmap;
-    
-    return true;
+    json += "]}";
+    server.send(200, "application/json", json);
 }
 
 // 添加触发波动效果的函数
@@ -231,12 +4558,16 @@ void triggerPhotoWave(uint8_t corner = 255) {
 }
 
 void handleRoot() {
-    Serial.println("处理根路径请求");
+    markActivity();
+    LOG_INFO("处理根路径请求");
     
     // 设置HTTP响应头的Content-Type和charset
     server.sendHeader("Content-Type", "text/html; charset=utf-8");
     
-    String html = "<html><head>";
+    // 页面约35KB, 一次预留避免逐步扩容时新旧两份同时占用系统堆(MEM_HTTP_RESERVE)
+    String html;
+    html.reserve(40 * 1024);
+    html += "<html><head>";
     // 添加charset meta标签
     html += "<meta charset='utf-8'>";
     html += "<meta name='viewport' content='width=device-width, initial-scale=1'>";
@@ -278,6 +4609,12 @@ void handleRoot() {
     html += ".message.success { background: #e6f4ea; color: #1e8e3e; }";
     html += ".message.error { background: #fce8e6; color: #d93025; }";
     
+    // 相册样式
+    html += ".gallery { display: grid; grid-template-columns: repeat(auto-fill, 60px); gap: 6px; justify-content: center; margin: 10px 0; }";
+    html += ".gallery img, .gallery span { width: 60px; height: 80px; border-radius: 4px; cursor: pointer; background: #eee; }";
+    html += ".gallery span { display: flex; align-items: center; justify-content: center; color: #999; }";
+    html += ".gallery .current { outline: 2px solid #1a73e8; }";
+    
     html += "</style>";
     
     // 添加字体图标
@@ -294,12 +4631,55 @@ void handleRoot() {
     html += "<div class='mode-option'><input type='radio' id='fit' name='mode' value='fit'><label for='fit'><i class='fas fa-compress'></i> 保持比例</label></div>";
     html += "</div>";
     
+    // 传输格式选择: JPEG或无损Q565(设备端解码更快)
+    html += "<div class='mode-select'>";
+    html += "<div class='mode-option'><input type='radio' id='fmtJpeg' name='format' value='jpeg' checked><label for='fmtJpeg'><i class='fas fa-file-image'></i> JPEG</label></div>";
+    html += "<div class='mode-option'><input type='radio' id='fmtQ565' name='format' value='q565'><label for='fmtQ565'><i class='fas fa-bolt'></i> 无损快速</label></div>";
+    html += "<select id='decodeTarget' title='JPEG解码耗时目标'>";
+    html += "<option value='0' selected>设备建议</option>";
+    html += "<option value='40000'>快速 40ms</option>";
+    html += "<option value='80000'>均衡 80ms</option>";
+    html += "<option value='160000'>高画质 160ms</option>";
+    html += "</select>";
+    html += "<label title='上传2倍分辨率, 用于平移缩放'><input type='checkbox' id='hires'" + String(kenBurns.enabled ? " checked" : "") + "> 高清</label>";
+    html += "</div>";
+    
+    // 切换效果选择
+    html += "<div class='mode-select'>";
+    html += "<select id='transition' onchange=\"fetch('/transition?type=' + this.value)\">";
+    const char* transitionLabels[][2] = {{"none", "无过渡"}, {"crossfade", "淡入淡出"}, {"wipe", "擦除"}, {"slide", "推入"}};
+    for(int i = 0; i < 4; i++) {
+        html += "<option value='" + String(transitionLabels[i][0]) + "'" + (i == transitionType ? " selected" : "") + ">";
+        html += String(transitionLabels[i][1]) + "</option>";
+    }
+    html += "</select>";
+    html += "</div>";
+    
     // 在上传区域前添加模式切换按钮
     html += "<div class='mode-switch'>";
     html += "<button id='clearMode' class='mode-btn" + String(currentDisplayMode == CLEAR_MODE ? " active" : "") + 
             "' onclick='switchMode(\"clear\")'><i class='fas fa-image'></i> 清晰模式</button>";
     html += "<button id='dynamicMode' class='mode-btn" + String(currentDisplayMode == DYNAMIC_MODE ? " active" : "") + 
             "' onclick='switchMode(\"dynamic\")'><i class='fas fa-paint-brush'></i> 动态模式</button>";
+    html += "<button id='slideshowBtn' class='mode-btn" + String(slideshow.enabled ? " active" : "") + 
+            "' onclick='toggleSlideshow()'><i class='fas fa-play'></i> 幻灯片(" + String(photoCount) + ")</button>";
+    html += "<button id='kbBtn' class='mode-btn" + String(kenBurns.enabled ? " active" : "") +
+            "' onclick='toggleKenBurns()'><i class='fas fa-search-plus'></i> 平移缩放</button>";
+    html += "<button id='clockBtn' class='mode-btn" + String(overlaySettings.clock ? " active" : "") +
+            "' onclick='toggleClock()'><i class='fas fa-clock'></i> 时钟</button>";
+    html += "<button id='streamBtn' class='mode-btn' onclick='toggleStream()'><i class='fas fa-broadcast-tower'></i> 投屏</button>";
+    html += "<input type='file' accept='video/*' id='streamInput' style='display:none' onchange='startStream(this.files[0])'>";
+    html += "</div>";
+    html += "<div id='streamStatus' style='text-align:center;color:#666'></div>";
+    
+    // 亮度和夜间模式
+    html += "<div class='mode-switch'>";
+    html += "<label><i class='fas fa-sun'></i> <input type='range' min='0' max='100' value='" + String(colorSettings.brightness) + "' ";
+    html += "onchange=\"fetch('/color?brightness=' + this.value)\"></label>";
+    html += "<label><input type='checkbox'" + String(colorSettings.night ? " checked" : "") + " ";
+    html += "onchange=\"fetch('/color?night=' + (this.checked ? 1 : 0))\"> <i class='fas fa-moon'></i> 夜间</label>";
+    html += "<input type='text' id='caption' maxlength='" + String(OVERLAY_TEXT_MAX) + "' placeholder='说明文字(英文)' value='" +
+            htmlEscape(overlay.caption.text) + "' onchange=\"fetch('/overlay?caption=' + encodeURIComponent(this.value))\">";
     html += "</div>";
     
     // 添加模式切换的CSS
@@ -324,13 +4704,102 @@ void handleRoot() {
     html += "      }";
     html += "    });";
     html += "}";
+    // 设备没有时钟芯片, 每次打开页面时把浏览器的时间和时区发给它
+    html += "fetch('/overlay?time=' + Math.floor(Date.now() / 1000) + '&tz=' + (-new Date().getTimezoneOffset()));";
+    html += "function toggleClock() {";
+    html += "  const btn = document.getElementById('clockBtn');";
+    html += "  fetch('/overlay?clock=' + (btn.classList.contains('active') ? 0 : 1))";
+    html += "    .then(response => response.json())";
+    html += "    .then(s => btn.classList.toggle('active', s.clock));";
+    html += "}";
+    html += "function toggleKenBurns() {";
+    html += "  const btn = document.getElementById('kbBtn');";
+    html += "  const on = !btn.classList.contains('active');";
+    html += "  fetch('/kenburns?on=' + (on ? 1 : 0))";
+    html += "    .then(response => response.json())";
+    html += "    .then(s => {";
+    html += "      btn.classList.toggle('active', s.enabled);";
+    html += "      if (s.enabled) document.getElementById('hires').checked = true;";
+    html += "      showMessage(s.enabled ? '平移缩放已开启(需要高清上传的照片)' : '平移缩放已关闭', 'success');";
+    html += "    });";
+    html += "}";
+    html += "function toggleSlideshow() {";
+    html += "  const btn = document.getElementById('slideshowBtn');";
+    html += "  const on = !btn.classList.contains('active');";
+    html += "  fetch('/slideshow?on=' + (on ? 1 : 0))";
+    html += "    .then(response => response.json())";
+    html += "    .then(s => {";
+    html += "      btn.classList.toggle('active', s.enabled);";
+    html += "      showMessage(s.enabled ? '幻灯片已开启(' + s.photos + '张)' : '幻灯片已关闭', 'success');";
+    html += "    });";
+    html += "}";
+    // 投屏: 播放本地视频并按确认节奏推送JPEG帧, 最多2帧在途
+    // 延迟按采集画面到收到显示确认计算, 包含确认的回程
+    html += "let streamWs = null;";
+    html += "function toggleStream() {";
+    html += "  if (streamWs) { streamWs.close(); return; }";
+    html += "  const input = document.getElementById('streamInput');";
+    html += "  input.value = '';";
+    html += "  input.click();";
+    html += "}";
+    html += "function startStream(file) {";
+    html += "  if (!file) return;";
+    html += "  const btn = document.getElementById('streamBtn');";
+    html += "  const status = document.getElementById('streamStatus');";
+    html += "  const video = document.createElement('video');";
+    html += "  video.src = URL.createObjectURL(file);";
+    html += "  video.muted = true; video.loop = true; video.playsInline = true;";
+    html += "  video.play();";
+    html += "  const canvas = document.createElement('canvas');";
+    html += "  canvas.width = 240; canvas.height = 320;";
+    html += "  const ctx = canvas.getContext('2d');";
+    html += "  const ws = new WebSocket('ws://' + location.hostname + ':" + String(STREAM_PORT) + "/');";
+    html += "  ws.binaryType = 'arraybuffer';";
+    html += "  const sent = {};";
+    html += "  let seq = 0, inFlight = 0, shown = 0, latency = 0, start = 0;";
+    html += "  const send = function() {";
+    html += "    if (ws.readyState !== 1 || inFlight >= 2 || video.readyState < 2) return;";
+    html += "    ctx.drawImage(video, 0, 0, 240, 320);";
+    html += "    const id = seq++;";
+    html += "    sent[id] = performance.now();";
+    html += "    inFlight++;";
+    html += "    canvas.toBlob(blob => blob.arrayBuffer().then(buf => {";
+    html += "      const msg = new Uint8Array(buf.byteLength + 4);";
+    html += "      new DataView(msg.buffer).setUint32(0, id, true);";
+    html += "      msg.set(new Uint8Array(buf), 4);";
+    html += "      ws.send(msg);";
+    html += "    }), 'image/jpeg', 0.7);";
+    html += "  };";
+    html += "  const pump = setInterval(send, 10);";
+    html += "  ws.onopen = function() { start = performance.now(); btn.classList.add('active'); };";
+    html += "  ws.onmessage = function(e) {";
+    html += "    const ack = JSON.parse(e.data);";
+    html += "    inFlight--;";
+    html += "    if (ack.shown && sent[ack.seq] !== undefined) {";
+    html += "      const rtt = performance.now() - sent[ack.seq];";
+    html += "      latency = shown++ ? latency * 0.9 + rtt * 0.1 : rtt;";
+    html += "    }";
+    html += "    delete sent[ack.seq];";
+    html += "    const fps = shown * 1000 / (performance.now() - start);";
+    html += "    status.textContent = fps.toFixed(1) + ' fps / 延迟 ' + latency.toFixed(0) + ' ms / 解码 ' + (ack.decodeUs / 1000).toFixed(1) + ' ms';";
+    html += "    send();";
+    html += "  };";
+    html += "  ws.onclose = function() {";
+    html += "    clearInterval(pump);";
+    html += "    video.pause();";
+    html += "    URL.revokeObjectURL(video.src);";
+    html += "    btn.classList.remove('active');";
+    html += "    streamWs = null;";
+    html += "  };";
+    html += "  streamWs = ws;";
+    html += "}";
     html += "</script>";
     
     // 文件上传区域
     html += "<div class='upload-area' id='dropZone'>";
     html += "<i class='fas fa-cloud-upload-alt'></i>";
-    html += "<p>点击或拖拽图片此处上传</p>";
-    html += "<input type='file' accept='image/*,.heic' id='fileInput' style='display:none'>";
+    html += "<p>点击或拖拽图片此处上传(多选时直接批量上传)</p>";
+    html += "<input type='file' accept='image/*,.heic' id='fileInput' style='display:none' multiple>";
     html += "</div>";
     
     // 预览区域
@@ -349,6 +4818,11 @@ void handleRoot() {
     // 上传按钮
     html += "<button id='uploadBtn' class='button' style='display:none'><i class='fas fa-upload'></i> 上传到显示屏</button>";
     
+    // 相册
+    html += "<div class='mode-switch'><button id='galleryBtn' class='mode-btn' onclick='toggleGallery()'><i class='fas fa-th'></i> 相册</button></div>";
+    html += "<div id='galleryStatus' style='text-align:center;color:#666'></div>";
+    html += "<div id='gallery' class='gallery' style='display:none'></div>";
+    
     html += "</div>";
     
     // JavaScript代码
@@ -417,25 +4891,330 @@ void handleRoot() {
     // 处理拖放
     html += "function handleDrop(e) {";
     html += "  const dt = e.dataTransfer;";
+    html += "  if (dt.files.length > 1) { uploadBatch(Array.from(dt.files)); return; }";
     html += "  const file = dt.files[0];";
     html += "  handleFile(file);";
     html += "}";
     
     // 处理文件选择
     html += "function handleChange(e) {";
+    html += "  if (e.target.files.length > 1) { uploadBatch(Array.from(e.target.files)); e.target.value = ''; return; }";
     html += "  const file = e.target.files[0];";
     html += "  handleFile(file);";
     html += "}";
-    
-    // 显示消息函数
-    html += "function showMessage(text, type) {";
-    html += "  const message = document.getElementById('message');";
-    html += "  message.textContent = text;";
-    html += "  message.className = 'message ' + type;";
-    html += "  message.style.display = 'block';";
-    html += "  setTimeout(() => message.style.display = 'none', 3000);";
+    
+    // 显示消息函数
+    html += "function showMessage(text, type) {";
+    html += "  const message = document.getElementById('message');";
+    html += "  message.textContent = text;";
+    html += "  message.className = 'message ' + type;";
+    html += "  message.style.display = 'block';";
+    html += "  setTimeout(() => message.style.display = 'none', 3000);";
+    html += "}";
+    
+    // Q565编码: RGB565 + QOI风格压缩, 格式与设备端Q565Decoder一致
+    html += "function encodeQ565(ctx, w, h, x, y) {";
+    html += "  const d = ctx.getImageData(x || 0, y || 0, w, h).data;";
+    html += "  const out = new Uint8Array(8 + w * h * 3);";
+    html += "  out.set([81, 53, 54, 53, w & 255, w >> 8, h & 255, h >> 8]);";
+    html += "  const index = new Uint16Array(64);";
+    html += "  let p = 8, prev = 0, run = 0;";
+    html += "  for (let i = 0; i < d.length; i += 4) {";
+    html += "    const r = d[i] >> 3, g = d[i + 1] >> 2, b = d[i + 2] >> 3;";
+    html += "    const px = (r << 11) | (g << 5) | b;";
+    html += "    if (px === prev) {";
+    html += "      if (++run === 62) { out[p++] = 0xC0 | (run - 1); run = 0; }";
+    html += "      continue;";
+    html += "    }";
+    html += "    if (run > 0) { out[p++] = 0xC0 | (run - 1); run = 0; }";
+    html += "    const hash = (r * 3 + g * 5 + b * 7) & 63;";
+    html += "    if (index[hash] === px) {";
+    html += "      out[p++] = hash;";
+    html += "    } else {";
+    html += "      index[hash] = px;";
+    html += "      const pr = prev >> 11, pg = (prev >> 5) & 63, pb = prev & 31;";
+    html += "      const dr = ((r - pr + 16) & 31) - 16, dg = ((g - pg + 32) & 63) - 32, db = ((b - pb + 16) & 31) - 16;";
+    html += "      const drg = dr - (dg >> 1), dbg = db - (dg >> 1);";
+    html += "      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {";
+    html += "        out[p++] = 0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);";
+    html += "      } else if (drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {";
+    html += "        out[p++] = 0x80 | (dg + 32);";
+    html += "        out[p++] = ((drg + 8) << 4) | (dbg + 8);";
+    html += "      } else {";
+    html += "        out[p++] = 0xFE; out[p++] = px >> 8; out[p++] = px & 255;";
+    html += "      }";
+    html += "    }";
+    html += "    prev = px;";
+    html += "  }";
+    html += "  if (run > 0) out[p++] = 0xC0 | (run - 1);";
+    html += "  return new Blob([out.subarray(0, p)], { type: 'image/x-q565' });";
+    html += "}";
+    
+    // 增量更新: 按16x16网格比较上次上传的画面, 同一行相邻的变化格合并成一块
+    html += "let lastFrame = null, lastPhotoId = null;";
+    html += "function diffTiles(ctx) {";
+    html += "  const cur = ctx.getImageData(0, 0, 240, 320).data, old = lastFrame.data;";
+    html += "  const tiles = [];";
+    html += "  let area = 0;";
+    html += "  for (let ty = 0; ty < 320; ty += 16) {";
+    html += "    let start = -1;";
+    html += "    for (let tx = 0; tx <= 240; tx += 16) {";
+    html += "      let dirty = false;";
+    html += "      for (let y = ty; tx < 240 && y < ty + 16 && !dirty; y++) {";
+    html += "        for (let i = (y * 240 + tx) * 4, e = i + 64; i < e; i += 4) {";
+    html += "          if ((cur[i] ^ old[i]) & 0xF8 || (cur[i + 1] ^ old[i + 1]) & 0xFC || (cur[i + 2] ^ old[i + 2]) & 0xF8) { dirty = true; break; }";
+    html += "        }";
+    html += "      }";
+    html += "      if (dirty && start < 0) start = tx;";
+    html += "      if (!dirty && start >= 0) {";
+    html += "        tiles.push({ x: start, y: ty, w: tx - start, h: 16 });";
+    html += "        area += (tx - start) * 16;";
+    html += "        start = -1;";
+    html += "      }";
+    html += "    }";
+    html += "  }";
+    html += "  tiles.area = area;";
+    html += "  return tiles;";
+    html += "}";
+    html += "function buildTiles(ctx, tiles) {";
+    html += "  const parts = [];";
+    html += "  for (const t of tiles) {";
+    html += "    const blob = encodeQ565(ctx, t.w, t.h, t.x, t.y);";
+    html += "    const hdr = new DataView(new ArrayBuffer(8));";
+    html += "    hdr.setUint16(0, t.x, true);";
+    html += "    hdr.setUint16(2, t.y, true);";
+    html += "    hdr.setUint32(4, blob.size, true);";
+    html += "    parts.push(hdr.buffer, blob);";
+    html += "  }";
+    html += "  return new Blob(parts);";
+    html += "}";
+    
+    // 分块续传: 16KB一块带CRC32, 两个连接并行发送; 失败后按设备端记录只重传缺少的块
+    html += "function crc32(buf) {";
+    html += "  let t = crc32.table;";
+    html += "  if (!t) {";
+    html += "    t = crc32.table = new Uint32Array(256);";
+    html += "    for (let i = 0; i < 256; i++) {";
+    html += "      let c = i;";
+    html += "      for (let k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >>> 1) : c >>> 1;";
+    html += "      t[i] = c;";
+    html += "    }";
+    html += "  }";
+    html += "  let c = 0xFFFFFFFF;";
+    html += "  for (let i = 0; i < buf.length; i++) c = t[(c ^ buf[i]) & 255] ^ (c >>> 8);";
+    html += "  return (c ^ 0xFFFFFFFF) >>> 0;";
+    html += "}";
+    // 设备正忙(503)时按Retry-After等待后重发, 不算作失败
+    html += "function waitRetryAfter(r) {";
+    html += "  return new Promise(res => setTimeout(res, (+r.headers.get('Retry-After') || 1) * 1000));";
+    html += "}";
+    html += "async function uploadChunked(blob, filename, onProgress) {";
+    html += "  const CHUNK = " + String(UPLOAD_CHUNK_SIZE) + ", total = blob.size, count = Math.ceil(total / CHUNK);";
+    html += "  const key = (Math.random() * 0x100000000 >>> 0).toString(16);";
+    html += "  const done = new Array(count).fill(false);";
+    html += "  let photoId = null;";
+    html += "  const sendChunk = async function(i) {";
+    html += "    const start = i * CHUNK, part = blob.slice(start, Math.min(total, start + CHUNK));";
+    html += "    const bytes = new Uint8Array(await part.arrayBuffer());";
+    html += "    const form = new FormData();";
+    html += "    form.append('chunk', part, filename);";
+    html += "    const send = () => fetch('/upload-chunk?id=' + key + '&name=' + encodeURIComponent(filename), {";
+    html += "      method: 'POST', body: form, headers: {";
+    html += "        'Content-Range': 'bytes ' + start + '-' + (start + bytes.length - 1) + '/' + total,";
+    html += "        'X-Chunk-Crc32': crc32(bytes).toString(16) } });";
+    html += "    let r = await send();";
+    html += "    for (let wait = 0; r.status === 503 && wait < 60; wait++) {";
+    html += "      await waitRetryAfter(r);";
+    html += "      r = await send();";
+    html += "    }";
+    html += "    if (!r.ok) throw new Error(r.status);";
+    html += "    const s = await r.json();";
+    html += "    done[i] = true;";
+    html += "    if (s.complete) photoId = s.id;";
+    html += "  };";
+    html += "  for (let round = 0; round < 5 && photoId === null; round++) {";
+    html += "    if (round > 0) {";
+    html += "      await new Promise(r => setTimeout(r, 500 * round));";
+    html += "      try {";
+    html += "        const st = await (await fetch('/upload-status?id=' + key)).json();";
+    html += "        if (st.complete) { photoId = st.id; break; }";
+    html += "        done.fill(false);";
+    html += "        for (const [a, b] of st.ranges) for (let i = a / CHUNK; i <= Math.floor(b / CHUNK); i++) done[i] = true;";
+    html += "      } catch (e) {}";
+    html += "    }";
+    html += "    const queue = done.map((d, i) => d ? -1 : i).filter(i => i >= 0);";
+    html += "    const worker = async function() {";
+    html += "      while (queue.length) {";
+    html += "        const i = queue.shift();";
+    html += "        try { await sendChunk(i); } catch (e) {}";
+    html += "        onProgress(done.filter(d => d).length / count);";
+    html += "      }";
+    html += "    };";
+    html += "    await Promise.all([worker(), worker()]);";
+    html += "  }";
+    html += "  if (photoId === null) throw new Error('upload failed');";
+    html += "  return photoId;";
+    html += "}";
+
+    // JPEG质量: 按设备给出的每KB解码耗时换算字节预算, 二分查找不超过预算的最高质量
+    html += "function loadEncodingTarget() {";
+    html += "  const target = +document.getElementById('decodeTarget').value;";
+    html += "  return fetch('/encoding-profile').then(r => r.json()).then(p => {";
+    html += "    if (target) p.targetDecodeUs = target;";
+    html += "    return p;";
+    html += "  }).catch(() => null);";
+    html += "}";
+    // 2倍图像素是4倍, 预算同比放大(显示时通常命中解码缓存)
+    html += "function hiresProfile(p) {";
+    html += "  return p && Object.assign({}, p, { maxBytes: p.maxBytes * 4, targetDecodeUs: p.targetDecodeUs * 4 });";
+    html += "}";
+    html += "function encodeJpeg(canvas, profile) {";
+    html += "  const enc = q => canvas.convertToBlob ? canvas.convertToBlob({ type: 'image/jpeg', quality: q }) :";
+    html += "    new Promise(r => canvas.toBlob(r, 'image/jpeg', q));";
+    html += "  const budget = profile ? Math.min(profile.maxBytes, profile.targetDecodeUs * 1024 / profile.decodeUsPerKB) : Infinity;";
+    html += "  const t0 = performance.now();";
+    html += "  const result = (blob, q) => ({ blob, quality: q, encodeMs: Math.round(performance.now() - t0),";
+    html += "    decodeUs: profile ? Math.round(blob.size / 1024 * profile.decodeUsPerKB) : 0 });";
+    html += "  return enc(0.95).then(async top => {";
+    html += "    if (top.size <= budget) return result(top, 0.95);";
+    html += "    let lo = 0.3, hi = 0.95, best = await enc(lo), bestQ = lo;";
+    html += "    for (let i = 0; i < 6; i++) {";
+    html += "      const q = (lo + hi) / 2, b = await enc(q);";
+    html += "      if (b.size <= budget) { lo = q; best = b; bestQ = q; } else { hi = q; }";
+    html += "    }";
+    html += "    return result(best, bestQ);";
+    html += "  });";
+    html += "}";
+
+    // 批量上传: 多个Worker用OffscreenCanvas并行缩放和编码, 编码好的照片按顺序分组,
+    // 每组用一个multipart请求上传; 上传一组的同时后面的照片继续编码
+    // k为相对屏幕的倍数, 高清上传为2
+    html += "function preparePhoto(blob, mode, format, profile, k) {";
+    html += "  const W = 240 * (k || 1), H = 320 * (k || 1);";
+    html += "  return createImageBitmap(blob).then(bmp => {";
+    html += "    const canvas = typeof OffscreenCanvas !== 'undefined' ? new OffscreenCanvas(W, H) :";
+    html += "      Object.assign(document.createElement('canvas'), { width: W, height: H });";
+    html += "    const ctx = canvas.getContext('2d');";
+    html += "    if (mode === 'stretch') {";
+    html += "      ctx.drawImage(bmp, 0, 0, W, H);";
+    html += "    } else {";
+    html += "      const scale = Math.min(W / bmp.width, H / bmp.height);";
+    html += "      const w = bmp.width * scale, h = bmp.height * scale;";
+    html += "      ctx.fillStyle = 'black';";
+    html += "      ctx.fillRect(0, 0, W, H);";
+    html += "      ctx.drawImage(bmp, (W - w) / 2, (H - h) / 2, w, h);";
+    html += "    }";
+    html += "    bmp.close();";
+    html += "    if (format === 'q565') return { blob: encodeQ565(ctx, W, H), name: 'photo.q565' };";
+    html += "    return encodeJpeg(canvas, profile).then(r => ({ blob: r.blob, name: 'photo.jpg' }));";
+    html += "  });";
+    html += "}";
+    // 不支持Worker里的OffscreenCanvas时退回主线程
+    html += "function createPhotoPool() {";
+    html += "  if (typeof Worker === 'undefined' || typeof OffscreenCanvas === 'undefined') {";
+    html += "    return { run: preparePhoto, close: () => {} };";
+    html += "  }";
+    html += "  const src = encodeQ565.toString() + encodeJpeg.toString() + preparePhoto.toString() +";
+    html += "    'onmessage = e => preparePhoto(e.data.blob, e.data.mode, e.data.format, e.data.profile, e.data.k)' +";
+    html += "    '.then(r => postMessage(r), err => postMessage({ error: String(err) }));';";
+    html += "  const url = URL.createObjectURL(new Blob([src], { type: 'text/javascript' }));";
+    html += "  const idle = [], waiting = [];";
+    html += "  for (let i = Math.min(navigator.hardwareConcurrency || 2, 4); i > 0; i--) idle.push(new Worker(url));";
+    html += "  const run = function(blob, mode, format, profile, k) {";
+    html += "    return new Promise((resolve, reject) => {";
+    html += "      const start = function(w) {";
+    html += "        w.onmessage = w.onerror = function(e) {";
+    html += "          const next = waiting.shift();";
+    html += "          if (next) next(w); else idle.push(w);";
+    html += "          if (e.data && !e.data.error) resolve(e.data); else reject(e.data ? e.data.error : e.message);";
+    html += "        };";
+    html += "        w.postMessage({ blob, mode, format, profile, k });";
+    html += "      };";
+    html += "      const w = idle.pop();";
+    html += "      if (w) start(w); else waiting.push(start);";
+    html += "    });";
+    html += "  };";
+    html += "  return { run, close: () => { idle.forEach(w => w.terminate()); URL.revokeObjectURL(url); } };";
+    html += "}";
+    html += "async function uploadBatch(files) {";
+    html += "  const t0 = performance.now();";
+    html += "  const mode = document.querySelector('input[name=\"mode\"]:checked').value;";
+    html += "  const format = document.querySelector('input[name=\"format\"]:checked').value;";
+    html += "  const uploadBtn = document.getElementById('uploadBtn');";
+    html += "  const progressBar = document.getElementById('progressBar');";
+    html += "  const progressBarFill = document.getElementById('progressBarFill');";
+    html += "  uploadBtn.classList.add('disabled');";
+    html += "  uploadBtn.disabled = true;";
+    html += "  progressBar.style.display = 'block';";
+    html += "  showMessage('正在处理 ' + files.length + ' 张照片...', 'info');";
+    html += "  const k = document.getElementById('hires').checked ? 2 : 1;";
+    html += "  let profile = format === 'jpeg' ? await loadEncodingTarget() : null;";
+    html += "  if (k === 2) profile = hiresProfile(profile);";
+    html += "  const pool = createPhotoPool();";
+    // heic2any需要DOM, 只能在主线程依次转换
+    html += "  let heic = Promise.resolve();";
+    html += "  const ready = new Array(files.length).fill(false);";
+    html += "  const jobs = files.map((file, i) => {";
+    html += "    let job;";
+    html += "    if (file.type === 'image/gif') {";
+    html += "      job = Promise.resolve({ blob: file, name: 'photo.gif' });";
+    html += "    } else {";
+    html += "      let src = Promise.resolve(file);";
+    html += "      if (file.type === 'image/heic' || file.name.toLowerCase().endsWith('.heic')) {";
+    html += "        src = heic = heic.catch(() => {}).then(() => heic2any({ blob: file, toType: 'image/jpeg' }))";
+    html += "          .then(b => Array.isArray(b) ? b[0] : b);";
+    html += "      }";
+    html += "      job = src.then(b => pool.run(b, mode, format, profile, k));";
+    html += "    }";
+    html += "    job = job.catch(() => null);";
+    html += "    job.then(() => ready[i] = true);";
+    html += "    return job;";
+    html += "  });";
+    html += "  let next = 0, done = 0, stored = 0, duplicates = 0, failed = 0, lastId = null;";
+    html += "  while (next < jobs.length) {";
+    // 等待下一张, 再带上已经编码好的照片, 每组最多8张
+    html += "    const group = [];";
+    html += "    do { group.push(await jobs[next++]); } while (next < jobs.length && group.length < 8 && ready[next]);";
+    html += "    const items = group.filter(g => g);";
+    html += "    failed += group.length - items.length;";
+    html += "    if (items.length) {";
+    html += "      const form = new FormData();";
+    html += "      items.forEach(it => form.append('photo', it.blob, it.name));";
+    // 设备端按内容去重, 重发已存下的照片不会产生副本
+    html += "      let result = null;";
+    html += "      for (let attempt = 0, wait = 0; attempt < 3 && !result; attempt++) {";
+    html += "        try {";
+    html += "          const r = await fetch('/upload', { method: 'POST', body: form });";
+    html += "          if (r.status === 503 && wait++ < 60) { await waitRetryAfter(r); attempt--; continue; }";
+    html += "          result = await r.json();";
+    html += "        } catch (e) {}";
+    html += "      }";
+    html += "      if (result) {";
+    html += "        stored += result.stored;";
+    html += "        duplicates += result.duplicates;";
+    html += "        failed += result.failed;";
+    html += "        const ids = result.ids.filter(id => id >= 0);";
+    html += "        if (ids.length) lastId = ids[ids.length - 1];";
+    html += "      } else {";
+    html += "        failed += items.length;";
+    html += "      }";
+    html += "    }";
+    html += "    done += group.length;";
+    html += "    progressBarFill.style.width = (done / jobs.length * 100) + '%';";
+    html += "  }";
+    html += "  pool.close();";
+    html += "  const secs = ((performance.now() - t0) / 1000).toFixed(1);";
+    html += "  const rate = (files.length / Math.max(secs, 0.1)).toFixed(1);";
+    html += "  showMessage('批量上传 ' + files.length + ' 张: 新增 ' + stored + ', 重复 ' + duplicates +";
+    html += "    ', 失败 ' + failed + ', 用时 ' + secs + ' 秒 (' + rate + ' 张/秒)', failed ? 'error' : 'success');";
+    html += "  lastFrame = null;";
+    html += "  if (lastId !== null) lastPhotoId = lastId;";
+    html += "  progressBar.style.display = 'none';";
+    html += "  progressBarFill.style.width = '0%';";
+    html += "  uploadBtn.classList.remove('disabled');";
+    html += "  uploadBtn.disabled = false;";
     html += "}";
-    
+
     // 处理上传
     html += "function processAndUpload() {";
     html += "  if (!currentFile) return;";
@@ -470,45 +5249,111 @@ void handleRoot() {
     html += "    const progressBarFill = document.getElementById('progressBarFill');";
     html += "    progressBar.style.display = 'block';";
     
-    html += "    canvas.toBlob(function(blob) {";
-    html += "      const formData = new FormData();";
-    html += "      formData.append('photo', blob, 'photo.jpg');";
-    
-    html += "      const xhr = new XMLHttpRequest();";
-    html += "      xhr.upload.onprogress = function(e) {";
-    html += "        if (e.lengthComputable) {";
-    html += "          const percentComplete = (e.loaded / e.total) * 100;";
-    html += "          progressBarFill.style.width = percentComplete + '%';";
-    html += "        }";
-    html += "      };";
+    html += "    const hires = document.getElementById('hires').checked;";
+    html += "    const sendBlob = function(blob, filename, info) {";
+    html += "      uploadChunked(blob, filename, p => progressBarFill.style.width = (p * 100) + '%')";
+    html += "        .then(id => {";
+    html += "          showMessage('上传成功！' + (info || ''), 'success');";
+    html += "          lastFrame = filename.endsWith('.gif') || hires ? null : ctx.getImageData(0, 0, 240, 320);";
+    html += "          lastPhotoId = id;";
+    html += "        })";
+    html += "        .catch(() => showMessage('上传失败，请重试', 'error'))";
+    html += "        .finally(() => {";
+    html += "          progressBar.style.display = 'none';";
+    html += "          progressBarFill.style.width = '0%';";
+    html += "          uploadBtn.classList.remove('disabled');";
+    html += "          uploadBtn.disabled = false;";
+    html += "        });";
+    html += "    };";
+
+    html += "    const sendFull = function() {";
+    html += "      const format = document.querySelector('input[name=\"format\"]:checked').value;";
+    // 高清照片从原图重新缩放到2倍尺寸, 不做增量更新(会退化成普通分辨率)
+    html += "      if (hires) {";
+    html += "        loadEncodingTarget()";
+    html += "          .then(p => preparePhoto(currentFile, mode, format, format === 'jpeg' ? hiresProfile(p) : null, 2))";
+    html += "          .then(r => sendBlob(r.blob, r.name, ' 高清 ' + (r.blob.size / 1024).toFixed(1) + 'KB'));";
+    html += "        return;";
+    html += "      }";
+    html += "      if (format === 'q565') {";
+    html += "        sendBlob(encodeQ565(ctx, 240, 320), 'photo.q565');";
+    html += "      } else {";
+    html += "        loadEncodingTarget().then(profile => encodeJpeg(canvas, profile)).then(r => {";
+    html += "          sendBlob(r.blob, 'photo.jpg', ' ' + (r.blob.size / 1024).toFixed(1) + 'KB, 质量 ' + Math.round(r.quality * 100) +";
+    html += "            ', 编码 ' + r.encodeMs + 'ms' + (r.decodeUs ? ', 预计解码 ' + (r.decodeUs / 1000).toFixed(0) + 'ms' : ''));";
+    html += "        });";
+    html += "      }";
+    html += "    };";
     
-    html += "      xhr.onload = function() {";
-    html += "        if (xhr.status === 200) {";
-    html += "          showMessage('上传成功！', 'success');";
-    html += "        } else {";
-    html += "          showMessage('上传失败，请重试', 'error');";
-    html += "        }";
-    html += "        progressBar.style.display = 'none';";
-    html += "        progressBarFill.style.width = '0%';";
-    html += "        uploadBtn.classList.remove('disabled');";
-    html += "        uploadBtn.disabled = false;";
-    html += "      };";
+    // GIF原样上传, 由设备端播放动画
+    html += "    if (currentFile.type === 'image/gif') {";
+    html += "      lastFrame = null;";
+    html += "      sendBlob(currentFile, 'photo.gif');";
+    html += "      return;";
+    html += "    }";
     
-    html += "      xhr.onerror = function() {";
-    html += "        showMessage('上传出错，请检查连接', 'error');";
+    // 变化区域不到一半时只上传变化的块, 失败(例如屏幕已切换照片)时退回完整上传
+    html += "    const tiles = lastFrame ? diffTiles(ctx) : null;";
+    html += "    if (!tiles || hires || tiles.area * 2 > 240 * 320) { sendFull(); return; }";
+    html += "    if (tiles.length === 0) {";
+    html += "      showMessage('画面没有变化', 'success');";
+    html += "      progressBar.style.display = 'none';";
+    html += "      uploadBtn.classList.remove('disabled');";
+    html += "      uploadBtn.disabled = false;";
+    html += "      return;";
+    html += "    }";
+    html += "    const formData = new FormData();";
+    html += "    const body = buildTiles(ctx, tiles);";
+    html += "    formData.append('tiles', body, 'tiles.bin');";
+    html += "    fetch('/tiles?base=' + lastPhotoId, { method: 'POST', body: formData })";
+    html += "      .then(r => r.ok ? r.json() : Promise.reject(r.status))";
+    html += "      .then(s => {";
+    html += "        lastFrame = ctx.getImageData(0, 0, 240, 320);";
+    html += "        showMessage('增量更新: ' + s.tiles + '块, ' + (body.size / 1024).toFixed(1) + 'KB, 重绘 ' + (s.redrawUs / 1000).toFixed(1) + 'ms', 'success');";
     html += "        progressBar.style.display = 'none';";
-    html += "        progressBarFill.style.width = '0%';";
     html += "        uploadBtn.classList.remove('disabled');";
     html += "        uploadBtn.disabled = false;";
-    html += "      };";
-    
-    html += "      xhr.open('POST', '/upload', true);";
-    html += "      xhr.send(formData);";
-    html += "    }, 'image/jpeg', 0.95);";
+    html += "      })";
+    html += "      .catch(() => { lastFrame = null; sendFull(); });";
     html += "  };";
     html += "  tempImg.src = img.src;";
     html += "}";
     
+    // 相册: 统计从请求列表到所有缩略图加载完的时间, 以及其中命中浏览器缓存的数量
+    html += "function loadGallery() {";
+    html += "  const t0 = performance.now();";
+    html += "  const grid = document.getElementById('gallery');";
+    html += "  return fetch('/gallery').then(r => r.json()).then(g => {";
+    html += "    grid.innerHTML = '';";
+    html += "    const loads = g.photos.map(p => {";
+    html += "      const el = document.createElement(p.thumb ? 'img' : 'span');";
+    html += "      el.title = p.id + '.' + p.format;";
+    html += "      if (p.id === g.current) el.className = 'current';";
+    html += "      el.onclick = () => fetch('/gallery?show=' + p.id).then(() => {";
+    html += "        grid.querySelectorAll('.current').forEach(e => e.className = '');";
+    html += "        el.className = 'current';";
+    html += "      });";
+    html += "      grid.appendChild(el);";
+    html += "      if (!p.thumb) { el.textContent = p.format; return null; }";
+    html += "      return new Promise(r => { el.onload = el.onerror = r; el.src = p.thumb; });";
+    html += "    });";
+    html += "    return Promise.all(loads).then(() => {";
+    html += "      const ms = Math.round(performance.now() - t0);";
+    html += "      const cached = performance.getEntriesByType('resource')";
+    html += "        .filter(e => e.name.includes('/thumb?') && e.startTime >= t0 && e.transferSize === 0).length;";
+    html += "      document.getElementById('galleryStatus').textContent = g.photos.length + ' 张, 加载 ' + ms + ' ms(缓存 ' + cached + ')' +";
+    html += "        (g.pending ? ', ' + g.pending + ' 张缩略图生成中' : '') + (g.failed ? ', ' + g.failed + ' 张无法生成' : '');";
+    html += "      if (g.pending && document.getElementById('galleryBtn').classList.contains('active')) setTimeout(loadGallery, 3000);";
+    html += "    });";
+    html += "  });";
+    html += "}";
+    html += "function toggleGallery() {";
+    html += "  const on = document.getElementById('galleryBtn').classList.toggle('active');";
+    html += "  document.getElementById('gallery').style.display = on ? '' : 'none';";
+    html += "  document.getElementById('galleryStatus').textContent = '';";
+    html += "  if (on) loadGallery();";
+    html += "}";
+    
     html += "document.getElementById('uploadBtn').onclick = processAndUpload;";
     html += "</script>";
     
@@ -516,9 +5361,168 @@ void handleRoot() {
     server.send(200, "text/html; charset=utf-8", html);
 }
 
+// 分块上传的会话表和准入(lib/upload_sessions), 块文件在闪存的UPLOAD_DIR中
+struct FlashChunkStore {
+    File file;
+
+    bool open(const char* path) {
+        file = PHOTO_FS.open(path, FILE_READ);
+        return file;
+    }
+
+    size_t read(uint8_t* buf, size_t n) {
+        return file.read(buf, n);
+    }
+
+    void close() {
+        if(file) file.close();
+    }
+
+    void remove(const char* path) {
+        PHOTO_FS.remove(path);
+    }
+
+    void rename(const char* from, const char* to) {
+        PHOTO_FS.rename(from, to);
+    }
+} uploadStore;
+
+UploadTable<UPLOAD_MAX_SESSIONS> uploads;
+
+void recordUploadWrite(size_t bytes, unsigned long us) {
+    uploads.admission.recordWrite(bytes, us);
+}
+
+UploadSession* findUploadSession(const String& key) {
+    return uploads.find(key.c_str());
+}
+
+int uploadWriters() {
+    return uploads.writers(millis());
+}
+
+bool admitUploadWriter() {
+    return uploads.admit(millis());
+}
+
+uint32_t uploadRetryAfter() {
+    return uploads.retryAfter(millis());
+}
+
+String uploadChunkPath(const UploadSession& session, uint16_t index, bool temp) {
+    char path[UPLOAD_PATH_MAX];
+    session.chunkPath(path, index, temp);
+    return path;
+}
+
+// 上传先缓存在内存中并同时计算哈希, 结束时发现是重复内容就不写闪存;
+// 超过内存缓冲(UPLOAD_RAM_BUFFER)的大文件转为直接写文件, 重复时再删除.
+// 正在接收的文件的全部状态都在上传上下文中, 不留在处理函数的静态变量里
+struct UploadContext {
+    bool rejected;              // 请求未通过准入, 数据全部丢弃, 应答503
+    File file;
+    PhotoFormat format;
+    uint16_t id;
+    uint8_t* buffer;
+    size_t buffered;
+    bool failed;
+    Sha256 sha;
+
+    void begin(PhotoFormat f) {
+        format = f;
+        sha.begin();
+        arenaFree(ARENA_UPLOAD, buffer);
+        buffer = (uint8_t*)arenaAlloc(ARENA_UPLOAD, UPLOAD_RAM_BUFFER);
+        buffered = 0;
+        failed = false;
+    }
+
+    // 分配照片编号并创建文件, 把内存中已缓存的部分写进去
+    void spill() {
+        ensureStoreSpace(0);
+        id = nextPhotoId++;
+        file = PHOTO_FS.open(storedPhotoPath(id, format), FILE_WRITE);
+        failed = !file || (buffered > 0 && file.write(buffer, buffered) != buffered);
+        arenaFree(ARENA_UPLOAD, buffer);
+        buffer = NULL;
+    }
+
+    // 删除不完整或重复的文件
+    void discard() {
+        if(file) {
+            file.close();
+            PHOTO_FS.remove(storedPhotoPath(id, format));
+        }
+        arenaFree(ARENA_UPLOAD, buffer);
+        buffer = NULL;
+    }
+} uploadContext;
+
+// 一次/upload请求可以带多个文件(multipart的每个文件部分都会单独回调handleFileUpload),
+// 每个文件处理完只记录结果, 整个请求结束后由handleUpload统一应答并显示最后一张
+struct UploadBatch {
+    uint16_t stored;
+    uint16_t duplicates;
+    uint16_t failed;
+    int32_t lastId;             // 最后一张成功的照片编号, -1为没有
+    String ids;                 // 每个文件对应的照片编号, 逗号分隔, 失败为-1
+    unsigned long startMs;
+} uploadBatch = {0, 0, 0, -1, "", 0};
+
+void resetUploadBatch() {
+    uploadBatch.stored = 0;
+    uploadBatch.duplicates = 0;
+    uploadBatch.failed = 0;
+    uploadBatch.lastId = -1;
+    uploadBatch.ids = "";
+    uploadBatch.startMs = 0;
+}
+
+void recordUploadResult(int32_t id, bool duplicate) {
+    if(uploadBatch.ids.length() > 0) uploadBatch.ids += ",";
+    uploadBatch.ids += String(id);
+    if(id < 0) {
+        uploadBatch.failed++;
+        return;
+    }
+    if(duplicate) uploadBatch.duplicates++;
+    else uploadBatch.stored++;
+    uploadBatch.lastId = id;
+}
+
 void handleUpload() {
-    Serial.println("处理上传请求");
-    server.send(200, "text/plain", "");
+    if(uploadContext.rejected) {
+        uploadContext.rejected = false;
+        resetUploadBatch();
+        server.sendHeader("Retry-After", String(uploadRetryAfter()));
+        server.send(503, "application/json", "{\"error\":\"busy\"}");
+        return;
+    }
+    LOG_INFO("处理上传请求: 新增 %d, 重复 %d, 失败 %d",
+             uploadBatch.stored, uploadBatch.duplicates, uploadBatch.failed);
+    int index = findPhotoById(uploadBatch.lastId);
+    if(index >= 0) {
+        // 初始化波动动画参数
+        imgAnim.wave = 0;
+        imgAnim.waveStrength = 0;
+        imgAnim.waveSpeed = 0;
+        imgAnim.lastWave = millis();
+        imgAnim.waveInterval = random(3000, 8000);
+        imgAnim.inWave = false;
+        imgAnim.enabled = true;
+
+        // 显示照片; 重复上传且正在显示时不重绘
+        requestRender(RENDER_SHOW, photoStore[index].id);
+        server.sendHeader("X-Photo-Id", String(photoStore[index].id));
+    }
+
+    String json = "{\"stored\":" + String(uploadBatch.stored);
+    json += ",\"duplicates\":" + String(uploadBatch.duplicates);
+    json += ",\"failed\":" + String(uploadBatch.failed);
+    json += ",\"ids\":[" + uploadBatch.ids + "]";
+    json += ",\"ms\":" + String(uploadBatch.startMs ? millis() - uploadBatch.startMs : 0) + "}";
+    server.send(index >= 0 ? 200 : 500, "application/json", json);
+    resetUploadBatch();
 }
 
 // 修改计算缩放比例的函数
@@ -578,14 +5582,10 @@ void drawCameraIcon(float x, float y, int size, uint16_t color, bool flash) {
     
     size *= scale;
     
-    // 绘制轨迹
+    // 绘制轨迹(越旧越暗, 与黑色混合)
     for(int i = 0; i < TRAIL_LENGTH - 1; i++) {
         if(trailPoints[i].color != 0) {
-            uint16_t trailColor = tft.color565(
-                (trailPoints[i].color >> 11) * (TRAIL_LENGTH - i) / TRAIL_LENGTH,
-                ((trailPoints[i].color >> 5) & 0x3F) * (TRAIL_LENGTH - i) / TRAIL_LENGTH,
-                (trailPoints[i].color & 0x1F) * (TRAIL_LENGTH - i) / TRAIL_LENGTH
-            );
+            uint16_t trailColor = blend565(trailPoints[i].color, TFT_BLACK, (TRAIL_LENGTH - i) * 32 / TRAIL_LENGTH);
             tft.drawPixel(trailPoints[i].x, trailPoints[i].y, trailColor);
         }
     }
@@ -598,12 +5598,8 @@ void drawCameraIcon(float x, float y, int size, uint16_t color, bool flash) {
     tft.fillRoundRect(x - size/2, y - size/3, 
                      size, size*2/3, size/6, color);
                      
-    // 添加装饰条纹
-    uint16_t stripeColor = tft.color565(
-        ((color >> 11) & 0x1F) * 0.7,
-        ((color >> 5) & 0x3F) * 0.7,
-        (color & 0x1F) * 0.7
-    );
+    // 添加装饰条纹(主体颜色的70%)
+    uint16_t stripeColor = blend565(color, TFT_BLACK, 22);
     tft.fillRoundRect(x - size/2, y - size/6, 
                      size, size/12, size/24, stripeColor);
     
@@ -779,52 +5775,473 @@ void drawStandbyAnimation() {
 // 修改handleFileUpload函数
 void handleFileUpload() {
     HTTPUpload& upload = server.upload();
-    static File file;
-    
+    UploadContext& ctx = uploadContext;
+
     if(upload.status == UPLOAD_FILE_START) {
-        isUploading = true;
-        if(DEBUG_ANIMATION) {
-            Serial.println("开始上传,停止动画");
+        uploadStarted();
+        if(!uploadBatch.startMs) {
+            // 请求的第一个文件: 分块上传的会话正在写闪存时整个请求排队
+            uploadBatch.startMs = millis();
+            ctx.rejected = !admitUploadWriter();
+        }
+        if(ctx.rejected) return;
+        LOG_DEBUG("开始上传,停止动画");
+        animationStop();    // 腾空间时可能删除正在播放的GIF
+        ctx.begin(photoFormatFromUpload(upload.filename, upload.type));
+    }
+    else if(upload.status == UPLOAD_FILE_WRITE) {
+        if(ctx.rejected) return;
+        ctx.sha.update(upload.buf, upload.currentSize);
+        if(!ctx.file && ctx.buffer && ctx.buffered + upload.currentSize <= UPLOAD_RAM_BUFFER) {
+            memcpy(ctx.buffer + ctx.buffered, upload.buf, upload.currentSize);
+            ctx.buffered += upload.currentSize;
+            return;
         }
-        if(SPIFFS.exists("/photo.jpg")) {
-            SPIFFS.remove("/photo.jpg");
+        // 内存放不下, 转为写文件
+        if(!ctx.file && !ctx.failed) ctx.spill();
+        if(ctx.file) {
+            unsigned long start = micros();
+            ctx.file.write(upload.buf, upload.currentSize);
+            recordUploadWrite(upload.currentSize, micros() - start);
         }
-        file = SPIFFS.open("/photo.jpg", FILE_WRITE);
-        if(!file) {
-            Serial.println("文件创建失败");
-            return server.send(500, "text/plain", "Failed to open file for writing");
+    }
+    else if(upload.status == UPLOAD_FILE_END) {
+        uploadFinished();
+        if(ctx.rejected) return;
+        uint8_t hash[32];
+        ctx.sha.end(hash);
+        int index = findPhotoByHash(hash);
+        if(index >= 0) {
+            // 重复内容: 丢弃这次上传, 已写入的文件也删除
+            ctx.discard();
+            acceptDuplicate(index, upload.totalSize);
+            recordUploadResult(photoStore[index].id, true);
+            return;
+        }
+        if(!ctx.file && !ctx.failed) {
+            unsigned long start = micros();
+            size_t bytes = ctx.buffered;
+            ctx.spill();
+            recordUploadWrite(bytes, micros() - start);
+        }
+        arenaFree(ARENA_UPLOAD, ctx.buffer);
+        ctx.buffer = NULL;
+
+        if(ctx.file) ctx.file.close();
+        if(ctx.failed) {
+            LOG_ERROR("文件创建失败");
+            PHOTO_FS.remove(storedPhotoPath(ctx.id, ctx.format));
+            recordUploadResult(-1, false);
+            return;
+        }
+        addStoredPhoto(ctx.id, ctx.format, upload.totalSize, hash);
+        recordUploadResult(ctx.id, false);
+        LOG_DEBUG("上传完成");
+    }
+    else if(upload.status == UPLOAD_FILE_ABORTED) {
+        // 连接中断, 删除不完整的文件
+        ctx.discard();
+        ctx.rejected = false;
+        uploadFinished();
+        resetUploadBatch();
+    }
+}
+
+// 分块续传: 文件按固定大小分块上传, 每块带偏移和CRC32, 校验通过的块单独保存;
+// 断线后客户端通过/upload-status查询已提交的范围, 只重传缺少的块; 全部到齐后拼接成照片
+// POST /upload-chunk?id=<会话>&name=<文件名>, 头部 Content-Range: bytes a-b/总长, X-Chunk-Crc32: <十六进制>
+
+// 当前块的接收状态
+struct ChunkReceive {
+    int status;                 // 返回的HTTP状态码
+    File file;
+    UploadChunk chunk;          // 块所属的会话和块号, 出错时会话可能为NULL
+    uint32_t received;
+    uint32_t crc;
+    uint32_t expectedCrc;
+    int photoIndex;             // 拼接完成后的照片下标, -1为未完成
+} chunkReceive;
+
+// 解析"bytes a-b/total"
+bool parseContentRange(const String& range, uint32_t* start, uint32_t* end, uint32_t* total) {
+    unsigned long a, b, t;
+    if(sscanf(range.c_str(), "bytes %lu-%lu/%lu", &a, &b, &t) != 3 || a > b || b >= t) return false;
+    *start = a;
+    *end = b;
+    *total = t;
+    return true;
+}
+
+// 按顺序拼接所有块, 每拷贝完一块就删除它以腾出空间; 返回照片下标
+int assembleUpload(UploadSession& session) {
+    PhotoFormat format = (PhotoFormat)session.format;
+    uint32_t total = session.total;
+    animationStop();
+
+    // 先读一遍计算哈希, 重复内容不再拼接写入
+    uint8_t hash[32];
+    uint8_t block[512];
+    Sha256 sha;
+    sha.begin();
+    uploadReadChunks(session, uploadStore, block, sizeof(block), false, [&](const uint8_t* data, size_t n) {
+        sha.update(data, n);
+        return true;
+    });
+    sha.end(hash);
+    int duplicate = findPhotoByHash(hash);
+    if(duplicate >= 0) {
+        uploadRemoveChunks(session, uploadStore);
+        session.complete(photoStore[duplicate].id, millis());
+        return acceptDuplicate(duplicate, total);
+    }
+
+    ensureStoreSpace(0);
+    uint16_t id = nextPhotoId++;
+    String path = storedPhotoPath(id, format);
+    File out = PHOTO_FS.open(path, FILE_WRITE);
+    uint8_t* buf = (uint8_t*)malloc(1024);
+    bool ok = out && buf;
+    if(ok) {
+        ok = uploadReadChunks(session, uploadStore, buf, 1024, true, [&](const uint8_t* data, size_t n) {
+            timerWrite(watchDog, 0);
+            return out.write(data, n) == n;
+        });
+    } else {
+        uploadRemoveChunks(session, uploadStore);
+    }
+    free(buf);
+    if(out) out.close();
+
+    if(!ok) {
+        session.reset();
+        PHOTO_FS.remove(path);
+        return -1;
+    }
+    session.complete(id, millis());
+    return addStoredPhoto(id, format, total, hash);
+}
+
+// 开始接收一个块: 校验范围, 必要时建立新会话
+void beginChunk() {
+    chunkReceive.photoIndex = -1;
+    chunkReceive.received = 0;
+    chunkReceive.crc = 0;
+    chunkReceive.chunk.session = NULL;
+
+    uint32_t start, end, total;
+    String key = server.arg("id");
+    if(!server.hasHeader("Content-Range") || !parseContentRange(server.header("Content-Range"), &start, &end, &total)) {
+        chunkReceive.status = 400;
+        chunkReceive.chunk.error = "bad range";
+        return;
+    }
+    chunkReceive.expectedCrc = strtoul(server.header("X-Chunk-Crc32").c_str(), NULL, 16);
+    chunkReceive.status = uploads.beginChunk(key.c_str(), start, end, total, photoFormatFromUpload(server.arg("name"), ""),
+                                             millis(), uploadStore, &chunkReceive.chunk);
+    if(chunkReceive.status != 200 || chunkReceive.chunk.session->state == SESSION_DONE) return;
+
+    chunkReceive.file = PHOTO_FS.open(uploadChunkPath(*chunkReceive.chunk.session, chunkReceive.chunk.index, true), FILE_WRITE);
+    if(!chunkReceive.file) {
+        chunkReceive.status = 507;
+        chunkReceive.chunk.error = "no space";
+    }
+}
+
+// 块接收完成: 长度和CRC都正确才提交, 全部到齐后拼接
+void endChunk() {
+    if(chunkReceive.file) chunkReceive.file.close();
+    if(chunkReceive.status != 200) return;
+
+    chunkReceive.status = uploadEndChunk(chunkReceive.chunk, chunkReceive.received,
+                                         chunkReceive.crc == chunkReceive.expectedCrc, uploadStore);
+    if(chunkReceive.status != 200) return;
+
+    UploadSession& session = *chunkReceive.chunk.session;
+    if(session.state == SESSION_ACTIVE && session.allCommitted()) {
+        chunkReceive.photoIndex = assembleUpload(session);
+        if(chunkReceive.photoIndex < 0) {
+            chunkReceive.status = 500;
+            chunkReceive.chunk.error = "assemble failed";
         }
-    } 
+    }
+}
+
+void handleChunkUpload() {
+    HTTPUpload& upload = server.upload();
+
+    if(upload.status == UPLOAD_FILE_START) {
+        uploadStarted();
+        beginChunk();
+    }
     else if(upload.status == UPLOAD_FILE_WRITE) {
-        if(file) {
-            file.write(upload.buf, upload.currentSize);
+        if(chunkReceive.file && chunkReceive.received + upload.currentSize <= chunkReceive.chunk.expected) {
+            unsigned long start = micros();
+            chunkReceive.file.write(upload.buf, upload.currentSize);
+            recordUploadWrite(upload.currentSize, micros() - start);
+            chunkReceive.crc = crc32_le(chunkReceive.crc, upload.buf, upload.currentSize);
         }
-    } 
+        chunkReceive.received += upload.currentSize;
+    }
     else if(upload.status == UPLOAD_FILE_END) {
-        if(file) {
-            file.close();
-            if(DEBUG_ANIMATION) {
-                Serial.println("上传完成,显示动态图片");
-            }
-            isUploading = false;
-            
-            // 初始化波动动画参数
-            imgAnim.wave = 0;
-            imgAnim.waveStrength = 0;
-            imgAnim.waveSpeed = 0;
-            imgAnim.lastWave = millis();
-            imgAnim.waveInterval = random(3000, 8000);
-            imgAnim.inWave = false;
+        endChunk();
+        uploadFinished();
+        if(chunkReceive.photoIndex >= 0) {
             imgAnim.enabled = true;
-            
-            // 显示图片
-            tft.fillScreen(TFT_BLACK);
-            TJpgDec.drawFsJpg(0, 0, "/photo.jpg");
+            requestRender(RENDER_SHOW, photoStore[chunkReceive.photoIndex].id);
+        }
+    }
+    else if(upload.status == UPLOAD_FILE_ABORTED) {
+        // 未完成的块直接丢弃, 客户端稍后重传
+        if(chunkReceive.file) {
+            chunkReceive.file.close();
+            uploadAbortChunk(chunkReceive.chunk, uploadStore);
+        }
+        uploadFinished();
+    }
+}
+
+void handleChunkDone() {
+    // 没有文件部分的请求不会经过块接收, 不能用上一次的结果回答
+    if(chunkReceive.status == 0) {
+        server.send(400, "application/json", "{\"error\":\"no file part\"}");
+        return;
+    }
+    String json = "{\"chunk\":" + String(chunkReceive.chunk.index);
+    if(chunkReceive.status == 503) server.sendHeader("Retry-After", String(uploadRetryAfter()));
+    if(chunkReceive.status != 200) {
+        json += ",\"error\":\"" + String(chunkReceive.chunk.error) + "\"}";
+    } else if(chunkReceive.photoIndex >= 0) {
+        json += ",\"complete\":true,\"id\":" + String(photoStore[chunkReceive.photoIndex].id) + "}";
+    } else if(chunkReceive.chunk.session->state == SESSION_DONE) {
+        json += ",\"complete\":true,\"id\":" + String(chunkReceive.chunk.session->photoId) + "}";
+    } else {
+        json += ",\"complete\":false,\"committed\":" + String(chunkReceive.chunk.session->committedCount) + "}";
+    }
+    server.send(chunkReceive.status, "application/json", json);
+    chunkReceive.status = 0;
+}
+
+// 已提交的范围: /upload-status?id=<会话>, 返回合并后的字节区间
+void handleUploadStatus() {
+    String key = server.arg("id");
+    UploadSession* session = key.length() > 0 ? findUploadSession(key) : NULL;
+    if(session && session->state == SESSION_DONE) {
+        server.send(200, "application/json", "{\"complete\":true,\"id\":" + String(session->photoId) + "}");
+        return;
+    }
+    String json = "{\"chunkSize\":" + String(UPLOAD_CHUNK_SIZE);
+    json += ",\"total\":" + String(session ? session->total : 0) + ",\"ranges\":[";
+    for(uint16_t i = 0; session && i < session->chunks; i++) {
+        if(!session->has(i) || (i > 0 && session->has(i - 1))) continue;
+        uint16_t j = i;
+        while(j + 1 < session->chunks && session->has(j + 1)) j++;
+        uint32_t end = min((uint32_t)(j + 1) * UPLOAD_CHUNK_SIZE, session->total) - 1;
+        if(json.endsWith("]")) json += ",";
+        json += "[" + String((uint32_t)i * UPLOAD_CHUNK_SIZE) + "," + String(end) + "]";
+    }
+    json += "]}";
+    server.send(200, "application/json", json);
+}
+
+// 上传会话和准入统计: /uploads
+void handleUploads() {
+    String json = "{\"maxWriters\":" + String(UPLOAD_MAX_WRITERS);
+    json += ",\"writers\":" + String(uploadWriters());
+    json += ",\"admitted\":" + String(uploads.admission.admitted);
+    json += ",\"rejected\":" + String(uploads.admission.rejected);
+    json += ",\"retryAfter\":" + String(uploadRetryAfter());
+    json += ",\"flashKBps\":" + String(uploads.admission.flashUs ?
+            (uint32_t)(uploads.admission.flashBytes * 1000000 / uploads.admission.flashUs / 1024) : 0);
+    json += ",\"sessions\":[";
+    bool first = true;
+    for(int i = 0; i < UPLOAD_MAX_SESSIONS; i++) {
+        UploadSession& session = uploads.sessions[i];
+        if(session.state == SESSION_FREE) continue;
+        if(!first) json += ",";
+        first = false;
+        json += "{\"id\":\"" + String(session.key) + "\",\"state\":\"" +
+                String(session.state == SESSION_DONE ? "done" : session.writing(millis()) ? "writing" : "idle") + "\"";
+        json += ",\"committed\":" + String(session.committedCount) + ",\"chunks\":" + String(session.chunks);
+        json += ",\"idleMs\":" + String(millis() - session.lastSeen) + "}";
+    }
+    json += "]}";
+    server.send(200, "application/json", json);
+}
+
+// 增量更新: /tiles?base=<照片编号> 上传tiles.bin, 只重绘变化的矩形区域
+// tiles.bin由若干块组成: x(u16) y(u16) 长度(u32) 均为小端, 后跟该块的Q565/R565/JPEG数据
+// 补丁同时写入当前照片的全屏R565帧文件; 非RAW照片打补丁后改存为该帧文件
+// 图块在上传回调中直接推送到屏幕, 不经过绘制队列: 逐块处理只需一个图块的缓冲
+#define TILE_MAX_BYTES (16 * 1024)
+#define TILE_RECORD_HEADER 8
+
+struct TilePatch {
+    int status;                 // 返回的HTTP状态码, 200以外的都不再处理后续数据
+    File frame;                 // 被修改的全屏帧文件
+    int cacheSlot;              // 修改的是解码缓存时的槽位, 否则为-1
+    uint8_t header[TILE_RECORD_HEADER];
+    uint8_t headerLen;
+    uint8_t* data;
+    uint32_t dataLen;
+    uint32_t need;
+    uint16_t tiles;
+    uint32_t bytes;             // 收到的总字节数
+    unsigned long redrawUs;     // 解码并推送到屏幕的耗时(含写帧文件)
+    unsigned long flashUs;      // 其中写帧文件的耗时
+} tilePatch;
+
+bool tileSink(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap) {
+    if(x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) return true;
+    uint16_t cw = min((int)w, SCREEN_WIDTH - x);
+    uint16_t ch = min((int)h, SCREEN_HEIGHT - y);
+    
+    // 帧文件保存变换前的像素
+    unsigned long start = micros();
+    for(uint16_t r = 0; r < ch; r++) {
+        tilePatch.frame.seek(Q565_HEADER_SIZE + ((size_t)(y + r) * SCREEN_WIDTH + x) * sizeof(uint16_t));
+        tilePatch.frame.write((uint8_t*)(bitmap + r * w), cw * sizeof(uint16_t));
+    }
+    tilePatch.flashUs += micros() - start;
+    
+    applyColorLut(bitmap, w * ch);
+    tft.pushImage(x, y, w, ch, bitmap);
+    return true;
+}
+
+// 解码一个完整的块并打补丁
+bool applyTile() {
+    int16_t x = tilePatch.header[0] | (tilePatch.header[1] << 8);
+    int16_t y = tilePatch.header[2] | (tilePatch.header[3] << 8);
+    PhotoFormat format = streamFrameFormat(tilePatch.data, tilePatch.dataLen);
+    if(format == PHOTO_NONE) return false;
+    
+    unsigned long start = micros();
+    DecodeResult r = drawImage(format, memorySource(tilePatch.data, tilePatch.dataLen), x, y, 1, tileSink);
+    tilePatch.redrawUs += micros() - start;
+    tilePatch.tiles++;
+    return r == DECODE_OK;
+}
+
+// 打开当前照片的全屏帧文件用于修改
+void beginTilePatch() {
+    // 图块直接改写解码缓存, PSRAM中的整帧随之失效
+    if(hasPhoto()) ramFrameInvalidate(photoStore[currentPhoto].id);
+    tilePatch.status = 200;
+    tilePatch.cacheSlot = -1;
+    tilePatch.headerLen = 0;
+    tilePatch.dataLen = 0;
+    tilePatch.tiles = 0;
+    tilePatch.bytes = 0;
+    tilePatch.redrawUs = 0;
+    tilePatch.flashUs = 0;
+    
+    // 客户端的差异是相对某张照片计算的, 屏幕已切换到别的照片时拒绝
+    if(!hasPhoto() || !server.hasArg("base") || server.arg("base").toInt() != photoStore[currentPhoto].id) {
+        tilePatch.status = 409;
+        return;
+    }
+    String path = decodeToFrameCache(currentPhoto);
+    if(path.length() == 0) {
+        tilePatch.status = 503;
+        return;
+    }
+    tilePatch.data = (uint8_t*)arenaAlloc(ARENA_UPLOAD, TILE_MAX_BYTES);
+    tilePatch.frame = PHOTO_FS.open(path, "r+");
+    if(!tilePatch.data || !tilePatch.frame) {
+        tilePatch.status = 500;
+        return;
+    }
+    if(photoStore[currentPhoto].format != PHOTO_RAW) {
+        // 修改期间不允许预取任务淘汰这个缓存槽
+        tilePatch.cacheSlot = frameCacheFind(photoStore[currentPhoto].id);
+        frameCache[tilePatch.cacheSlot].pending = true;
+    }
+}
+
+// 释放资源; 修改的是解码缓存时把它改存为照片本身
+void endTilePatch() {
+    if(tilePatch.frame) tilePatch.frame.close();
+    arenaFree(ARENA_UPLOAD, tilePatch.data);
+    tilePatch.data = NULL;
+    if(tilePatch.tiles > 0) {
+        // 内容已改变, 不再参与去重, 缩略图重新生成
+        memset(photoStore[currentPhoto].hash, 0, 32);
+        savePhotoHashes();
+        thumbForget(photoStore[currentPhoto].id);
+    }
+    if(tilePatch.cacheSlot < 0) return;
+    
+    FrameCacheSlot& slot = frameCache[tilePatch.cacheSlot];
+    StoredPhoto& photo = photoStore[currentPhoto];
+    if(tilePatch.tiles > 0) {
+        PHOTO_FS.remove(storedPhotoPath(photo.id, photo.format));
+        PHOTO_FS.rename(frameCachePath(photo.id), storedPhotoPath(photo.id, PHOTO_RAW));
+        photo.format = PHOTO_RAW;
+        photo.size = FRAME_BYTES;
+        photo.scale = 1;
+        slot.photoId = -1;
+        slot.valid = false;
+    }
+    slot.pending = false;
+    tilePatch.cacheSlot = -1;
+}
+
+void handleTileUpload() {
+    HTTPUpload& upload = server.upload();
+    
+    if(upload.status == UPLOAD_FILE_START) {
+        uploadStarted();
+        beginTilePatch();
+    }
+    else if(upload.status == UPLOAD_FILE_WRITE) {
+        tilePatch.bytes += upload.currentSize;
+        size_t pos = 0;
+        while(tilePatch.status == 200 && pos < upload.currentSize) {
+            if(tilePatch.headerLen < TILE_RECORD_HEADER) {
+                tilePatch.header[tilePatch.headerLen++] = upload.buf[pos++];
+                if(tilePatch.headerLen == TILE_RECORD_HEADER) {
+                    const uint8_t* h = tilePatch.header;
+                    tilePatch.need = h[4] | (h[5] << 8) | (h[6] << 16) | ((uint32_t)h[7] << 24);
+                    tilePatch.dataLen = 0;
+                    if(tilePatch.need == 0 || tilePatch.need > TILE_MAX_BYTES) tilePatch.status = 400;
+                }
+                continue;
+            }
+            size_t n = min((size_t)(tilePatch.need - tilePatch.dataLen), upload.currentSize - pos);
+            memcpy(tilePatch.data + tilePatch.dataLen, upload.buf + pos, n);
+            tilePatch.dataLen += n;
+            pos += n;
+            if(tilePatch.dataLen == tilePatch.need) {
+                if(!applyTile()) tilePatch.status = 400;
+                tilePatch.headerLen = 0;
+            }
         }
-        server.send(200, "text/plain", "Upload successful");
+    }
+    else if(upload.status == UPLOAD_FILE_END) {
+        // 数据在块中间结束也视为格式错误
+        if(tilePatch.status == 200 && tilePatch.headerLen != 0) tilePatch.status = 400;
+        endTilePatch();
+        uploadFinished();
+        LOG_DEBUG("增量更新: %u 块, %lu 字节, %lu us", tilePatch.tiles,
+                  (unsigned long)tilePatch.bytes, tilePatch.redrawUs);
+    }
+    else if(upload.status == UPLOAD_FILE_ABORTED) {
+        // 已经应用的块仍然有效
+        endTilePatch();
+        uploadFinished();
     }
 }
 
+void handleTileDone() {
+    String json = "{\"tiles\":" + String(tilePatch.tiles);
+    json += ",\"bytes\":" + String(tilePatch.bytes);
+    json += ",\"redrawUs\":" + String(tilePatch.redrawUs);
+    json += ",\"flashUs\":" + String(tilePatch.flashUs) + "}";
+    // 没有文件部分的请求不会经过beginTilePatch
+    server.send(tilePatch.status ? tilePatch.status : 400, "application/json", json);
+    tilePatch.status = 0;
+}
+
 // 在文件开头的全局变量声明部分添加
 #define LOADING_BAR_WIDTH 180
 #define LOADING_BAR_HEIGHT 12
@@ -942,6 +6359,7 @@ void showBootAnimation() {
 
 // 添加模式切换处理函数
 void handleSwitchMode() {
+    markActivity();
     String mode = server.arg("mode");
     if(mode == "clear") {
         currentDisplayMode = CLEAR_MODE;
@@ -949,22 +6367,118 @@ void handleSwitchMode() {
         currentDisplayMode = DYNAMIC_MODE;
     }
     
-    saveDisplayMode();  // 保存当前模式
+    markSettingsChanged();  // 保存当前模式(延迟写入)
     
-    // 如果当前有图片显示，重新显示
-    if(SPIFFS.exists("/photo.jpg")) {
-        tft.fillScreen(TFT_BLACK);
-        TJpgDec.drawFsJpg(0, 0, "/photo.jpg");
-    }
+    // 如果当前有图片显示，重新显示(由loop执行)
+    requestRender(RENDER_REDRAW);
     
     server.send(200, "text/plain", "success");
 }
 
+// 功耗调节: 按当前状态决定loop的节拍和CPU频率(策略见lib/power_policy), 两个节拍之间让出CPU;
+// 启用CONFIG_PM_ENABLE时(env:esp32dev-lightsleep)空闲可进入自动浅睡眠, 热点由WiFi驱动持锁保持;
+// 长时间无操作时调暗背光
+#define POWER_WINDOW_MS 10000               // 醒着比例的统计窗口
+#define POWER_POLL_MS 10                    // 让出CPU期间检查新连接的间隔
+
+struct PowerGovernor {
+    PowerState state;
+    PowerPolicy policy;
+    unsigned long deadline;         // 下一次loop的计划时间(ms)
+    unsigned long windowStart;
+    uint32_t windowSleepMs;         // 统计窗口内让出CPU的时间
+    uint8_t awakePercent = 100;     // 上一个窗口内醒着的比例, 作为电流的近似指标
+    uint64_t totalSleepMs;
+} governor;
+
+PowerState currentPowerState() {
+    if(isUploading() || streamActive) return POWER_BUSY;
+    if(!hasPhoto()) return POWER_STANDBY;
+    if(photoStore[currentPhoto].format == PHOTO_GIF) return POWER_ANIMATION;
+    if(kenBurns.enabled && kenBurns.tilesId == photoStore[currentPhoto].id) return POWER_ANIMATION;
+    return currentDisplayMode == CLEAR_MODE ? POWER_STATIC : POWER_DYNAMIC;
+}
+
+void applyCpuFrequency(uint16_t mhz) {
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pm = {};
+    pm.max_freq_mhz = mhz;
+    pm.min_freq_mhz = 80;   // WiFi需要至少80MHz
+    pm.light_sleep_enable = true;
+    esp_pm_configure(&pm);
+#else
+    setCpuFrequencyMhz(mhz);
+#endif
+}
+
+// 每次loop开始时调用: 更新策略, 等到下一个节拍; 有连接在排队时提前醒来
+void governorTick() {
+    unsigned long now = millis();
+    governor.state = currentPowerState();
+    PowerPolicy policy = powerPolicy(governor.state, now - lastActivity, now - lastRequest);
+    
+    if(policy.cpuMhz != governor.policy.cpuMhz) applyCpuFrequency(policy.cpuMhz);
+    if(policy.dim != governor.policy.dim) {
+        idleDimmed = policy.dim;
+        colorLutDirty = true;
+        updateColorLut();
+        // 没有背光PWM时变暗由查找表完成, 需要重绘
+        requestRender(RENDER_REDRAW);
+    }
+    governor.policy = policy;
+    
+    if(now - governor.windowStart >= POWER_WINDOW_MS) {
+        unsigned long window = now - governor.windowStart;
+        governor.awakePercent = 100 - min((unsigned long)governor.windowSleepMs * 100 / window, 100UL);
+        governor.windowStart = now;
+        governor.windowSleepMs = 0;
+    }
+    
+    if(policy.fps == 0) {
+        governor.deadline = now;
+        return;
+    }
+    unsigned long period = 1000 / policy.fps;
+    // GIF的下一帧更早时按帧时间唤醒
+    unsigned long wake = governor.deadline;
+    if(anim.playing && (long)(anim.nextFrameAt - wake) < 0) wake = anim.nextFrameAt;
+    unsigned long wait = powerWaitMs(now, wake, period);
+    unsigned long slept = 0;
+    while(slept < wait && !server.pending()) {
+        unsigned long step = min(wait - slept, (unsigned long)POWER_POLL_MS);
+        delay(step);
+        slept += step;
+    }
+    governor.windowSleepMs += slept;
+    governor.totalSleepMs += slept;
+    if(slept > 0) now = millis();
+    governor.deadline = powerNextDeadline(now, governor.deadline, period);
+}
+
+// 功耗状态: /power
+void handlePower() {
+    const char* names[] = {"standby", "static", "dynamic", "animation", "busy"};
+    String json = "{\"state\":\"" + String(names[governor.state]) + "\"";
+    json += ",\"fps\":" + String(governor.policy.fps);
+    json += ",\"cpuMhz\":" + String(getCpuFrequencyMhz());
+    json += ",\"awakePercent\":" + String(governor.awakePercent);
+    json += ",\"sleepSeconds\":" + String((uint32_t)(governor.totalSleepMs / 1000));
+    json += ",\"dimmed\":" + String(idleDimmed ? "true" : "false");
+    json += ",\"backlight\":" + String(backlightLevel);
+#if CONFIG_PM_ENABLE
+    json += ",\"lightSleep\":true}";
+#else
+    json += ",\"lightSleep\":false}";
+#endif
+    server.send(200, "application/json", json);
+}
+
 void setup() {
     Serial.begin(115200);
+    logBegin();
     
     // WiFi初始化
-    Serial.println("正在初始化WiFi...");
+    LOG_INFO("正在初始化WiFi...");
     
     // 完全关闭WiFi并重置
     WiFi.persistent(false);  // 禁用WiFi配置持久化
@@ -1030,7 +6544,7 @@ void setup() {
     // 启动AP
     bool apSuccess = WiFi.softAP(WIFI_SSID, WIFI_PASSWORD, WIFI_CHANNEL, false, MAX_CONNECTIONS);
     if (!apSuccess) {
-        Serial.println("AP配置失败,重启设备!");
+        LOG_ERROR("AP配置失败,重启设备!");
         delay(1000);
         ESP.restart();
         return;
@@ -1039,44 +6553,45 @@ void setup() {
     // 等待AP完全启动
     delay(500);
     
-    Serial.println("AP模式启动成功");
-    Serial.printf("SSID: %s\n", WIFI_SSID);
-    Serial.printf("密码: %s\n", WIFI_PASSWORD);
-    Serial.printf("信道: %d\n", WIFI_CHANNEL);
-    Serial.printf("IP地址: %s\n", WiFi.softAPIP().toString().c_str());
+    LOG_INFO("AP模式启动成功");
+    LOG_INFO("SSID: %s", WIFI_SSID);
+    LOG_INFO("密码: %s", WIFI_PASSWORD);
+    LOG_INFO("信道: %d", WIFI_CHANNEL);
+    LOG_INFO("IP地址: %s", WiFi.softAPIP().toString().c_str());
     
     // WiFi事件处理
     WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info){
-        Serial.print("Station connected, MAC: ");
         uint8_t* mac = info.wifi_ap_staconnected.mac;
-        for(int i = 0; i < 6; i++){
-            Serial.printf("%02X", mac[i]);
-            if(i < 5) Serial.print(":");
-        }
-        Serial.println();
+        LOG_INFO("Station connected, MAC: %02X:%02X:%02X:%02X:%02X:%02X",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     }, ARDUINO_EVENT_WIFI_AP_STACONNECTED);
     
     WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info){
-        Serial.print("Station disconnected, MAC: ");
         uint8_t* mac = info.wifi_ap_stadisconnected.mac;
-        for(int i = 0; i < 6; i++){
-            Serial.printf("%02X", mac[i]);
-            if(i < 5) Serial.print(":");
-        }
-        Serial.println();
+        LOG_INFO("Station disconnected, MAC: %02X:%02X:%02X:%02X:%02X:%02X",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     }, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
 
     // 其他初始化代码...
-    // 初始化SPIFFS
-    if(!SPIFFS.begin(true)) {
-        Serial.println("SPIFFS挂载失败");
+    // 挂载存储(LittleFS版本首次启动时从SPIFFS迁移)
+    if(!mountStorage()) {
+        LOG_ERROR("存储挂载失败");
         return;
     }
+#if STORAGE_BENCH
+    storageBenchmark();
+#endif
+    loadSettings();     // 显示模式和色彩设置, 要在画第一帧之前
     
     // 初始化显示屏
     tft.begin();
     tft.setRotation(2);
     tft.fillScreen(TFT_BLACK);
+#ifdef TFT_BL
+    ledcSetup(BACKLIGHT_PWM_CHANNEL, BACKLIGHT_PWM_FREQ, BACKLIGHT_PWM_BITS);
+    ledcAttachPin(TFT_BL, BACKLIGHT_PWM_CHANNEL);
+#endif
+    updateColorLut();
     
     // 显示开机动画
     showBootAnimation();
@@ -1084,25 +6599,41 @@ void setup() {
     // 初始化JPEG解码器
     TJpgDec.setCallback(tft_output);
     TJpgDec.setSwapBytes(true);
+    tftMutex = xSemaphoreCreateMutex();
     
     // 配置Web服务器路由
-    server.on("/", HTTP_GET, handleRoot);
-    server.on("/upload", HTTP_POST, handleUpload, handleFileUpload);
+    server.on("/", HTTP_GET, timed(handleRoot));
+    server.on("/upload", HTTP_POST, timed(handleUpload), handleFileUpload);
+    server.on("/tiles", HTTP_POST, timed(handleTileDone), handleTileUpload);
+    server.on("/upload-chunk", HTTP_POST, timed(handleChunkDone), handleChunkUpload);
+    server.on("/upload-status", HTTP_GET, timed(handleUploadStatus));
+    server.on("/uploads", HTTP_GET, timed(handleUploads));
+    server.on("/overlay", HTTP_GET, timed(handleOverlay));
+    server.on("/gallery", HTTP_GET, timed(handleGallery));
+    server.on("/thumb", HTTP_GET, timed(handleThumb));
+    const char* requestHeaders[] = {"Content-Range", "X-Chunk-Crc32", "If-None-Match"};
+    server.collectHeaders(requestHeaders, 3);
     
     // 启动服务器
     server.begin();
-    Serial.println("HTTP服务器已启动");
+    LOG_INFO("HTTP服务器已启动");
     
     // 确保初始状态
-    isUploading = false;
+    activeUploads = 0;
     
-    // 删除可能存在的旧图片文件
-    if(SPIFFS.exists("/photo.jpg")) {
-        SPIFFS.remove("/photo.jpg");
-        if(DEBUG_ANIMATION) {
-            Serial.println("删除旧图片文件");
-        }
-    }
+    // 删除可能存在的旧图片文件, 照片库保留但开机先显示待机动画
+    removeLegacyPhotoFiles();
+    clearFrameCache();
+    removeDirectory(UPLOAD_DIR);    // 断电前未完成的分块上传
+    loadPhotoStore();
+    loadPhotoHashes();
+    loadThumbIndex();
+    currentPhoto = -1;
+    LOG_DEBUG("删除旧图片文件");
+    
+    // 启动后台预取任务(核心0, 低优先级)
+    prefetchQueue = xQueueCreate(FRAME_CACHE_SLOTS, sizeof(PrefetchJob));
+    xTaskCreatePinnedToCore(prefetchTaskLoop, "prefetch", 6144, NULL, 1, &prefetchTask, 0);
     
     // 初始化看门狗定时器(5秒超时)
     watchDog = timerBegin(0, 80, true);
@@ -1112,44 +6643,84 @@ void setup() {
     timerAlarmWrite(watchDog, 5000000, false);
     timerAlarmEnable(watchDog);
     
-    // 加载显示模式
-    loadDisplayMode();
-    
     // 添加模式切换路由
-    server.on("/switch-mode", HTTP_GET, handleSwitchMode);
+    server.on("/switch-mode", HTTP_GET, timed(handleSwitchMode));
+    server.on("/decoders", HTTP_GET, timed(handleDecoders));
+    server.on("/decoder-bench", HTTP_GET, timed(handleDecoderBench));
+    server.on("/encoding-profile", HTTP_GET, timed(handleEncodingProfile));
+    server.on("/slideshow", HTTP_GET, timed(handleSlideshow));
+    server.on("/transition", HTTP_GET, timed(handleTransition));
+    server.on("/stream", HTTP_GET, timed(handleStreamStats));
+    server.on("/animation", HTTP_GET, timed(handleAnimation));
+    server.on("/color", HTTP_GET, timed(handleColor));
+    server.on("/power", HTTP_GET, timed(handlePower));
+    server.on("/dedup", HTTP_GET, timed(handleDedup));
+    server.on("/kenburns", HTTP_GET, timed(handleKenBurns));
+    server.on("/storage", HTTP_GET, timed(handleStorage));
+    server.on("/settings", HTTP_GET, timed(handleSettings));
+    server.on("/memory", HTTP_GET, timed(handleMemory));
+    server.on("/frame-bench", HTTP_GET, timed(handleFrameBench));
+    server.on("/pixel-bench", HTTP_GET, timed(handlePixelBench));
+    server.on("/log", HTTP_GET, timed(handleLogStats));
+    server.on("/render", HTTP_GET, handleRenderStats);
+    
+    // 启动投屏WebSocket服务
+    webSocket.begin();
+    webSocket.onEvent(onStreamEvent);
+    
+    // 其他部分都初始化后再划分内存区, 剩下的留给WiFi和HTTP; 整帧缓冲在PSRAM中,
+    // 只有DMA条带占用内部内存, 先分配
+    frameTierBegin();
+    memoryBegin();
 }
 
 void loop() {
+    // 按功耗策略等到下一个节拍
+    governorTick();
+    
     // 喂狗
     timerWrite(watchDog, 0);
     
-    // 定期检查内存
-    if(millis() - lastHeapCheck > HEAP_CHECK_INTERVAL) {
-        lastHeapCheck = millis();
-        
-        size_t freeHeap = ESP.getFreeHeap();
-        if(freeHeap < MIN_HEAP_SIZE) {
-            lowMemCount++;
-            Serial.printf("警告:内存不足 %d bytes\n", freeHeap);
-            
-            if(lowMemCount > 3) {  // 连续3次内存不足
-                Serial.println("内存持续不足,准备重启...");
-                ESP.restart();
-            }
-        } else {
-            lowMemCount = 0;  // 重置计数
-        }
-        
-        // 打印内存信息
-        Serial.printf("空闲堆内存: %d bytes\n", freeHeap);
-        Serial.printf("最大空闲块: %d bytes\n", ESP.getMaxAllocHeap());
-    }
+    // 定期检查内存, 不足时降级
+    memoryTick();
 
     // 处理Web服务器请求
     server.handleClient();
+    updateColorLut();
+    settingsTick();
+    
+    // 投屏中只显示推送的帧
+    handleStream();
+    if(streamActive) return;
+
+    // 执行处理函数登记的绘制
+    processRenderQueue();
+    
+    // 空闲时补做缩略图
+    thumbTick();
+    
+    // 幻灯片定时切换
+    if(slideshow.enabled && photoCount > 0 && !isUploading() &&
+       (!hasPhoto() || (photoCount > 1 && millis() - slideshow.lastSwitch >= slideshow.interval))) {
+        slideshow.lastSwitch = millis();
+        showPhoto(hasPhoto() ? (currentPhoto + 1) % photoCount : 0);
+        LOG_DEBUG("幻灯片切换: %lu us", slideshow.lastSwitchUs);
+    }
     
     // 优先检查是否有图片需要显示
-    if (SPIFFS.exists("/photo.jpg") && !isUploading) {
+    if (hasPhoto() && !isUploading()) {
+        // GIF按帧延时播放, 不做油画波动和定期重绘
+        if(photoStore[currentPhoto].format == PHOTO_GIF) {
+            animationTick();
+            return;
+        }
+
+        // 平移缩放同样按自己的帧率推送
+        if(kenBurnsTick()) return;
+        
+        // 时钟变化时只更新它所在的矩形
+        overlayTick();
+        
         static unsigned long lastWaveCheck = 0;
         static unsigned long lastRefresh = 0;
         const unsigned long REFRESH_INTERVAL = 60000; // 每分钟强制刷新一次
@@ -1158,7 +6729,7 @@ void loop() {
         if(millis() - lastRefresh > REFRESH_INTERVAL) {
             lastRefresh = millis();
             tft.fillScreen(TFT_BLACK);
-            TJpgDec.drawFsJpg(0, 0, "/photo.jpg");
+            drawPhoto();
             return;
         }
         
@@ -1166,12 +6737,12 @@ void loop() {
         if(millis() - lastWaveCheck > random(3000, 8000)) {
             lastWaveCheck = millis();
             
-            // 检查内存是否足够进行动画
-            if(ESP.getFreeHeap() > MIN_HEAP_SIZE) {
+            // 降级时不做动画
+            if(!memoryState.degraded) {
                 triggerPhotoWave();
-                TJpgDec.drawFsJpg(0, 0, "/photo.jpg");
+                drawPhoto();
             } else {
-                Serial.println("内存不足,跳过动画效果");
+                LOG_INFO("内存不足,跳过动画效果");
             }
         }
         return;
@@ -1181,13 +6752,13 @@ void loop() {
     static unsigned long lastFrameTime = 0;
     const unsigned long targetFrameTime = 1000 / 20; // 限制最大帧率为20fps
     
-    if (!isUploading && !SPIFFS.exists("/photo.jpg")) {
+    if (!isUploading() && !hasPhoto()) {
         unsigned long currentTime = millis();
         if(currentTime - lastFrameTime >= targetFrameTime) {
             lastFrameTime = currentTime;
             
-            // 检查内存是否足够
-            if(ESP.getFreeHeap() > MIN_HEAP_SIZE) {
+            // 降级时不画待机动画
+            if(!memoryState.degraded) {
                 drawStandbyAnimation();
             } else {
                 // 如果内存不足,显示简单的等待信息
@@ -0,0 +1,180 @@
+// GIF录制/回放: 第一遍边画边录, 回放录制内容的模拟面板与直接绘制的面板逐帧一致,
+// 且直接绘制的结果与逐像素合成的参考画面一致(透明像素保留背景, 处置方式2在下一帧前填黑)
+// 运行: pio test -e native -f test_anim_replay
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <anim_ops.h>
+
+#define PANEL_W 240
+#define PANEL_H 320
+#define FRAMES 24
+
+void setUp(void) {
+    srand(33);
+}
+
+void tearDown(void) {}
+
+// 模拟面板: 一块帧缓冲
+struct SimPanel {
+    uint16_t px[PANEL_W * PANEL_H];
+    
+    void run(int16_t x, int16_t y, uint16_t n, uint16_t* line) {
+        memcpy(px + y * PANEL_W + x, line, n * sizeof(uint16_t));
+    }
+    
+    void fill(int16_t x, int16_t y, int16_t w, int16_t h) {
+        for(int r = 0; r < h; r++) memset(px + (y + r) * PANEL_W + x, 0, w * sizeof(uint16_t));
+    }
+};
+
+// 录制内容, 与设备上一样循环读取
+struct Recording {
+    std::vector<uint8_t> data;
+    size_t readPos = 0;
+    
+    void append(const void* p, size_t n) {
+        data.insert(data.end(), (const uint8_t*)p, (const uint8_t*)p + n);
+    }
+    
+    void read(void* buf, size_t n) {
+        uint8_t* out = (uint8_t*)buf;
+        while(n--) {
+            if(readPos >= data.size()) readPos = 0;
+            *out++ = data[readPos++];
+        }
+    }
+};
+
+// 一帧GIF: 矩形, 调色板索引, 透明色和处置方式
+struct Frame {
+    int16_t x, y, w, h;
+    std::vector<uint8_t> index;
+    bool hasTransparency;
+    uint8_t transparent;
+    uint8_t disposal;
+    int delayMs;
+};
+
+static uint16_t palette[256];
+
+static Frame randomFrame(void) {
+    Frame f;
+    f.w = 1 + rand() % PANEL_W;
+    f.h = 1 + rand() % PANEL_H;
+    f.x = rand() % (PANEL_W - f.w + 1);
+    f.y = rand() % (PANEL_H - f.h + 1);
+    f.hasTransparency = rand() % 3 != 0;
+    f.transparent = rand() & 0xFF;
+    f.disposal = rand() % 3 == 0 ? 2 : 1;
+    f.delayMs = 10 + rand() % 200;
+    // 成片的透明区域和单个透明像素都有
+    f.index.resize(f.w * f.h);
+    uint8_t color = 0;
+    for(size_t i = 0; i < f.index.size(); i++) {
+        if(rand() % 8 == 0) color = rand() % 4 == 0 ? f.transparent : rand() & 0xFF;
+        f.index[i] = color;
+    }
+    return f;
+}
+
+// 与设备上第一遍播放相同的流程: 画到面板的同时录制
+static void drawAndRecord(const Frame& f, Frame* prev, SimPanel& panel, Recording& rec) {
+    uint8_t op[ANIM_OP_FILL_SIZE];
+    if(prev && prev->disposal == 2) {
+        panel.fill(prev->x, prev->y, prev->w, prev->h);
+        rec.append(op, animOpFill(op, prev->x, prev->y, prev->w, prev->h));
+    }
+    uint16_t line[PANEL_W];
+    for(int r = 0; r < f.h; r++) {
+        int16_t y = f.y + r;
+        animSplitRuns(f.index.data() + r * f.w, f.w, f.hasTransparency, f.transparent, palette, line,
+                      [&](int start, uint16_t n) {
+            uint8_t run[ANIM_OP_RUN_SIZE];
+            rec.append(run, animOpRun(run, f.x + start, y, n));
+            rec.append(line, n * sizeof(uint16_t));
+            panel.run(f.x + start, y, n, line);
+        });
+    }
+    rec.append(op, animOpEnd(op, f.delayMs));
+}
+
+// 逐像素合成的参考画面
+static void compose(const Frame& f, const Frame* prev, uint16_t* ref) {
+    if(prev && prev->disposal == 2) {
+        for(int r = 0; r < prev->h; r++) {
+            for(int c = 0; c < prev->w; c++) ref[(prev->y + r) * PANEL_W + prev->x + c] = 0;
+        }
+    }
+    for(int r = 0; r < f.h; r++) {
+        for(int c = 0; c < f.w; c++) {
+            uint8_t i = f.index[r * f.w + c];
+            if(f.hasTransparency && i == f.transparent) continue;
+            ref[(f.y + r) * PANEL_W + f.x + c] = palette[i];
+        }
+    }
+}
+
+static SimPanel live, replay;
+static uint16_t ref[PANEL_W * PANEL_H];
+
+static void test_replay_matches_live(void) {
+    for(int i = 0; i < 256; i++) palette[i] = rand() & 0xFFFF;
+    memset(live.px, 0, sizeof(live.px));
+    memset(replay.px, 0, sizeof(replay.px));
+    memset(ref, 0, sizeof(ref));
+    
+    std::vector<Frame> frames;
+    Recording rec;
+    for(int i = 0; i < FRAMES; i++) {
+        frames.push_back(randomFrame());
+        Frame* prev = i > 0 ? &frames[i - 1] : NULL;
+        drawAndRecord(frames[i], prev, live, rec);
+        compose(frames[i], prev, ref);
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(ref, live.px, sizeof(ref), "live");
+        
+        // 回放刚录好的这一帧, 两块面板应一致
+        uint16_t line[PANEL_W];
+        TEST_ASSERT_EQUAL(frames[i].delayMs, animReplayFrame(rec, replay, line));
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(live.px, replay.px, sizeof(ref), "replay");
+    }
+}
+
+// 录完的循环反复回放: 读到末尾回到开头, 每一轮都与在上一轮画面上继续合成的参考一致
+static void test_replay_loops(void) {
+    for(int i = 0; i < 256; i++) palette[i] = rand() & 0xFFFF;
+    std::vector<Frame> frames;
+    Recording rec;
+    memset(live.px, 0, sizeof(live.px));
+    for(int i = 0; i < FRAMES; i++) {
+        frames.push_back(randomFrame());
+        drawAndRecord(frames[i], i > 0 ? &frames[i - 1] : NULL, live, rec);
+    }
+    // 循环结束时上一帧要求恢复背景, 补录填黑(与设备一致)
+    if(frames.back().disposal == 2) {
+        uint8_t op[ANIM_OP_FILL_SIZE];
+        const Frame& f = frames.back();
+        rec.append(op, animOpFill(op, f.x, f.y, f.w, f.h));
+    }
+    
+    memset(replay.px, 0, sizeof(replay.px));
+    memset(ref, 0, sizeof(ref));
+    uint16_t line[PANEL_W];
+    for(int loop = 0; loop < 3; loop++) {
+        for(int i = 0; i < FRAMES; i++) {
+            const Frame* prev = i > 0 ? &frames[i - 1] : (loop > 0 ? &frames.back() : NULL);
+            compose(frames[i], prev, ref);
+            TEST_ASSERT_EQUAL(frames[i].delayMs, animReplayFrame(rec, replay, line));
+            TEST_ASSERT_EQUAL_MEMORY(ref, replay.px, sizeof(ref));
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_replay_matches_live);
+    RUN_TEST(test_replay_loops);
+    return UNITY_END();
+}
@@ -0,0 +1,119 @@
+// 淡入淡出的混合内核: 打包乘法与逐通道参考实现结果一致, 以及各实现在过渡条带上的吞吐
+// 运行: pio test -e native -f test_blend
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <pixel_kernels.h>
+
+// 与src/main.cpp中的过渡条带一致
+#define STRIP_PIXELS (240 * 16)
+#define FRAME_STRIPS 20
+
+static uint16_t from[STRIP_PIXELS], to[STRIP_PIXELS], out[STRIP_PIXELS];
+
+void setUp(void) {
+    srand(30);
+}
+
+void tearDown(void) {}
+
+// 逐通道参考: c = bg + (fg - bg) * alpha / 32, 向下取整
+static int channelBlend(int fg, int bg, int alpha) {
+    int d = (fg - bg) * alpha;
+    return bg + (d >= 0 ? d / 32 : -((-d + 31) / 32));
+}
+
+static uint16_t referenceBlend(uint16_t fg, uint16_t bg, int alpha) {
+    int r = channelBlend(fg >> 11, bg >> 11, alpha);
+    int g = channelBlend((fg >> 5) & 0x3F, (bg >> 5) & 0x3F, alpha);
+    int b = channelBlend(fg & 0x1F, bg & 0x1F, alpha);
+    return (r << 11) | (g << 5) | b;
+}
+
+static uint16_t swap16(uint16_t v) {
+    return (v >> 8) | (v << 8);
+}
+
+static void randomFill(uint16_t* buf, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) buf[i] = rand() & 0xFFFF;
+}
+
+static void test_blend565_matches_per_channel(void) {
+    for(int i = 0; i < 4000000; i++) {
+        uint16_t fg = rand() & 0xFFFF, bg = rand() & 0xFFFF;
+        uint8_t alpha = rand() % 33;
+        if(blend565(fg, bg, alpha) != referenceBlend(fg, bg, alpha)) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "fg %04X bg %04X alpha %u", fg, bg, alpha);
+            TEST_FAIL_MESSAGE(msg);
+        }
+    }
+}
+
+// 过渡里的用法: 目标是上一张(已交换字节), 源是下一张, alpha随进度从0到32
+static void test_strip_blend_every_alpha(void) {
+    for(int impl = 0; impl < PIXEL_KERNEL_IMPLS; impl++) {
+        for(int alpha = 0; alpha <= 32; alpha++) {
+            randomFill(from, STRIP_PIXELS);
+            randomFill(to, STRIP_PIXELS);
+            memcpy(out, from, sizeof(out));
+            pixelKernels[impl].blend(out, to, STRIP_PIXELS, alpha);
+            for(int i = 0; i < STRIP_PIXELS; i++) {
+                uint16_t expected = swap16(referenceBlend(swap16(to[i]), swap16(from[i]), alpha));
+                if(out[i] != expected) TEST_FAIL_MESSAGE(pixelKernels[impl].name);
+            }
+        }
+    }
+}
+
+// 浮点混合作对比基准
+static void floatBlend(uint16_t* dst, const uint16_t* src, uint32_t count, uint8_t alpha) {
+    float a = alpha / 32.0f;
+    for(uint32_t i = 0; i < count; i++) {
+        uint16_t fg = swap16(src[i]), bg = swap16(dst[i]);
+        int r = (bg >> 11) + ((fg >> 11) - (bg >> 11)) * a;
+        int g = ((bg >> 5) & 0x3F) + (((fg >> 5) & 0x3F) - ((bg >> 5) & 0x3F)) * a;
+        int b = (bg & 0x1F) + ((fg & 0x1F) - (bg & 0x1F)) * a;
+        dst[i] = swap16((r << 11) | (g << 5) | b);
+    }
+}
+
+// 按过渡的方式逐帧混合整屏(20个条带), 报告每种实现的像素吞吐
+static double measure(void (*blend)(uint16_t*, const uint16_t*, uint32_t, uint8_t), uint32_t* checksum) {
+    const int frames = 400;
+    auto start = std::chrono::steady_clock::now();
+    for(int f = 0; f < frames; f++) {
+        for(int s = 0; s < FRAME_STRIPS; s++) {
+            memcpy(out, from, sizeof(out));
+            blend(out, to, STRIP_PIXELS, f * 32 / frames);
+            *checksum += out[s * 97];
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (double)frames * FRAME_STRIPS * STRIP_PIXELS / secs / 1e6;
+}
+
+static void test_blend_throughput(void) {
+    randomFill(from, STRIP_PIXELS);
+    randomFill(to, STRIP_PIXELS);
+    uint32_t checksum = 0;
+    char msg[128];
+    for(int impl = 0; impl < PIXEL_KERNEL_IMPLS; impl++) {
+        double mpx = measure(pixelKernels[impl].blend, &checksum);
+        snprintf(msg, sizeof(msg), "blend %-6s %7.1f Mpx/s (%.1f MB/s)", pixelKernels[impl].name, mpx, mpx * 2);
+        TEST_MESSAGE(msg);
+    }
+    double mpx = measure(floatBlend, &checksum);
+    snprintf(msg, sizeof(msg), "blend float  %7.1f Mpx/s (%.1f MB/s) [checksum %08X]", mpx, mpx * 2, (unsigned)checksum);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_blend565_matches_per_channel);
+    RUN_TEST(test_strip_blend_every_alpha);
+    RUN_TEST(test_blend_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,123 @@
+// 色彩查找表: 三张逐通道表与逐像素浮点计算结果一致, 以及整帧上查表与不变换(跳过)、浮点的耗时
+// 运行: pio test -e native -f test_color_lut
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <color_lut.h>
+
+// 与src/main.cpp中的屏幕一致
+#define FRAME_PIXELS (240 * 320)
+
+struct ColorParams {
+    float scale;
+    uint8_t warmth;
+    float gamma;
+};
+
+// 夜间模式(亮度30%被背光承担一部分)、暖色、gamma、背光下限以下的调暗
+static const ColorParams cases[] = {
+    {1.0f, 0, 1.0f},
+    {1.0f, 60, 1.0f},
+    {0.3f, 60, 1.0f},
+    {1.0f, 0, 2.2f},
+    {0.5f, 100, 0.6f},
+    {0.05f, 30, 1.4f},
+};
+
+static uint16_t frame[FRAME_PIXELS], out[FRAME_PIXELS];
+
+void setUp(void) {
+    srand(34);
+}
+
+void tearDown(void) {}
+
+static int floatChannel(int v, int maxValue, float gain, float gamma) {
+    float f = powf((float)v / maxValue, gamma) * gain;
+    int c = (int)(f * maxValue + 0.5f);
+    return c > maxValue ? maxValue : c;
+}
+
+// 参考: 换回正常字节序, 逐通道做浮点变换后再交换
+static uint16_t floatTransform(uint16_t swapped, const ColorParams& p) {
+    uint16_t s = colorLutSwap(swapped);
+    int r = floatChannel(s >> 11, 31, p.scale, p.gamma);
+    int g = floatChannel((s >> 5) & 63, 63, p.scale * (1 - COLOR_WARM_GREEN * p.warmth / 100), p.gamma);
+    int b = floatChannel(s & 31, 31, p.scale * (1 - COLOR_WARM_BLUE * p.warmth / 100), p.gamma);
+    return colorLutSwap((r << 11) | (g << 5) | b);
+}
+
+static void floatApply(const ColorParams& p, uint16_t* px, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) px[i] = floatTransform(px[i], p);
+}
+
+// 每种设置下全部65536个像素值
+static void test_lut_matches_float(void) {
+    static uint16_t all[65536];
+    ColorLut lut;
+    for(const ColorParams& p : cases) {
+        for(uint32_t i = 0; i < 65536; i++) all[i] = i;
+        colorLutBuild(lut, p.scale, p.warmth, p.gamma);
+        colorLutApply(lut, all, 65536);
+        for(uint32_t i = 0; i < 65536; i++) {
+            if(all[i] != floatTransform(i, p)) {
+                char msg[96];
+                snprintf(msg, sizeof(msg), "px %04X scale %.2f warmth %u gamma %.1f", (unsigned)i, p.scale, p.warmth, p.gamma);
+                TEST_FAIL_MESSAGE(msg);
+            }
+        }
+    }
+}
+
+static void test_identity_settings_keep_pixels(void) {
+    static uint16_t all[65536];
+    for(uint32_t i = 0; i < 65536; i++) all[i] = i;
+    ColorLut lut;
+    colorLutBuild(lut, 1.0f, 0, 1.0f);
+    colorLutApply(lut, all, 65536);
+    for(uint32_t i = 0; i < 65536; i++) TEST_ASSERT_EQUAL_HEX16(i, all[i]);
+}
+
+// 每帧从解码结果复制到推送缓冲, 再做(或跳过)变换; 返回每帧毫秒数
+template<typename F> static double measure(F transform, uint32_t* checksum) {
+    const int frames = 200;
+    auto start = std::chrono::steady_clock::now();
+    for(int f = 0; f < frames; f++) {
+        memcpy(out, frame, sizeof(out));
+        transform(out, FRAME_PIXELS);
+        *checksum += out[f * 97];
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return secs * 1000 / frames;
+}
+
+static void test_lut_throughput(void) {
+    for(uint32_t i = 0; i < FRAME_PIXELS; i++) frame[i] = rand() & 0xFFFF;
+    const ColorParams& night = cases[2];
+    ColorLut lut;
+    colorLutBuild(lut, night.scale, night.warmth, night.gamma);
+    uint32_t checksum = 0;
+
+    double identity = measure([](uint16_t*, uint32_t) {}, &checksum);
+    double table = measure([&](uint16_t* px, uint32_t n) { colorLutApply(lut, px, n); }, &checksum);
+    double fp = measure([&](uint16_t* px, uint32_t n) { floatApply(night, px, n); }, &checksum);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "frame copy only (identity) %.3f ms", identity);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "frame copy + LUT          %.3f ms (+%.3f)", table, table - identity);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "frame copy + float        %.3f ms (+%.3f) [checksum %08X]", fp, fp - identity, (unsigned)checksum);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(table < fp);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_lut_matches_float);
+    RUN_TEST(test_identity_settings_keep_pixels);
+    RUN_TEST(test_lut_throughput);
+    return UNITY_END();
+}
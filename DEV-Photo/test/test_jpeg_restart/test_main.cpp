@@ -0,0 +1,192 @@
+// 双核JPEG解码的拆分: 文件头解析, 拆分点落在重启边界上且最靠近中间, 两个片段的输入流
+// (改写高度 + 重新编号的RST标记)与直接生成的独立JPEG逐字节一致, 与读取分块大小无关.
+// tjpgd依赖Arduino, 这里用结构相同的合成JPEG, 不做像素级解码
+// 运行: pio test -e native -f test_jpeg_restart
+#include <unity.h>
+#include <stdlib.h>
+#include <vector>
+#include <jpeg_restart.h>
+
+typedef std::vector<uint8_t> Bytes;
+
+void setUp(void) {
+    srand(27);
+}
+
+void tearDown(void) {}
+
+// 每个重启间隔的熵编码数据: 随机字节, 0xFF按规范填充0x00
+static std::vector<Bytes> makeIntervals(int count) {
+    std::vector<Bytes> intervals(count);
+    for(int i = 0; i < count; i++) {
+        int n = 20 + rand() % 200;
+        for(int k = 0; k < n; k++) {
+            uint8_t b = rand() & 0xFF;
+            intervals[i].push_back(b);
+            if(b == 0xFF) intervals[i].push_back(0x00);
+        }
+    }
+    return intervals;
+}
+
+// 合成文件头 + 从first开始的各间隔(RST从0编号), hv为Y分量采样因子, dri为0时没有DRI段
+static Bytes makeJpeg(uint16_t w, uint16_t h, uint8_t hv, uint16_t dri, const std::vector<Bytes>& intervals,
+                      size_t first, size_t* heightPos = NULL, size_t* scanStart = NULL) {
+    Bytes out = {0xFF, 0xD8};
+    // DQT(内容无关)
+    out.insert(out.end(), {0xFF, 0xDB, 0x00, 0x06, 0x00, 1, 2, 3});
+    if(heightPos) *heightPos = out.size() + 5;
+    out.insert(out.end(), {0xFF, 0xC0, 0x00, 17, 8, (uint8_t)(h >> 8), (uint8_t)h, (uint8_t)(w >> 8), (uint8_t)w,
+                           3, 1, hv, 0, 2, 0x11, 1, 3, 0x11, 1});
+    if(dri) out.insert(out.end(), {0xFF, 0xDD, 0x00, 0x04, (uint8_t)(dri >> 8), (uint8_t)dri});
+    out.insert(out.end(), {0xFF, 0xDA, 0x00, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0});
+    if(scanStart) *scanStart = out.size();
+    for(size_t i = first; i < intervals.size(); i++) {
+        if(i > first) {
+            out.push_back(0xFF);
+            out.push_back(0xD0 | ((i - first - 1) & 7));
+        }
+        out.insert(out.end(), intervals[i].begin(), intervals[i].end());
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+    return out;
+}
+
+// 按随机大小分块读出整个片段, 其中夹杂跳过(buf为NULL)的读取
+static void readAll(JpegSliceStream stream, size_t total, Bytes& out) {
+    out.assign(total, 0);
+    size_t pos = 0;
+    while(pos < total) {
+        size_t n = 1 + rand() % 64;
+        if(n > total - pos) n = total - pos;
+        TEST_ASSERT_EQUAL(n, stream.read(out.data() + pos, n));
+        pos += n;
+    }
+    uint8_t tail;
+    TEST_ASSERT_EQUAL(0, stream.read(&tail, 1));
+}
+
+static void test_parse_header(void) {
+    std::vector<Bytes> intervals = makeIntervals(20);
+    size_t heightPos, scanStart;
+    Bytes jpg = makeJpeg(240, 320, 0x22, 15, intervals, 0, &heightPos, &scanStart);
+    JpegInfo info;
+    TEST_ASSERT_TRUE(parseJpegHeader(jpg.data(), jpg.size(), &info));
+    TEST_ASSERT_EQUAL(240, info.width);
+    TEST_ASSERT_EQUAL(320, info.height);
+    TEST_ASSERT_EQUAL(16, info.mcuW);
+    TEST_ASSERT_EQUAL(16, info.mcuH);
+    TEST_ASSERT_EQUAL(15, info.restartInterval);
+    TEST_ASSERT_EQUAL(heightPos, info.sofHeightPos);
+    TEST_ASSERT_EQUAL(scanStart, info.scanStart);
+    
+    // 渐进式不支持
+    Bytes progressive = jpg;
+    progressive[heightPos - 4] = 0xC2;
+    TEST_ASSERT_FALSE(parseJpegHeader(progressive.data(), progressive.size(), &info));
+}
+
+// 各种尺寸/采样/间隔组合: 拆分点必须落在间隔边界上, 且没有更靠近中间的边界
+static void test_split_is_nearest_boundary(void) {
+    const uint8_t hvs[] = {0x11, 0x21, 0x22};
+    for(int round = 0; round < 200; round++) {
+        uint16_t w = 16 + rand() % 400, h = 16 + rand() % 400;
+        uint8_t hv = hvs[rand() % 3];
+        uint16_t mcuW = 8 * (hv >> 4), mcuH = 8 * (hv & 0x0F);
+        uint16_t perRow = (w + mcuW - 1) / mcuW, rows = (h + mcuH - 1) / mcuH;
+        uint16_t dri = 1 + rand() % (2 * perRow);
+        int count = (perRow * rows + dri - 1) / dri;
+        Bytes jpg = makeJpeg(w, h, hv, dri, makeIntervals(count), 0);
+        JpegInfo info;
+        TEST_ASSERT_TRUE(parseJpegHeader(jpg.data(), jpg.size(), &info));
+        
+        int expected = -1;
+        for(int r = 1; r < rows; r++) {
+            if((r * perRow) % dri != 0) continue;
+            if(expected < 0 || abs(r - rows / 2) < abs(expected - rows / 2)) expected = r;
+        }
+        size_t splitPos;
+        uint16_t splitY;
+        uint8_t rstShift;
+        bool found = findRestartSplit(jpg.data(), jpg.size(), info, &splitPos, &splitY, &rstShift);
+        TEST_ASSERT_EQUAL(expected >= 0, found);
+        if(!found) continue;
+        TEST_ASSERT_EQUAL(expected * mcuH, splitY);
+        uint32_t k = expected * perRow / dri;
+        TEST_ASSERT_EQUAL(k & 7, rstShift);
+        // 拆分点紧跟第k个RST标记
+        TEST_ASSERT_EQUAL(0xFF, jpg[splitPos - 2]);
+        TEST_ASSERT_EQUAL(0xD0 | ((k - 1) & 7), jpg[splitPos - 1]);
+    }
+}
+
+static void test_no_dri_no_split(void) {
+    Bytes jpg = makeJpeg(240, 320, 0x22, 0, makeIntervals(1), 0);
+    JpegInfo info;
+    size_t splitPos;
+    uint16_t splitY;
+    uint8_t rstShift;
+    TEST_ASSERT_TRUE(parseJpegHeader(jpg.data(), jpg.size(), &info));
+    TEST_ASSERT_EQUAL(0, info.restartInterval);
+    TEST_ASSERT_FALSE(findRestartSplit(jpg.data(), jpg.size(), info, &splitPos, &splitY, &rstShift));
+}
+
+// 两个片段的输入流等于分别生成的两个独立JPEG: 上半部分只改高度, 下半部分另外把RST从0重新编号
+static void test_slices_are_standalone_jpegs(void) {
+    for(int round = 0; round < 50; round++) {
+        const uint16_t w = 240, h = 320, perRow = 15, rows = 20;
+        const uint16_t dri = (rand() % 2) ? perRow : 5;
+        int count = perRow * rows / dri;
+        std::vector<Bytes> intervals = makeIntervals(count);
+        Bytes jpg = makeJpeg(w, h, 0x22, dri, intervals, 0);
+        JpegInfo info;
+        size_t splitPos;
+        uint16_t splitY;
+        uint8_t rstShift;
+        TEST_ASSERT_TRUE(parseJpegHeader(jpg.data(), jpg.size(), &info));
+        TEST_ASSERT_TRUE(findRestartSplit(jpg.data(), jpg.size(), info, &splitPos, &splitY, &rstShift));
+        uint32_t k = (splitY / 16) * perRow / dri;
+        
+        JpegSliceStream top = {jpg.data(), info.scanStart, jpg.data() + info.scanStart, jpg.size() - info.scanStart,
+                               0, info.sofHeightPos, splitY, 0, false};
+        JpegSliceStream bottom = {jpg.data(), info.scanStart, jpg.data() + splitPos, jpg.size() - splitPos,
+                                  0, info.sofHeightPos, (uint16_t)(h - splitY), rstShift, false};
+        
+        // 上半部分的高度截止在拆分行, 解码器读到那里就停止, 后面的数据不影响
+        Bytes topExpected = makeJpeg(w, splitY, 0x22, dri, intervals, 0);
+        Bytes topGot;
+        readAll(top, jpg.size(), topGot);
+        TEST_ASSERT_EQUAL_MEMORY(topExpected.data(), topGot.data(), topExpected.size());
+        
+        Bytes bottomExpected = makeJpeg(w, h - splitY, 0x22, dri, intervals, k);
+        Bytes bottomGot;
+        readAll(bottom, info.scanStart + jpg.size() - splitPos, bottomGot);
+        TEST_ASSERT_EQUAL(bottomExpected.size(), bottomGot.size());
+        TEST_ASSERT_EQUAL_MEMORY(bottomExpected.data(), bottomGot.data(), bottomExpected.size());
+    }
+}
+
+// 跳过(buf为NULL)只推进位置
+static void test_skip_advances(void) {
+    Bytes jpg = makeJpeg(240, 320, 0x22, 15, makeIntervals(20), 0);
+    JpegInfo info;
+    TEST_ASSERT_TRUE(parseJpegHeader(jpg.data(), jpg.size(), &info));
+    JpegSliceStream s = {jpg.data(), info.scanStart, jpg.data() + info.scanStart, jpg.size() - info.scanStart,
+                         0, info.sofHeightPos, 320, 0, false};
+    TEST_ASSERT_EQUAL(4, s.read(NULL, 4));
+    uint8_t b[2];
+    s.read(b, 2);
+    TEST_ASSERT_EQUAL(jpg[4], b[0]);
+    TEST_ASSERT_EQUAL(jpg[5], b[1]);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_header);
+    RUN_TEST(test_split_is_nearest_boundary);
+    RUN_TEST(test_no_dri_no_split);
+    RUN_TEST(test_slices_are_standalone_jpegs);
+    RUN_TEST(test_skip_advances);
+    return UNITY_END();
+}
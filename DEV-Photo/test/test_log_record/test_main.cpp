@@ -0,0 +1,117 @@
+// 延迟格式化的日志: 存下参数后还原的文本与直接snprintf一致; 字符串在调用时复制;
+// 参数空间不够时截断而不越界; 以及调用处存参数与直接格式化的耗时对比
+// 运行: pio test -e native -f test_log_record
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <log_record.h>
+
+#define ARGS_MAX 96
+
+static uint8_t args[ARGS_MAX];
+static char lazy[256], direct[256];
+
+void setUp(void) {
+    memset(args, 0xA5, sizeof(args));
+}
+
+void tearDown(void) {}
+
+static size_t encode(uint8_t* out, size_t cap, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t n = logEncodeArgs(out, cap, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+// 同一组参数分别走两条路径, 结果必须逐字一致
+#define CHECK_SAME(fmt, ...) do { \
+        size_t n_ = encode(args, ARGS_MAX, fmt, ##__VA_ARGS__); \
+        logFormatArgs(lazy, sizeof(lazy), fmt, args, n_); \
+        snprintf(direct, sizeof(direct), fmt, ##__VA_ARGS__); \
+        TEST_ASSERT_EQUAL_STRING(direct, lazy); \
+    } while(0)
+
+// src/main.cpp中用到的转换
+static void test_repo_formats(void) {
+    CHECK_SAME("解码耗时: %lu us (%s)%s", 123456UL, "jpegdec", " 失败");
+    CHECK_SAME("照片库: %d 张", 42);
+    CHECK_SAME("内存区 %s: %u/%u 字节", "render", 40960u, 40960u);
+    CHECK_SAME("SHA %02X%02X%02X%02X", 0x0a, 0xff, 0x00, 0x7c);
+    CHECK_SAME("%02lu:%02lu", 7UL, 5UL);
+    CHECK_SAME("空闲 %u%% 时间", 93u);
+    CHECK_SAME("并行解码错误: 上半%d 下半%d", -1, 3);
+    CHECK_SAME("没有参数");
+}
+
+static void test_other_formats(void) {
+    CHECK_SAME("%lld %llu %zu", -9000000000LL, 18000000000ULL, (size_t)77);
+    CHECK_SAME("%.2f %8.3e %g", 3.14159, -0.000123, 1e20);
+    CHECK_SAME("[%-6s|%6s] %c", "ab", "cd", 'x');
+    CHECK_SAME("%*d|%-*d|%.*s", 5, 42, 4, 7, 3, "abcdef");
+    CHECK_SAME("%#x %o %+d % d", 255u, 8u, 5, 6);
+    CHECK_SAME("%s", "");
+}
+
+// 字符串在调用时复制, 之后源缓冲被改写(例如String临时对象析构)不影响输出
+static void test_strings_are_copied(void) {
+    char name[16] = "photo-17";
+    size_t n = encode(args, ARGS_MAX, "show %s", name);
+    strcpy(name, "XXXXXXXX");
+    logFormatArgs(lazy, sizeof(lazy), "show %s", args, n);
+    TEST_ASSERT_EQUAL_STRING("show photo-17", lazy);
+}
+
+// 参数空间不够: 长字符串截断, 后面的参数丢弃, 格式化在缺参数处停止, 都不写出界
+static void test_truncation(void) {
+    char big[200];
+    memset(big, 'a', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+    uint8_t small[ARGS_MAX + 8];
+    memset(small, 0x5A, sizeof(small));
+    size_t n = encode(small, ARGS_MAX, "%d %s %d", 1, big, 2);
+    TEST_ASSERT_EQUAL(ARGS_MAX, n);
+    for(int i = ARGS_MAX; i < ARGS_MAX + 8; i++) TEST_ASSERT_EQUAL(0x5A, small[i]);
+    logFormatArgs(lazy, sizeof(lazy), "%d %s %d", small, n);
+    TEST_ASSERT_EQUAL(2 + ARGS_MAX - 4 - 1 + 1, strlen(lazy));   // "1 " + 截断的字符串 + " "
+    
+    // 输出缓冲小于文本
+    char out[8];
+    memset(out, 0x5A, sizeof(out));
+    n = encode(args, ARGS_MAX, "value %d", 123456);
+    TEST_ASSERT_EQUAL(7, logFormatArgs(out, 8, "value %d", args, n));
+    TEST_ASSERT_EQUAL_STRING("value 1", out);
+}
+
+// 调用处的耗时: 只存参数 vs 直接格式化(主机上的相对值)
+static void test_caller_cost(void) {
+    const int runs = 200000;
+    volatile size_t sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for(int i = 0; i < runs; i++) {
+        sink += encode(args, ARGS_MAX, "解码耗时: %lu us (%s)%s", (unsigned long)i * 37, "jpegdec", "");
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for(int i = 0; i < runs; i++) {
+        sink += snprintf(direct, sizeof(direct), "解码耗时: %lu us (%s)%s", (unsigned long)i * 37, "jpegdec", "");
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    double encodeNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / runs;
+    double formatNs = std::chrono::duration<double, std::nano>(t2 - t1).count() / runs;
+    char msg[128];
+    snprintf(msg, sizeof(msg), "caller: encode %.0f ns, snprintf %.0f ns (%.1fx)", encodeNs, formatNs, formatNs / encodeNs);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(sink > 0);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_repo_formats);
+    RUN_TEST(test_other_formats);
+    RUN_TEST(test_strings_are_copied);
+    RUN_TEST(test_truncation);
+    RUN_TEST(test_caller_cost);
+    return UNITY_END();
+}
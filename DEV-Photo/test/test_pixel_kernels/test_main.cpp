@@ -0,0 +1,112 @@
+// 像素核心: SWAR和向量实现在随机的起始偏移和长度下与标量参考实现逐像素一致
+// 运行: pio test -e native -f test_pixel_kernels
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pixel_kernels.h>
+
+#define BUF_PIXELS 1024
+#define ROUNDS 2000
+
+static uint16_t src[BUF_PIXELS + 16];
+static uint16_t ref[BUF_PIXELS + 16];
+static uint16_t out[BUF_PIXELS + 16];
+static int32_t indices[BUF_PIXELS];
+
+void setUp(void) {
+    srand(565);
+}
+
+void tearDown(void) {}
+
+static void randomFill(uint16_t* buf, uint32_t count) {
+    for(uint32_t i = 0; i < count; i++) buf[i] = rand() & 0xFFFF;
+}
+
+// 随机的起始偏移(含奇数, 即非4字节对齐)和长度(含0和不足一个字/向量的长度)
+static void randomSlice(uint32_t* offset, uint32_t* count) {
+    *offset = rand() % 8;
+    *count = rand() % 4 == 0 ? rand() % 20 : rand() % (BUF_PIXELS - 8);
+}
+
+static void test_swap_matches_scalar(void) {
+    for(int impl = 1; impl < PIXEL_KERNEL_IMPLS; impl++) {
+        for(int round = 0; round < ROUNDS; round++) {
+            uint32_t offset, count;
+            randomSlice(&offset, &count);
+            randomFill(ref, BUF_PIXELS + 16);
+            memcpy(out, ref, sizeof(out));
+            pxSwapScalar(ref + offset, count);
+            pixelKernels[impl].swap(out + offset, count);
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(ref, out, sizeof(out), pixelKernels[impl].name);
+        }
+    }
+}
+
+static void test_fill_matches_scalar(void) {
+    for(int impl = 1; impl < PIXEL_KERNEL_IMPLS; impl++) {
+        for(int round = 0; round < ROUNDS; round++) {
+            uint32_t offset, count;
+            randomSlice(&offset, &count);
+            uint16_t color = rand() & 0xFFFF;
+            randomFill(ref, BUF_PIXELS + 16);
+            memcpy(out, ref, sizeof(out));
+            pxFillScalar(ref + offset, count, color);
+            pixelKernels[impl].fill(out + offset, count, color);
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(ref, out, sizeof(out), pixelKernels[impl].name);
+        }
+    }
+}
+
+// 源和目标的对齐各自随机, 包括两者对齐不同的情况
+static void test_blend_matches_scalar(void) {
+    for(int impl = 1; impl < PIXEL_KERNEL_IMPLS; impl++) {
+        for(int round = 0; round < ROUNDS; round++) {
+            uint32_t offset, count;
+            randomSlice(&offset, &count);
+            uint32_t srcOffset = rand() % 8;
+            uint8_t alpha = rand() % 33;
+            randomFill(src, BUF_PIXELS + 16);
+            randomFill(ref, BUF_PIXELS + 16);
+            memcpy(out, ref, sizeof(out));
+            pxBlendScalar(ref + offset, src + srcOffset, count, alpha);
+            pixelKernels[impl].blend(out + offset, src + srcOffset, count, alpha);
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(ref, out, sizeof(out), pixelKernels[impl].name);
+        }
+    }
+}
+
+static void test_gather_matches_scalar(void) {
+    for(int impl = 1; impl < PIXEL_KERNEL_IMPLS; impl++) {
+        for(int round = 0; round < ROUNDS; round++) {
+            uint32_t offset, count;
+            randomSlice(&offset, &count);
+            for(uint32_t i = 0; i < count; i++) indices[i] = rand() % BUF_PIXELS;
+            randomFill(src, BUF_PIXELS);
+            randomFill(ref, BUF_PIXELS + 16);
+            memcpy(out, ref, sizeof(out));
+            pxGatherScalar(ref + offset, src, indices, count);
+            pixelKernels[impl].gather(out + offset, src, indices, count);
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(ref, out, sizeof(out), pixelKernels[impl].name);
+        }
+    }
+}
+
+// 混合的端点: alpha为0时保持目标, 为32时等于源
+static void test_blend_endpoints(void) {
+    for(int i = 0; i < 1000; i++) {
+        uint16_t fg = rand() & 0xFFFF, bg = rand() & 0xFFFF;
+        TEST_ASSERT_EQUAL_UINT16(bg, blend565(fg, bg, 0));
+        TEST_ASSERT_EQUAL_UINT16(fg, blend565(fg, bg, 32));
+    }
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_swap_matches_scalar);
+    RUN_TEST(test_fill_matches_scalar);
+    RUN_TEST(test_blend_matches_scalar);
+    RUN_TEST(test_gather_matches_scalar);
+    RUN_TEST(test_blend_endpoints);
+    return UNITY_END();
+}
@@ -0,0 +1,86 @@
+// 功耗策略: 各状态的节拍和频率, 无操作后调暗/降速, 最近有HTTP请求时不限速, 以及节拍计时
+// 运行: pio test -e native -f test_power_policy
+#include <unity.h>
+#include <power_policy.h>
+
+#define QUIET (POWER_REQUEST_BURST_MS + 1)   // 很久没有HTTP请求
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_busy_is_unthrottled(void) {
+    PowerPolicy p = powerPolicy(POWER_BUSY, IDLE_DEEP_MS, QUIET);
+    TEST_ASSERT_EQUAL(0, p.fps);
+    TEST_ASSERT_EQUAL(240, p.cpuMhz);
+    TEST_ASSERT_FALSE(p.dim);
+}
+
+// 越安静的状态节拍越低, 静态照片时CPU降到WiFi允许的最低频率
+static void test_states_order(void) {
+    PowerPolicy anim = powerPolicy(POWER_ANIMATION, 0, QUIET);
+    PowerPolicy dynamic = powerPolicy(POWER_DYNAMIC, 0, QUIET);
+    PowerPolicy still = powerPolicy(POWER_STATIC, 0, QUIET);
+    TEST_ASSERT_TRUE(anim.fps > dynamic.fps);
+    TEST_ASSERT_TRUE(dynamic.fps > still.fps);
+    TEST_ASSERT_TRUE(still.fps > 0);
+    TEST_ASSERT_EQUAL(80, still.cpuMhz);
+    TEST_ASSERT_TRUE(anim.cpuMhz >= dynamic.cpuMhz);
+}
+
+static void test_idle_dims_and_slows_standby(void) {
+    TEST_ASSERT_FALSE(powerPolicy(POWER_STATIC, IDLE_DIM_MS - 1, QUIET).dim);
+    TEST_ASSERT_TRUE(powerPolicy(POWER_STATIC, IDLE_DIM_MS, QUIET).dim);
+    PowerPolicy awake = powerPolicy(POWER_STANDBY, 0, QUIET);
+    PowerPolicy deep = powerPolicy(POWER_STANDBY, IDLE_DEEP_MS, QUIET);
+    TEST_ASSERT_TRUE(deep.fps < awake.fps);
+    TEST_ASSERT_TRUE(deep.cpuMhz < awake.cpuMhz);
+    TEST_ASSERT_TRUE(deep.dim);
+}
+
+// 刚处理过请求时每个状态都不限速(频率和调暗不变), 过了窗口恢复节拍
+static void test_recent_request_skips_pacing(void) {
+    const PowerState states[] = {POWER_STANDBY, POWER_STATIC, POWER_DYNAMIC, POWER_ANIMATION};
+    for(PowerState s : states) {
+        PowerPolicy burst = powerPolicy(s, IDLE_DIM_MS, 0);
+        PowerPolicy edge = powerPolicy(s, IDLE_DIM_MS, POWER_REQUEST_BURST_MS - 1);
+        PowerPolicy quiet = powerPolicy(s, IDLE_DIM_MS, POWER_REQUEST_BURST_MS);
+        TEST_ASSERT_EQUAL(0, burst.fps);
+        TEST_ASSERT_EQUAL(0, edge.fps);
+        TEST_ASSERT_TRUE(quiet.fps > 0);
+        TEST_ASSERT_EQUAL(quiet.cpuMhz, burst.cpuMhz);
+        TEST_ASSERT_EQUAL(quiet.dim, burst.dim);
+    }
+}
+
+static void test_wait_is_bounded(void) {
+    TEST_ASSERT_EQUAL(0, powerWaitMs(1000, 1000, 100));
+    TEST_ASSERT_EQUAL(0, powerWaitMs(1000, 900, 100));
+    TEST_ASSERT_EQUAL(40, powerWaitMs(1000, 1040, 100));
+    TEST_ASSERT_EQUAL(100, powerWaitMs(1000, 5000, 100));
+    // millis()回绕
+    TEST_ASSERT_EQUAL(30, powerWaitMs(0xFFFFFFF0UL, 0x0000000EUL, 100));
+}
+
+// 按节拍累加不漂移; 落后太多时从现在重新计时
+static void test_deadline(void) {
+    uint32_t deadline = 1000;
+    for(int i = 0; i < 10; i++) {
+        uint32_t now = deadline + 7;    // 每次都晚醒来一点
+        deadline = powerNextDeadline(now, deadline, 100);
+    }
+    TEST_ASSERT_EQUAL(2000, deadline);
+    TEST_ASSERT_EQUAL(5100, powerNextDeadline(5000, 1000, 100));
+    TEST_ASSERT_EQUAL(0x00000054UL, powerNextDeadline(0xFFFFFFF0UL, 0xFFFFFFF0UL, 100));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_busy_is_unthrottled);
+    RUN_TEST(test_states_order);
+    RUN_TEST(test_idle_dims_and_slows_standby);
+    RUN_TEST(test_recent_request_skips_pacing);
+    RUN_TEST(test_wait_is_bounded);
+    RUN_TEST(test_deadline);
+    return UNITY_END();
+}
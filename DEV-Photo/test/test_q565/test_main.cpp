@@ -0,0 +1,149 @@
+// Q565: 与浏览器端encodeQ565相同算法的编码结果, 按任意分块送入解码器都能无损还原; 并测量解码吞吐.
+// TJpgDec依赖Arduino, 无法在主机上运行, JPEG一侧的MB/s由设备上的/decoder-bench给出
+// 运行: pio test -e native -f test_q565
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include <q565.h>
+
+#define W 240
+#define H 320
+
+void setUp(void) {
+    srand(26);
+}
+
+void tearDown(void) {}
+
+// 与页面脚本中的encodeQ565逐行对应, 输入为未交换字节的565
+static std::vector<uint8_t> encode(const uint16_t* px, uint16_t w, uint16_t h) {
+    std::vector<uint8_t> out = {'Q', '5', '6', '5', (uint8_t)w, (uint8_t)(w >> 8), (uint8_t)h, (uint8_t)(h >> 8)};
+    uint16_t index[64] = {0};
+    uint16_t prev = 0;
+    int run = 0;
+    for(uint32_t i = 0; i < (uint32_t)w * h; i++) {
+        uint16_t p = px[i];
+        int r = p >> 11, g = (p >> 5) & 0x3F, b = p & 0x1F;
+        if(p == prev) {
+            if(++run == 62) {
+                out.push_back(Q565_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if(run > 0) {
+            out.push_back(Q565_OP_RUN | (run - 1));
+            run = 0;
+        }
+        uint8_t hash = q565Hash(p);
+        if(index[hash] == p) {
+            out.push_back(hash);
+        } else {
+            index[hash] = p;
+            int pr = prev >> 11, pg = (prev >> 5) & 63, pb = prev & 31;
+            int dr = ((r - pr + 16) & 31) - 16, dg = ((g - pg + 32) & 63) - 32, db = ((b - pb + 16) & 31) - 16;
+            int drg = dr - (dg >> 1), dbg = db - (dg >> 1);
+            if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out.push_back(Q565_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+            } else if(drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                out.push_back(Q565_OP_LUMA | (dg + 32));
+                out.push_back(((drg + 8) << 4) | (dbg + 8));
+            } else {
+                out.push_back(Q565_OP_RGB);
+                out.push_back(p >> 8);
+                out.push_back(p & 0xFF);
+            }
+        }
+        prev = p;
+    }
+    if(run > 0) out.push_back(Q565_OP_RUN | (run - 1));
+    return out;
+}
+
+// 类似照片的测试图: 平滑渐变加噪声, 中间有纯色块(产生重复和索引操作码)
+static void photoLike(uint16_t* px, int noise) {
+    for(int y = 0; y < H; y++) {
+        for(int x = 0; x < W; x++) {
+            int r = (x * 31 / W + (noise ? rand() % noise : 0)) & 31;
+            int g = (y * 63 / H + (noise ? rand() % noise : 0)) & 63;
+            int b = ((x + y) * 31 / (W + H)) & 31;
+            if(x > 60 && x < 120 && y > 100 && y < 180) r = g = b = 0;
+            px[y * W + x] = (r << 11) | (g << 5) | b;
+        }
+    }
+}
+
+// 按给定的分块大小送入, 输出也分成不定长的段, 检查跨块的操作码和重复
+static bool decodeChunked(const std::vector<uint8_t>& data, uint16_t* out, size_t chunk) {
+    Q565Decoder dec;
+    dec.reset();
+    size_t pos = Q565_HEADER_SIZE, n = 0;
+    const size_t total = W * H;
+    while(n < total) {
+        size_t len = pos + chunk <= data.size() ? chunk : data.size() - pos;
+        size_t used = 0;
+        size_t want = 1 + rand() % 300;
+        size_t got = dec.decode(data.data() + pos, len, &used, out + n, want < total - n ? want : total - n);
+        pos += used;
+        n += got;
+        if(got == 0 && used == 0 && pos >= data.size() && dec.run == 0) return false;
+    }
+    return pos == data.size();
+}
+
+static void check_roundtrip(int noise) {
+    static uint16_t src[W * H], out[W * H];
+    photoLike(src, noise);
+    std::vector<uint8_t> data = encode(src, W, H);
+    const size_t chunks[] = {1, 2, 3, 7, 512, data.size()};
+    for(size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        memset(out, 0, sizeof(out));
+        TEST_ASSERT_TRUE(decodeChunked(data, out, chunks[c]));
+        // 解码输出是交换过字节的
+        pxSwapScalar(out, W * H);
+        TEST_ASSERT_EQUAL_MEMORY(src, out, sizeof(src));
+    }
+}
+
+static void test_roundtrip_smooth(void) {
+    check_roundtrip(0);
+}
+
+static void test_roundtrip_noisy(void) {
+    check_roundtrip(4);
+}
+
+static void test_roundtrip_random(void) {
+    static uint16_t src[W * H], out[W * H];
+    for(int i = 0; i < W * H; i++) src[i] = rand() % 4 == 0 ? src[i > 0 ? i - 1 : 0] : rand() & 0xFFFF;
+    std::vector<uint8_t> data = encode(src, W, H);
+    TEST_ASSERT_TRUE(decodeChunked(data, out, 97));
+    pxSwapScalar(out, W * H);
+    TEST_ASSERT_EQUAL_MEMORY(src, out, sizeof(src));
+}
+
+// 解码吞吐: 输出字节(整屏153600字节)每秒, 与设备上读文件时相同的512字节输入块
+static void test_decode_throughput(void) {
+    static uint16_t src[W * H], out[W * H];
+    photoLike(src, 4);
+    std::vector<uint8_t> data = encode(src, W, H);
+    const int runs = 50;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < runs; i++) TEST_ASSERT_TRUE(decodeChunked(data, out, 512));
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Q565 %u bytes (%.1f%% of raw), decode %.1f MB/s output",
+             (unsigned)data.size(), data.size() * 100.0 / (W * H * 2), runs * W * H * 2 / secs / 1e6);
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_roundtrip_smooth);
+    RUN_TEST(test_roundtrip_noisy);
+    RUN_TEST(test_roundtrip_random);
+    RUN_TEST(test_decode_throughput);
+    return UNITY_END();
+}
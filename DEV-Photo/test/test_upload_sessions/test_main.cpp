@@ -0,0 +1,391 @@
+// 分块上传的会话: 四个客户端交错上传(含中途断开、CRC错误和重发), 写入者不超过上限,
+// 每个文件逐字节拼接正确, 结束后不留块文件; Retry-After估计、超时会话的回收和会话id的校验;
+// 以及页面客户端在丢包链路上的完成率和请求数
+// 运行: pio test -e native -f test_upload_sessions
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <upload_sessions.h>
+
+#define CLIENTS 4               // 与src/main.cpp中的MAX_CONNECTIONS一致
+
+typedef std::vector<uint8_t> Bytes;
+
+// 内存中的文件系统
+struct MemStore {
+    std::map<std::string, Bytes> files;
+    const Bytes* reading = NULL;
+    size_t pos = 0;
+
+    bool open(const char* path) {
+        auto it = files.find(path);
+        reading = it == files.end() ? NULL : &it->second;
+        pos = 0;
+        return reading != NULL;
+    }
+
+    size_t read(uint8_t* buf, size_t n) {
+        if(!reading) return 0;
+        if(n > reading->size() - pos) n = reading->size() - pos;
+        memcpy(buf, reading->data() + pos, n);
+        pos += n;
+        return n;
+    }
+
+    void close() {
+        reading = NULL;
+    }
+
+    void remove(const char* path) {
+        files.erase(path);
+    }
+
+    void rename(const char* from, const char* to) {
+        auto it = files.find(from);
+        if(it == files.end()) return;
+        files[to] = it->second;
+        files.erase(it);
+    }
+};
+
+struct Client {
+    char key[UPLOAD_KEY_MAX + 1];
+    Bytes data;
+    Bytes received;             // 拼接结果
+    std::vector<uint16_t> order;    // 待发送的块, 按发送顺序
+    uint32_t retryAt;
+    bool done;
+};
+
+static UploadTable<CLIENTS> table;
+static MemStore store;
+static uint32_t now;
+
+void setUp(void) {
+    srand(48);
+    memset(&table, 0, sizeof(table));
+    store.files.clear();
+    now = 1000;
+}
+
+void tearDown(void) {}
+
+static void fill(Bytes& b, uint32_t size) {
+    b.resize(size);
+    for(uint32_t i = 0; i < size; i++) b[i] = rand() & 0xFF;
+}
+
+static uint32_t chunkCount(uint32_t total) {
+    return (total + UPLOAD_CHUNK_SIZE - 1) / UPLOAD_CHUNK_SIZE;
+}
+
+// 客户端发送一个块; 返回HTTP状态码
+static int sendChunk(Client& c, uint16_t index, int fault) {
+    uint32_t start = (uint32_t)index * UPLOAD_CHUNK_SIZE;
+    uint32_t len = c.data.size() - start < UPLOAD_CHUNK_SIZE ? c.data.size() - start : UPLOAD_CHUNK_SIZE;
+    UploadChunk chunk;
+    int status = table.beginChunk(c.key, start, start + len - 1, c.data.size(), 0, now, store, &chunk);
+    if(status != 200 || chunk.session->state == SESSION_DONE) return status;
+
+    char temp[UPLOAD_PATH_MAX];
+    chunk.session->chunkPath(temp, chunk.index, true);
+    Bytes& file = store.files[temp];
+    if(fault == 1) {
+        // 中途断开: 只收到一部分
+        file.assign(c.data.begin() + start, c.data.begin() + start + len / 2);
+        uploadAbortChunk(chunk, store);
+        return 0;
+    }
+    file.assign(c.data.begin() + start, c.data.begin() + start + len);
+    table.admission.recordWrite(len, len / 200);    // 约200KB/s
+    status = uploadEndChunk(chunk, len, fault != 2, store);
+    if(status == 200 && chunk.session->allCommitted()) {
+        uint8_t buf[512];
+        bool ok = uploadReadChunks(*chunk.session, store, buf, sizeof(buf), true, [&](const uint8_t* data, size_t n) {
+            c.received.insert(c.received.end(), data, data + n);
+            return true;
+        });
+        if(!ok) return 500;
+        chunk.session->complete(1, now);
+    }
+    return status;
+}
+
+#define ROUNDS 10
+
+struct SimStats {
+    int aborted, corrupted, resent, busy, maxWriters;
+    uint32_t admitted;
+} sim;
+
+// 一轮: 随机的文件大小、发送顺序、断开和CRC错误
+static void simulateRound(void) {
+    memset(&table, 0, sizeof(table));
+    store.files.clear();
+    const char* keys[CLIENTS] = {"a1", "b2c3", "0000ffff", "7"};
+    Client clients[CLIENTS];
+    for(int i = 0; i < CLIENTS; i++) {
+        Client& c = clients[i];
+        strcpy(c.key, keys[i]);
+        fill(c.data, 50 * 1024 + rand() % (200 * 1024));
+        c.received.clear();
+        c.order.clear();
+        for(uint16_t k = 0; k < chunkCount(c.data.size()); k++) c.order.push_back(k);
+        // 少量乱序
+        for(size_t k = 1; k < c.order.size(); k += 3) std::swap(c.order[k], c.order[k - 1]);
+        c.retryAt = 0;
+        c.done = false;
+    }
+
+    int busy = 0;
+    for(int step = 0; step < 100000; step++) {
+        int pending = 0;
+        uint32_t nextRetry = UINT32_MAX;
+        for(Client& c : clients) {
+            if(c.done) continue;
+            pending++;
+            if(c.retryAt > now && c.retryAt < nextRetry) nextRetry = c.retryAt;
+        }
+        if(pending == 0) break;
+
+        Client& c = clients[rand() % CLIENTS];
+        if(c.done) continue;
+        if(c.retryAt > now) {
+            // 没有可以发送的客户端时等到最早的Retry-After
+            bool any = false;
+            for(Client& o : clients) any |= !o.done && o.retryAt <= now;
+            if(!any) now = nextRetry;
+            continue;
+        }
+        now += 1 + rand() % 40;
+
+        int roll = rand() % 100;
+        int fault = roll < 8 ? 1 : roll < 12 ? 2 : 0;
+        uint16_t index = c.order.front();
+        int status = sendChunk(c, index, fault);
+        if(status == 503) {
+            uint32_t retry = table.retryAfter(now);
+            TEST_ASSERT_TRUE(retry >= 1 && retry <= UPLOAD_RETRY_MAX);
+            c.retryAt = now + retry * 1000;
+            busy++;
+        } else if(status == 0) {
+            sim.aborted++;
+        } else if(status == 422) {
+            sim.corrupted++;
+        } else {
+            TEST_ASSERT_EQUAL(200, status);
+            c.order.erase(c.order.begin());
+            // 偶尔重发已提交的块(响应丢失)
+            if(!c.order.empty() && rand() % 10 == 0) {
+                c.order.insert(c.order.begin(), index);
+                sim.resent++;
+            }
+            if(c.order.empty()) c.done = true;
+        }
+        int writers = table.writers(now);
+        if(writers > sim.maxWriters) sim.maxWriters = writers;
+        TEST_ASSERT_TRUE(writers <= UPLOAD_MAX_WRITERS);
+    }
+
+    for(Client& c : clients) {
+        TEST_ASSERT_TRUE(c.done);
+        TEST_ASSERT_EQUAL(c.data.size(), c.received.size());
+        TEST_ASSERT_EQUAL_MEMORY(c.data.data(), c.received.data(), c.data.size());
+        TEST_ASSERT_EQUAL(SESSION_DONE, table.find(c.key)->state);
+    }
+    TEST_ASSERT_EQUAL(0, store.files.size());
+    TEST_ASSERT_EQUAL(busy, table.admission.rejected);
+    sim.busy += busy;
+    sim.admitted += table.admission.admitted;
+}
+
+static void test_four_clients_interleaved(void) {
+    memset(&sim, 0, sizeof(sim));
+    for(int round = 0; round < ROUNDS; round++) {
+        simulateRound();
+        TEST_ASSERT_EQUAL(0, store.files.size());   // 本轮失败时停止
+    }
+    char msg[128];
+    snprintf(msg, sizeof(msg), "%d rounds: 503 %d, aborted %d, crc %d, resent %d, admitted %u",
+             ROUNDS, sim.busy, sim.aborted, sim.corrupted, sim.resent, (unsigned)sim.admitted);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL(UPLOAD_MAX_WRITERS, sim.maxWriters);
+    TEST_ASSERT_TRUE(sim.busy > 0 && sim.aborted > 0 && sim.corrupted > 0 && sim.resent > 0);
+}
+
+// 剩余字节数 / 实测速度, 至少1秒, 不超过上限
+static void test_retry_after_estimate(void) {
+    TEST_ASSERT_EQUAL(1, table.retryAfter(now));
+    UploadChunk chunk;
+    TEST_ASSERT_EQUAL(200, table.beginChunk("1", 0, UPLOAD_CHUNK_SIZE - 1, 40 * UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+    TEST_ASSERT_EQUAL(200, table.beginChunk("2", 0, UPLOAD_CHUNK_SIZE - 1, 40 * UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+    table.admission.recordWrite(100 * 1024, 1000000);      // 100KB/s, 两个会话共剩1280KB
+    TEST_ASSERT_EQUAL(13, table.retryAfter(now));
+    table.admission.recordWrite(0, 9000000);               // 10KB/s
+    TEST_ASSERT_EQUAL(UPLOAD_RETRY_MAX, table.retryAfter(now));
+    TEST_ASSERT_EQUAL(503, table.beginChunk("3", 0, UPLOAD_CHUNK_SIZE - 1, UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+    TEST_ASSERT_EQUAL_STRING("busy", chunk.error);
+}
+
+// 空闲超时的会话不再算作写入者, 槽位用完时被新会话替换, 它已提交的块被删除
+static void test_timed_out_session_is_replaced(void) {
+    UploadChunk chunk;
+    char temp[UPLOAD_PATH_MAX];
+    for(int i = 0; i < CLIENTS; i++) {
+        char key[2] = {(char)('a' + i), 0};
+        if(i == UPLOAD_MAX_WRITERS) now += UPLOAD_SESSION_TIMEOUT;
+        TEST_ASSERT_EQUAL(200, table.beginChunk(key, 0, UPLOAD_CHUNK_SIZE - 1, 2 * UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+        chunk.session->chunkPath(temp, 0, true);
+        store.files[temp] = Bytes(UPLOAD_CHUNK_SIZE);
+        TEST_ASSERT_EQUAL(200, uploadEndChunk(chunk, UPLOAD_CHUNK_SIZE, true, store));
+    }
+    TEST_ASSERT_EQUAL(CLIENTS, store.files.size());
+    now += UPLOAD_SESSION_TIMEOUT;
+    TEST_ASSERT_EQUAL(0, table.writers(now));
+    TEST_ASSERT_EQUAL(200, table.beginChunk("e", 0, UPLOAD_CHUNK_SIZE - 1, UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+    TEST_ASSERT_NULL(table.find("a"));      // 最久没有活动的
+    TEST_ASSERT_EQUAL(CLIENTS - 1, store.files.size());
+}
+
+// 完成的应答丢失后重发的块得到同一结果, 不重建会话也不写文件; 大小不同时才是新会话
+static void test_resend_after_complete(void) {
+    Client c;
+    strcpy(c.key, "c0ffee");
+    fill(c.data, UPLOAD_CHUNK_SIZE + 100);
+    c.received.clear();
+    TEST_ASSERT_EQUAL(200, sendChunk(c, 0, 0));
+    TEST_ASSERT_EQUAL(200, sendChunk(c, 1, 0));
+    TEST_ASSERT_EQUAL(SESSION_DONE, table.find(c.key)->state);
+    uint32_t admitted = table.admission.admitted;
+
+    TEST_ASSERT_EQUAL(200, sendChunk(c, 1, 0));
+    TEST_ASSERT_EQUAL(SESSION_DONE, table.find(c.key)->state);
+    TEST_ASSERT_EQUAL(1, table.find(c.key)->photoId);
+    TEST_ASSERT_EQUAL(0, store.files.size());
+    TEST_ASSERT_EQUAL(admitted, table.admission.admitted);
+    TEST_ASSERT_EQUAL(c.data.size(), c.received.size());
+
+    UploadChunk chunk;
+    TEST_ASSERT_EQUAL(200, table.beginChunk(c.key, 0, UPLOAD_CHUNK_SIZE - 1, 3 * UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+    TEST_ASSERT_EQUAL(SESSION_ACTIVE, chunk.session->state);
+}
+
+// id直接用在块文件名中: 只接受1-8位十六进制数
+static void test_session_id_checks(void) {
+    const char* bad[] = {"", "123456789", "../a", "..", "a/b", "a.t1", "g", "ab cd", "%2e%2e"};
+    UploadChunk chunk;
+    for(const char* key : bad) {
+        TEST_ASSERT_EQUAL_MESSAGE(400, table.beginChunk(key, 0, 99, 100, 0, now, store, &chunk), key);
+        TEST_ASSERT_EQUAL_STRING("bad id", chunk.error);
+    }
+    const char* good[] = {"0", "a1", "DEADBEEF", "0123abcd"};
+    for(const char* key : good) {
+        TEST_ASSERT_EQUAL_MESSAGE(200, table.beginChunk(key, 0, 99, 100, 0, now, store, &chunk), key);
+        table.find(key)->reset();
+    }
+    TEST_ASSERT_EQUAL(0, table.admission.rejected);
+}
+
+static void test_range_checks(void) {
+    UploadChunk chunk;
+    TEST_ASSERT_EQUAL(416, table.beginChunk("1", 1, 100, 200, 0, now, store, &chunk));
+    TEST_ASSERT_EQUAL(416, table.beginChunk("1", 0, 98, 100, 0, now, store, &chunk));
+    uint32_t tooBig = (UPLOAD_MAX_CHUNKS + 1) * UPLOAD_CHUNK_SIZE;
+    TEST_ASSERT_EQUAL(416, table.beginChunk("1", 0, UPLOAD_CHUNK_SIZE - 1, tooBig, 0, now, store, &chunk));
+    TEST_ASSERT_EQUAL(200, table.beginChunk("1", 0, UPLOAD_CHUNK_SIZE - 1, 2 * UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+    TEST_ASSERT_EQUAL(400, table.beginChunk("1", 0, UPLOAD_CHUNK_SIZE - 1, 3 * UPLOAD_CHUNK_SIZE, 0, now, store, &chunk));
+    TEST_ASSERT_EQUAL_STRING("size changed", chunk.error);
+    TEST_ASSERT_EQUAL(1, table.admission.admitted);
+}
+
+// 丢包链路上的页面客户端(uploadChunked): 每轮发送缺少的块, 之后按/upload-status的结果补发, 最多5轮.
+// 请求有30%丢失(其中一半在块传到一半时断开), 设备处理完的请求有20%应答丢失.
+// 页面的两个并发请求在设备上也是逐个处理, 模型中按顺序发送
+#define LOSSY_RUNS 100
+#define LOSSY_FILE (300 * 1024)
+#define LOSSY_DROP 30
+#define LOSSY_LOST_RESPONSE 20
+#define LOSSY_ROUNDS 5
+
+static bool lossy(int percent) {
+    return rand() % 100 < percent;
+}
+
+static void test_lossy_link(void) {
+    int completed = 0, minRequests = INT_MAX, maxRequests = 0;
+    long requestsTotal = 0;
+    for(int run = 0; run < LOSSY_RUNS; run++) {
+        memset(&table, 0, sizeof(table));
+        store.files.clear();
+        Client c;
+        snprintf(c.key, sizeof(c.key), "%x", run + 1);
+        fill(c.data, LOSSY_FILE);
+        c.received.clear();
+        std::vector<bool> done(chunkCount(LOSSY_FILE), false);
+        bool complete = false;
+        int requests = 0;
+
+        for(int round = 0; round < LOSSY_ROUNDS && !complete; round++) {
+            if(round > 0) {
+                requests++;
+                if(!lossy(LOSSY_DROP) && !lossy(LOSSY_LOST_RESPONSE)) {
+                    UploadSession* s = table.find(c.key);
+                    if(s && s->state == SESSION_DONE) {
+                        complete = true;
+                        break;
+                    }
+                    for(size_t k = 0; k < done.size(); k++) done[k] = s && s->has(k);
+                }
+            }
+            for(uint16_t k = 0; k < done.size(); k++) {
+                if(done[k]) continue;
+                now += 10;
+                requests++;
+                if(lossy(LOSSY_DROP)) {
+                    if(rand() % 2) sendChunk(c, k, 1);
+                    continue;
+                }
+                int status = sendChunk(c, k, 0);
+                if(lossy(LOSSY_LOST_RESPONSE)) continue;
+                TEST_ASSERT_EQUAL(200, status);
+                done[k] = true;
+                complete = table.find(c.key)->state == SESSION_DONE;
+            }
+        }
+
+        // 未完成时留下已提交的块(由启动时的清理删除), 但不留临时文件
+        for(auto& f : store.files) TEST_ASSERT_TRUE(f.first.find(".t") == std::string::npos);
+        if(!complete) continue;
+        TEST_ASSERT_EQUAL(0, store.files.size());
+        TEST_ASSERT_EQUAL(c.data.size(), c.received.size());
+        TEST_ASSERT_EQUAL_MEMORY(c.data.data(), c.received.data(), c.data.size());
+        completed++;
+        requestsTotal += requests;
+        if(requests < minRequests) minRequests = requests;
+        if(requests > maxRequests) maxRequests = requests;
+    }
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "lossy link, %u chunks: %d/%d complete, requests min %d avg %.1f max %d",
+             (unsigned)chunkCount(LOSSY_FILE), completed, LOSSY_RUNS, minRequests,
+             completed ? (double)requestsTotal / completed : 0.0, maxRequests);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(completed * 100 >= LOSSY_RUNS * 90);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_four_clients_interleaved);
+    RUN_TEST(test_retry_after_estimate);
+    RUN_TEST(test_timed_out_session_is_replaced);
+    RUN_TEST(test_resend_after_complete);
+    RUN_TEST(test_session_id_checks);
+    RUN_TEST(test_range_checks);
+    RUN_TEST(test_lossy_link);
+    return UNITY_END();
+}